@@ -0,0 +1,79 @@
+-- Lua core micro benchmarks, used for comparing the prebuilt libraries with the LUAMACHINE_LUA_FROM_SOURCE builds.
+-- Works both with the standalone interpreter (lua luacore.lua) and from a LuaState (RunFile), returns a table of name -> seconds
+
+local iterations = tonumber((arg and arg[1]) or 1)
+
+local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+end
+
+local benchmarks = {
+    { "calls", function()
+        return fib(27)
+    end },
+    { "numeric_loop", function()
+        local sum = 0.0
+        for i = 1, 5000000 do
+            sum = sum + (i % 7) * 0.5
+        end
+        return sum
+    end },
+    { "table_array", function()
+        local t = {}
+        for i = 1, 1000000 do
+            t[i] = i
+        end
+        local sum = 0
+        for i = 1, #t do
+            sum = sum + t[i]
+        end
+        return sum
+    end },
+    { "table_hash", function()
+        local t = {}
+        for i = 1, 200000 do
+            t["key" .. i] = i
+        end
+        local sum = 0
+        for _, v in pairs(t) do
+            sum = sum + v
+        end
+        return sum
+    end },
+    { "string_ops", function()
+        local parts = {}
+        for i = 1, 100000 do
+            parts[#parts + 1] = string.format("%d:%s", i, string.rep("x", i % 8))
+        end
+        local s = table.concat(parts, ",")
+        local count = 0
+        for _ in s:gmatch("%d+:x+") do
+            count = count + 1
+        end
+        return count
+    end },
+    { "closures_gc", function()
+        local list = {}
+        for i = 1, 300000 do
+            list[i % 1000 + 1] = function() return i end
+        end
+        collectgarbage("collect")
+        return #list
+    end },
+}
+
+local results = {}
+for _, benchmark in ipairs(benchmarks) do
+    local name, fn = benchmark[1], benchmark[2]
+    local best = math.huge
+    for _ = 1, iterations do
+        local start = os.clock()
+        fn()
+        best = math.min(best, os.clock() - start)
+    end
+    results[name] = best
+    print(string.format("%-12s %8.3f ms", name, best * 1000))
+end
+
+return results
@@ -44,7 +44,8 @@ public class LuaMachine : ModuleRules
                 "SlateCore",
                 "UMG",
                 "InputCore",
-                "BlueprintGraph"
+                "BlueprintGraph",
+                "Projects"
 				// ... add private dependencies that you statically link with here ...	
 			}
             );
@@ -60,43 +61,136 @@ public class LuaMachine : ModuleRules
         if (Target.bBuildEditor)
         {
             PrivateDependencyModuleNames.AddRange(new string[]{
-                "UnrealEd",
-                "Projects"
+                "UnrealEd"
             });
         }
 
         string ThirdPartyDirectory = System.IO.Path.Combine(ModuleDirectory, "..", "ThirdParty");
 
-        if (Target.Platform == UnrealTargetPlatform.Win64)
+        string LuaVersion = GetLuaMachineOption(Target, "LUAMACHINE_LUA_VERSION", "53");
+        if (LuaVersion != "53" && LuaVersion != "54")
         {
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "x64", "liblua53_win64.lib"));
+            throw new BuildException("Unsupported LUAMACHINE_LUA_VERSION " + LuaVersion + " (valid values are 53 and 54)");
         }
 
-        else if (Target.Platform == UnrealTargetPlatform.Mac)
-        {
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "x64", "liblua53_mac.a"));
-        }
+        bool bLua54 = LuaVersion == "54";
+        PublicDefinitions.Add(bLua54 ? "LUAMACHINE_LUA54=1" : "LUAMACHINE_LUA54=0");
+
+        // there are no prebuilt libraries for Lua 5.4
+        bool bLuaFromSource = bLua54 || GetLuaMachineOption(Target, "LUAMACHINE_LUA_FROM_SOURCE", "0") == "1";
 
-        else if (Target.Platform == UnrealTargetPlatform.Linux)
+        // LuaJIT is supported only on Linux x64, the other platforms fall back to PUC Lua
+        bool bLuaJIT = GetLuaMachineOption(Target, "LUAMACHINE_LUAJIT", "0") == "1" && Target.Platform == UnrealTargetPlatform.Linux;
+        if (bLuaJIT && bLuaFromSource)
         {
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "x64", "liblua53_linux64.a"));
+            throw new BuildException("LUAMACHINE_LUAJIT cannot be combined with LUAMACHINE_LUA_FROM_SOURCE or LUAMACHINE_LUA_VERSION=54");
         }
 
-        else if (Target.Platform == UnrealTargetPlatform.LinuxArm64)
+        PublicDefinitions.Add(bLuaJIT ? "LUAMACHINE_LUAJIT=1" : "LUAMACHINE_LUAJIT=0");
+
+        if (bLuaJIT)
         {
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARM64", "liblua53_linux_aarch64.a"));
+            // LuaJIT 2.1 headers (lua.hpp, lua.h, luaconf.h, lualib.h, lauxlib.h, luajit.h) in ThirdParty/luajit/include
+            string LuaJITLibrary = System.IO.Path.Combine(ThirdPartyDirectory, "x64", "libluajit_linux64.a");
+            if (!System.IO.File.Exists(LuaJITLibrary) || !System.IO.File.Exists(System.IO.Path.Combine(ThirdPartyDirectory, "luajit", "include", "lua.hpp")))
+            {
+                throw new BuildException("LUAMACHINE_LUAJIT is enabled but " + LuaJITLibrary + " or the LuaJIT headers cannot be found");
+            }
+
+            PublicDefinitions.Add("LUAMACHINE_LUA_FROM_SOURCE=0");
+            PublicAdditionalLibraries.Add(LuaJITLibrary);
         }
+        else if (bLuaFromSource)
+        {
+            // the official Lua sources (src/ directory of the distribution) must be copied in ThirdParty/lua/src (ThirdParty/lua54/src for 5.4)
+            string LuaSourceDirectory = System.IO.Path.Combine(ThirdPartyDirectory, bLua54 ? "lua54" : "lua", "src");
+            if (!System.IO.File.Exists(System.IO.Path.Combine(LuaSourceDirectory, "lapi.c")))
+            {
+                throw new BuildException("Building Lua from source but the Lua sources cannot be found in " + LuaSourceDirectory);
+            }
+
+            PublicDefinitions.Add("LUAMACHINE_LUA_FROM_SOURCE=1");
+            PrivateIncludePaths.Add(LuaSourceDirectory);
 
-        else if (Target.Platform == UnrealTargetPlatform.Android)
+            // API consistency checks are enabled by default only in Debug builds
+            bool bDebugConfiguration = Target.Configuration == UnrealTargetConfiguration.Debug || Target.Configuration == UnrealTargetConfiguration.DebugGame;
+            if (GetLuaMachineOption(Target, "LUAMACHINE_LUA_APICHECK", bDebugConfiguration ? "1" : "0") == "1")
+            {
+                PrivateDefinitions.Add("LUA_USE_APICHECK");
+            }
+
+            string MaxCCalls = GetLuaMachineOption(Target, "LUAMACHINE_LUAI_MAXCCALLS", null);
+            if (!string.IsNullOrEmpty(MaxCCalls))
+            {
+                PrivateDefinitions.Add("LUAI_MAXCCALLS=" + MaxCCalls);
+            }
+
+            // optional header for lua_lock/lua_unlock, luai_userstate* and other core macros
+            if (System.IO.File.Exists(System.IO.Path.Combine(LuaSourceDirectory, "luauser.h")))
+            {
+                PrivateDefinitions.Add("LUAMACHINE_LUA_USER_H=1");
+            }
+
+            // always optimize the Lua core, even in Debug builds
+            if (GetLuaMachineOption(Target, "LUAMACHINE_LUA_OPTIMIZE", "0") == "1")
+            {
+                OptimizeCode = CodeOptimization.Always;
+            }
+        }
+        else
         {
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARMv7", "liblua53_android.a"));
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARM64", "liblua53_android64.a"));
+            PublicDefinitions.Add("LUAMACHINE_LUA_FROM_SOURCE=0");
+
+            if (Target.Platform == UnrealTargetPlatform.Win64)
+            {
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "x64", "liblua53_win64.lib"));
+            }
+
+            else if (Target.Platform == UnrealTargetPlatform.Mac)
+            {
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "x64", "liblua53_mac.a"));
+            }
+
+            else if (Target.Platform == UnrealTargetPlatform.Linux)
+            {
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "x64", "liblua53_linux64.a"));
+            }
+
+            else if (Target.Platform == UnrealTargetPlatform.LinuxArm64)
+            {
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARM64", "liblua53_linux_aarch64.a"));
+            }
+
+            else if (Target.Platform == UnrealTargetPlatform.Android)
+            {
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARMv7", "liblua53_android.a"));
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARM64", "liblua53_android64.a"));
+            }
+
+            else if (Target.Platform == UnrealTargetPlatform.IOS)
+            {
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARM64", "liblua53_ios.a"));
+            }
         }
+    }
 
-        else if (Target.Platform == UnrealTargetPlatform.IOS)
+    // build-time options can be set in the project Target.cs (GlobalDefinitions.Add("LUAMACHINE_LUA_FROM_SOURCE=1");) or as environment variables
+    private static string GetLuaMachineOption(ReadOnlyTargetRules Target, string Name, string DefaultValue)
+    {
+        foreach (string Definition in Target.GlobalDefinitions)
         {
-            PublicAdditionalLibraries.Add(System.IO.Path.Combine(ThirdPartyDirectory, "ARM64", "liblua53_ios.a"));
+            if (Definition == Name)
+            {
+                return "1";
+            }
+
+            if (Definition.StartsWith(Name + "="))
+            {
+                return Definition.Substring(Name.Length + 1);
+            }
         }
 
+        string Value = System.Environment.GetEnvironmentVariable(Name);
+        return string.IsNullOrEmpty(Value) ? DefaultValue : Value;
     }
 }
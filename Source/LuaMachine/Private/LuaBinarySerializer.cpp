@@ -0,0 +1,321 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaBinarySerializer.h"
+
+enum class ELuaBinaryTag : uint8
+{
+	Nil,
+	False,
+	True,
+	Integer,
+	Number,
+	String,
+	Table,
+};
+
+static const int32 LuaBinaryMaxDepth = 64;
+
+template<typename T>
+static void LuaBinary_Write(TArray<uint8>& Data, const T Value)
+{
+	Data.Append(reinterpret_cast<const uint8*>(&Value), sizeof(T));
+}
+
+template<typename T>
+static bool LuaBinary_Read(const uint8* Data, const int64 Size, int64& Offset, T& Value)
+{
+	if (Offset + (int64)sizeof(T) > Size)
+	{
+		return false;
+	}
+	FMemory::Memcpy(&Value, Data + Offset, sizeof(T));
+	Offset += sizeof(T);
+	return true;
+}
+
+static bool LuaBinary_Serialize(lua_State* L, int Index, TArray<uint8>& Data, FString& Error, const int32 Depth)
+{
+	switch (lua_type(L, Index))
+	{
+	case LUA_TNIL:
+		Data.Add((uint8)ELuaBinaryTag::Nil);
+		return true;
+	case LUA_TBOOLEAN:
+		Data.Add((uint8)(lua_toboolean(L, Index) ? ELuaBinaryTag::True : ELuaBinaryTag::False));
+		return true;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, Index))
+		{
+			Data.Add((uint8)ELuaBinaryTag::Integer);
+			LuaBinary_Write<int64>(Data, (int64)lua_tointeger(L, Index));
+		}
+		else
+		{
+			Data.Add((uint8)ELuaBinaryTag::Number);
+			LuaBinary_Write<double>(Data, (double)lua_tonumber(L, Index));
+		}
+		return true;
+	case LUA_TSTRING:
+	{
+		size_t Length = 0;
+		const char* String = lua_tolstring(L, Index, &Length);
+		Data.Add((uint8)ELuaBinaryTag::String);
+		LuaBinary_Write<uint32>(Data, (uint32)Length);
+		Data.Append(reinterpret_cast<const uint8*>(String), Length);
+		return true;
+	}
+	case LUA_TTABLE:
+		break;
+	default:
+		Error = FString::Printf(TEXT("unable to serialize a value of type %s"), UTF8_TO_TCHAR(lua_typename(L, lua_type(L, Index))));
+		return false;
+	}
+
+	if (Depth >= LuaBinaryMaxDepth)
+	{
+		Error = TEXT("table nesting is too deep (recursive tables cannot be serialized)");
+		return false;
+	}
+
+	if (!lua_checkstack(L, 3))
+	{
+		Error = TEXT("stack overflow");
+		return false;
+	}
+
+	Index = LuaCompat_AbsIndex(L, Index);
+
+	// the sequence part is written first, so it can be rebuilt with lua_rawseti
+	const int64 ArrayLength = (int64)lua_rawlen(L, Index);
+	Data.Add((uint8)ELuaBinaryTag::Table);
+	LuaBinary_Write<uint32>(Data, (uint32)ArrayLength);
+	const int32 HashCountOffset = Data.Num();
+	LuaBinary_Write<uint32>(Data, 0);
+
+	for (int64 ArrayIndex = 1; ArrayIndex <= ArrayLength; ArrayIndex++)
+	{
+		lua_rawgeti(L, Index, ArrayIndex);
+		const bool bSuccess = LuaBinary_Serialize(L, -1, Data, Error, Depth + 1);
+		lua_pop(L, 1);
+		if (!bSuccess)
+		{
+			return false;
+		}
+	}
+
+	uint32 HashCount = 0;
+	lua_pushnil(L);
+	while (lua_next(L, Index))
+	{
+		if (lua_isinteger(L, -2))
+		{
+			const lua_Integer Key = lua_tointeger(L, -2);
+			if (Key >= 1 && Key <= ArrayLength)
+			{
+				lua_pop(L, 1);
+				continue;
+			}
+		}
+
+		if (!LuaBinary_Serialize(L, -2, Data, Error, Depth + 1) || !LuaBinary_Serialize(L, -1, Data, Error, Depth + 1))
+		{
+			lua_pop(L, 2);
+			return false;
+		}
+		HashCount++;
+		lua_pop(L, 1);
+	}
+
+	FMemory::Memcpy(Data.GetData() + HashCountOffset, &HashCount, sizeof(uint32));
+	return true;
+}
+
+static bool LuaBinary_Deserialize(lua_State* L, const uint8* Data, const int64 Size, int64& Offset, FString& Error, const int32 Depth)
+{
+	uint8 Tag = 0;
+	if (!LuaBinary_Read<uint8>(Data, Size, Offset, Tag))
+	{
+		Error = TEXT("truncated data");
+		return false;
+	}
+
+	if (!lua_checkstack(L, 3))
+	{
+		Error = TEXT("stack overflow");
+		return false;
+	}
+
+	switch ((ELuaBinaryTag)Tag)
+	{
+	case ELuaBinaryTag::Nil:
+		lua_pushnil(L);
+		return true;
+	case ELuaBinaryTag::False:
+		lua_pushboolean(L, 0);
+		return true;
+	case ELuaBinaryTag::True:
+		lua_pushboolean(L, 1);
+		return true;
+	case ELuaBinaryTag::Integer:
+	{
+		int64 Value = 0;
+		if (!LuaBinary_Read<int64>(Data, Size, Offset, Value))
+		{
+			break;
+		}
+		lua_pushinteger(L, (lua_Integer)Value);
+		return true;
+	}
+	case ELuaBinaryTag::Number:
+	{
+		double Value = 0;
+		if (!LuaBinary_Read<double>(Data, Size, Offset, Value))
+		{
+			break;
+		}
+		lua_pushnumber(L, (lua_Number)Value);
+		return true;
+	}
+	case ELuaBinaryTag::String:
+	{
+		uint32 Length = 0;
+		if (!LuaBinary_Read<uint32>(Data, Size, Offset, Length) || Offset + Length > Size)
+		{
+			break;
+		}
+		// strings are interned/copied by Lua directly from the buffer
+		lua_pushlstring(L, reinterpret_cast<const char*>(Data + Offset), Length);
+		Offset += Length;
+		return true;
+	}
+	case ELuaBinaryTag::Table:
+	{
+		uint32 ArrayLength = 0;
+		uint32 HashCount = 0;
+		if (Depth >= LuaBinaryMaxDepth || !LuaBinary_Read<uint32>(Data, Size, Offset, ArrayLength) || !LuaBinary_Read<uint32>(Data, Size, Offset, HashCount))
+		{
+			break;
+		}
+		// every value takes at least one byte, do not trust the sizes for preallocating
+		if ((int64)ArrayLength + (int64)HashCount * 2 > Size - Offset)
+		{
+			break;
+		}
+		lua_createtable(L, (int)ArrayLength, (int)HashCount);
+		for (uint32 ArrayIndex = 1; ArrayIndex <= ArrayLength; ArrayIndex++)
+		{
+			if (!LuaBinary_Deserialize(L, Data, Size, Offset, Error, Depth + 1))
+			{
+				lua_pop(L, 1);
+				return false;
+			}
+			lua_rawseti(L, -2, ArrayIndex);
+		}
+		for (uint32 HashIndex = 0; HashIndex < HashCount; HashIndex++)
+		{
+			if (!LuaBinary_Deserialize(L, Data, Size, Offset, Error, Depth + 1))
+			{
+				lua_pop(L, 1);
+				return false;
+			}
+			if (!LuaBinary_Deserialize(L, Data, Size, Offset, Error, Depth + 1))
+			{
+				lua_pop(L, 2);
+				return false;
+			}
+			if (lua_isnil(L, -2))
+			{
+				Error = TEXT("invalid nil table key");
+				lua_pop(L, 3);
+				return false;
+			}
+			lua_rawset(L, -3);
+		}
+		return true;
+	}
+	default:
+		Error = FString::Printf(TEXT("invalid tag %u"), Tag);
+		return false;
+	}
+
+	Error = TEXT("truncated data");
+	return false;
+}
+
+bool FLuaBinarySerializer::Serialize(lua_State* L, int Index, TArray<uint8>& Data, FString& Error)
+{
+	const int32 OriginalSize = Data.Num();
+	if (!LuaBinary_Serialize(L, Index, Data, Error, 0))
+	{
+		Data.SetNum(OriginalSize);
+		return false;
+	}
+	return true;
+}
+
+int32 FLuaBinarySerializer::SerializeRange(lua_State* L, int FirstIndex, TArray<uint8>& Data, FString& Error)
+{
+	FirstIndex = LuaCompat_AbsIndex(L, FirstIndex);
+	const int32 OriginalSize = Data.Num();
+	const int Top = lua_gettop(L);
+	for (int Index = FirstIndex; Index <= Top; Index++)
+	{
+		if (!LuaBinary_Serialize(L, Index, Data, Error, 0))
+		{
+			Data.SetNum(OriginalSize);
+			return -1;
+		}
+	}
+	return FMath::Max(Top - FirstIndex + 1, 0);
+}
+
+bool FLuaBinarySerializer::Deserialize(lua_State* L, const uint8* Data, const int64 Size, int64& Offset, FString& Error)
+{
+	return LuaBinary_Deserialize(L, Data, Size, Offset, Error, 0);
+}
+
+int32 FLuaBinarySerializer::DeserializeAll(lua_State* L, const uint8* Data, const int64 Size, FString& Error)
+{
+	int64 Offset = 0;
+	int32 NumValues = 0;
+	while (Offset < Size)
+	{
+		if (!LuaBinary_Deserialize(L, Data, Size, Offset, Error, 0))
+		{
+			lua_pop(L, NumValues);
+			return -1;
+		}
+		NumValues++;
+	}
+	return NumValues;
+}
+
+void FLuaBinarySerializer::WriteNil(TArray<uint8>& Data)
+{
+	Data.Add((uint8)ELuaBinaryTag::Nil);
+}
+
+void FLuaBinarySerializer::WriteBool(TArray<uint8>& Data, const bool bValue)
+{
+	Data.Add((uint8)(bValue ? ELuaBinaryTag::True : ELuaBinaryTag::False));
+}
+
+void FLuaBinarySerializer::WriteInteger(TArray<uint8>& Data, const int64 Value)
+{
+	Data.Add((uint8)ELuaBinaryTag::Integer);
+	LuaBinary_Write<int64>(Data, Value);
+}
+
+void FLuaBinarySerializer::WriteNumber(TArray<uint8>& Data, const double Value)
+{
+	Data.Add((uint8)ELuaBinaryTag::Number);
+	LuaBinary_Write<double>(Data, Value);
+}
+
+void FLuaBinarySerializer::WriteString(TArray<uint8>& Data, const FString& Value)
+{
+	FTCHARToUTF8 UTF8String(*Value);
+	Data.Add((uint8)ELuaBinaryTag::String);
+	LuaBinary_Write<uint32>(Data, (uint32)UTF8String.Length());
+	Data.Append(reinterpret_cast<const uint8*>(UTF8String.Get()), UTF8String.Length());
+}
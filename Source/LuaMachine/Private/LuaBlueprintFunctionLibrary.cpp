@@ -3,6 +3,7 @@
 #include "LuaBlueprintFunctionLibrary.h"
 #include "LuaComponent.h"
 #include "LuaMachine.h"
+#include "LuaMachineStats.h"
 #include "Runtime/Online/HTTP/Public/Interfaces/IHttpResponse.h"
 #include "Runtime/Core/Public/Math/BigInt.h"
 #include "Runtime/Core/Public/Misc/Base64.h"
@@ -23,6 +24,10 @@
 #include "Misc/FileHelper.h"
 #include "Serialization/ArrayReader.h"
 #include "TextureResource.h"
+#include "LatentActions.h"
+#include "Engine/LatentActionManager.h"
+#include "Async/Async.h"
+#include "UObject/UObjectGlobals.h"
 #include "EdGraph/EdGraphPin.h"
 #include "EdGraphSchema_K2.h"
 
@@ -115,6 +120,14 @@ void ULuaBlueprintFunctionLibrary::LuaStateReload(UObject* WorldContextObject, T
 	FLuaMachineModule::Get().GetLuaState(StateClass, WorldContextObject->GetWorld());
 }
 
+bool ULuaBlueprintFunctionLibrary::LuaStateReloadModule(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& ModuleName)
+{
+	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
+	if (!State)
+		return false;
+	return State->HotReloadModule(ModuleName);
+}
+
 FString ULuaBlueprintFunctionLibrary::Conv_LuaValueToString(const FLuaValue& Value)
 {
 	return Value.ToString();
@@ -375,6 +388,124 @@ FLuaValue ULuaBlueprintFunctionLibrary::LuaRunFile(UObject* WorldContextObject,
 	return State->RunFile(Filename, bIgnoreNonExistent);
 }
 
+/* completes the latent node when the async run has been executed on the game thread */
+class FLuaRunAsyncLatentAction : public FPendingLatentAction
+{
+public:
+	struct FResult
+	{
+		bool bCompleted = false;
+		bool bSuccess = false;
+		FLuaValue ReturnValue;
+	};
+
+	FLuaRunAsyncLatentAction(const FLatentActionInfo& LatentInfo, ULuaState* InLuaState, FLuaValue& InReturnValue, bool& bInSuccess)
+		: ExecutionFunction(LatentInfo.ExecutionFunction)
+		, OutputLink(LatentInfo.Linkage)
+		, CallbackTarget(LatentInfo.CallbackTarget)
+		, LuaState(InLuaState)
+		, ReturnValue(InReturnValue)
+		, bSuccess(bInSuccess)
+		, Result(MakeShared<FResult>())
+	{
+	}
+
+	FLuaRunAsyncCompletion GetCompletion() const
+	{
+		TSharedRef<FResult> SharedResult = Result;
+		return [SharedResult](bool bInSuccess, const FLuaValue& InReturnValue)
+		{
+			SharedResult->bCompleted = true;
+			SharedResult->bSuccess = bInSuccess;
+			SharedResult->ReturnValue = InReturnValue;
+		};
+	}
+
+	virtual void UpdateOperation(FLatentResponse& Response) override
+	{
+		if (Result->bCompleted)
+		{
+			ReturnValue = Result->ReturnValue;
+			bSuccess = Result->bSuccess;
+		}
+		// the completion is never called when the LuaState is destroyed while loading
+		else if (!LuaState.IsValid() || !LuaState->GetInternalLuaState())
+		{
+			Result->bCompleted = true;
+			ReturnValue = FLuaValue();
+			bSuccess = false;
+		}
+		Response.FinishAndTriggerIf(Result->bCompleted, ExecutionFunction, OutputLink, CallbackTarget);
+	}
+
+	static FLuaRunAsyncLatentAction* Start(UObject* WorldContextObject, const FLatentActionInfo& LatentInfo, ULuaState* LuaState, FLuaValue& ReturnValue, bool& bSuccess)
+	{
+		UWorld* World = WorldContextObject->GetWorld();
+		if (!World)
+		{
+			return nullptr;
+		}
+
+		FLatentActionManager& LatentActionManager = World->GetLatentActionManager();
+		if (LatentActionManager.FindExistingAction<FLuaRunAsyncLatentAction>(LatentInfo.CallbackTarget, LatentInfo.UUID))
+		{
+			return nullptr;
+		}
+
+		FLuaRunAsyncLatentAction* LatentAction = new FLuaRunAsyncLatentAction(LatentInfo, LuaState, ReturnValue, bSuccess);
+		LatentActionManager.AddNewAction(LatentInfo.CallbackTarget, LatentInfo.UUID, LatentAction);
+		return LatentAction;
+	}
+
+private:
+	FName ExecutionFunction;
+	int32 OutputLink;
+	FWeakObjectPtr CallbackTarget;
+	TWeakObjectPtr<ULuaState> LuaState;
+	FLuaValue& ReturnValue;
+	bool& bSuccess;
+	TSharedRef<FResult> Result;
+};
+
+void ULuaBlueprintFunctionLibrary::LuaRunFileAsync(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& Filename, const bool bIgnoreNonExistent, FLatentActionInfo LatentInfo, FLuaValue& ReturnValue, bool& bSuccess)
+{
+	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
+	if (!State)
+		return;
+
+	FLuaRunAsyncLatentAction* LatentAction = FLuaRunAsyncLatentAction::Start(WorldContextObject, LatentInfo, State, ReturnValue, bSuccess);
+	if (LatentAction)
+	{
+		State->RunFileAsync(Filename, bIgnoreNonExistent, LatentAction->GetCompletion());
+	}
+}
+
+void ULuaBlueprintFunctionLibrary::LuaRunNonContentFileAsync(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& Filename, const bool bIgnoreNonExistent, FLatentActionInfo LatentInfo, FLuaValue& ReturnValue, bool& bSuccess)
+{
+	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
+	if (!State)
+		return;
+
+	FLuaRunAsyncLatentAction* LatentAction = FLuaRunAsyncLatentAction::Start(WorldContextObject, LatentInfo, State, ReturnValue, bSuccess);
+	if (LatentAction)
+	{
+		State->RunNonContentFileAsync(Filename, bIgnoreNonExistent, LatentAction->GetCompletion());
+	}
+}
+
+void ULuaBlueprintFunctionLibrary::LuaRunCodeAssetAsync(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, ULuaCode* CodeAsset, FLatentActionInfo LatentInfo, FLuaValue& ReturnValue, bool& bSuccess)
+{
+	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
+	if (!State)
+		return;
+
+	FLuaRunAsyncLatentAction* LatentAction = FLuaRunAsyncLatentAction::Start(WorldContextObject, LatentInfo, State, ReturnValue, bSuccess);
+	if (LatentAction)
+	{
+		State->RunCodeAssetAsync(CodeAsset, LatentAction->GetCompletion());
+	}
+}
+
 FLuaValue ULuaBlueprintFunctionLibrary::LuaRunNonContentFile(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& Filename, const bool bIgnoreNonExistent)
 {
 	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
@@ -505,6 +636,32 @@ void ULuaBlueprintFunctionLibrary::LuaRunURL(UObject* WorldContextObject, TSubcl
 	State->RunURL(WorldContextObject, URL, Headers, SecurityHeader, SignaturePublicExponent, SignatureModulus, Completed);
 }
 
+void ULuaBlueprintFunctionLibrary::LuaRunJob(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<FLuaValue> Args, FLuaJobCompleted Completed)
+{
+	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
+	if (!State)
+		return;
+
+	State->RunJobAsync(FunctionName, Args, Completed);
+}
+
+void ULuaBlueprintFunctionLibrary::LuaParallelFor(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<FLuaValue> Inputs, const int32 ChunkSize, FLuaJobCompleted Completed)
+{
+	ULuaState* State = LuaGetState(WorldContextObject, StateClass);
+	if (!State)
+		return;
+
+	State->ParallelForAsync(FunctionName, Inputs, ChunkSize, Completed);
+}
+
+void ULuaBlueprintFunctionLibrary::LuaResetJobStates(TSubclassOf<ULuaState> StateClass)
+{
+	if (!StateClass)
+		return;
+
+	FLuaMachineModule::Get().GetJobSystem().ResetWorkerGroup(StateClass);
+}
+
 void ULuaBlueprintFunctionLibrary::LuaTableFillObject(FLuaValue InTable, UObject* InObject)
 {
 	if (InTable.Type != ELuaValueType::Table || !InObject)
@@ -1323,6 +1480,8 @@ bool ULuaBlueprintFunctionLibrary::LuaValueFromJson(UObject* WorldContextObject,
 
 FString ULuaBlueprintFunctionLibrary::LuaValueToJson(FLuaValue Value)
 {
+	SCOPE_CYCLE_COUNTER(STAT_LuaJsonConversion);
+
 	FString Json;
 	TSharedRef<TJsonWriter<>> JsonWriter = TJsonWriterFactory<>::Create(&Json);
 	FJsonSerializer::Serialize(Value.ToJsonValue(), "", JsonWriter);
@@ -1470,6 +1629,310 @@ bool ULuaBlueprintFunctionLibrary::LuaLoadPakFile(const FString& Filename, FStri
 	return true;
 }
 
+/* state of a LuaLoadPakFileAsync() call, the file access happens on a worker thread, the engine registration on the game thread */
+class FLuaPakFileAsyncLoad : public TSharedFromThis<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe>
+{
+public:
+	FString Filename;
+	FString Mountpoint;
+	FString ContentPath;
+	FString AssetRegistryPath;
+	FLuaPakFileLoaded Completed;
+	FLuaPakFileProgress Progress;
+
+	/*
+	 * loads run one at a time (in request order): a load can install its own PakFile platform file layer
+	 * and overrides GAllowUnversionedContentInEditor until it is finished
+	 */
+	static void Enqueue(TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe> AsyncLoad)
+	{
+		check(IsInGameThread());
+		TArray<TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe>>& Queue = GetQueue();
+		Queue.Add(AsyncLoad);
+		if (Queue.Num() == 1)
+		{
+			AsyncLoad->Start();
+		}
+	}
+
+private:
+	static TArray<TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe>>& GetQueue()
+	{
+		// the first item is the running load
+		static TArray<TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe>> Queue;
+		return Queue;
+	}
+
+	void Start()
+	{
+		StartTime = FPlatformTime::Seconds();
+		StageStartTime = StartTime;
+
+		if (!Mountpoint.StartsWith("/") || !Mountpoint.EndsWith("/"))
+		{
+			Finish(TEXT("Invalid Mountpoint, must be in the format /Name/"));
+			return;
+		}
+
+		TopPlatformFile = &FPlatformFileManager::Get().GetPlatformFile();
+		PakPlatformFile = (FPakPlatformFile*)FPlatformFileManager::Get().FindPlatformFile(TEXT("PakFile"));
+		if (!PakPlatformFile)
+		{
+			PakPlatformFile = new FPakPlatformFile();
+			if (!PakPlatformFile->Initialize(TopPlatformFile, TEXT("")))
+			{
+				delete(PakPlatformFile);
+				PakPlatformFile = nullptr;
+				Finish(TEXT("Unable to setup PakPlatformFile"));
+				return;
+			}
+			FPlatformFileManager::Get().SetPlatformFile(*PakPlatformFile);
+			bCustomPakPlatformFile = true;
+		}
+
+		ReportProgress(0, TEXT("Mounting"));
+
+		TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe> Self = AsShared();
+		Async(EAsyncExecution::ThreadPool, [Self]()
+			{
+				const bool bMounted = Self->Mount();
+				AsyncTask(ENamedThreads::GameThread, [Self, bMounted]()
+					{
+						if (bMounted)
+						{
+							Self->RegisterAssets();
+						}
+						else
+						{
+							Self->Finish(Self->Error);
+						}
+					});
+			});
+	}
+
+	IPlatformFile* TopPlatformFile = nullptr;
+	FPakPlatformFile* PakPlatformFile = nullptr;
+	bool bCustomPakPlatformFile = false;
+#if WITH_EDITOR
+	bool bRestoreUnversionedContent = false;
+	decltype(GAllowUnversionedContentInEditor) bPreviousGAllowUnversionedContentInEditor;
+#endif
+
+	FString PakFileMountPoint;
+	FArrayReader SerializedAssetData;
+	FString Error;
+
+	TArray<FAssetData> AssetData;
+	int32 NumPackages = 0;
+	int32 NumLoadedPackages = 0;
+
+	double StartTime = 0;
+	double StageStartTime = 0;
+	FString Stage;
+
+	void ReportProgress(const float Value, const FString& NewStage)
+	{
+		if (NewStage != Stage)
+		{
+			const double Now = FPlatformTime::Seconds();
+			if (!Stage.IsEmpty())
+			{
+				UE_LOG(LogLuaMachine, Log, TEXT("%s: %s took %.3f ms"), *Filename, *Stage, (Now - StageStartTime) * 1000);
+			}
+			Stage = NewStage;
+			StageStartTime = Now;
+		}
+		Progress.ExecuteIfBound(Value, Stage);
+	}
+
+	// worker thread: the pak index and the asset registry are read here
+	bool Mount()
+	{
+#if	ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION > 26
+		TRefCountPtr<FPakFile> PakFile = new FPakFile(PakPlatformFile, *Filename, false);
+		if (!PakFile->IsValid())
+#else
+		FPakFile PakFile(PakPlatformFile, *Filename, false);
+		if (!PakFile.IsValid())
+#endif
+		{
+			Error = TEXT("Unable to open PakFile");
+			return false;
+		}
+
+#if	ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION > 26
+		PakFileMountPoint = PakFile->GetMountPoint();
+#else
+		PakFileMountPoint = PakFile.GetMountPoint();
+#endif
+
+		FPaths::MakeStandardFilename(Mountpoint);
+		FPaths::MakeStandardFilename(PakFileMountPoint);
+
+#if	ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION > 26
+		PakFile->SetMountPoint(*PakFileMountPoint);
+#else
+		PakFile.SetMountPoint(*PakFileMountPoint);
+#endif
+
+		if (!PakPlatformFile->Mount(*Filename, 0, *PakFileMountPoint))
+		{
+			Error = TEXT("Unable to mount PakFile");
+			return false;
+		}
+
+		if (AssetRegistryPath.IsEmpty())
+		{
+			AssetRegistryPath = "/Plugins" + Mountpoint + "AssetRegistry.bin";
+		}
+
+		if (!FFileHelper::LoadFileToArray(SerializedAssetData, *(PakFileMountPoint + AssetRegistryPath)))
+		{
+			Error = TEXT("Unable to parse AssetRegistry file");
+			return false;
+		}
+
+		return true;
+	}
+
+	void RegisterAssets()
+	{
+		ReportProgress(0.3f, TEXT("Registering assets"));
+
+		if (ContentPath.IsEmpty())
+		{
+			ContentPath = "/Plugins" + Mountpoint + "Content/";
+		}
+
+		FString MountDestination = PakFileMountPoint + ContentPath;
+		FPaths::MakeStandardFilename(MountDestination);
+
+		FPackageName::RegisterMountPoint(Mountpoint, MountDestination);
+
+		IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+
+#if WITH_EDITOR
+		bPreviousGAllowUnversionedContentInEditor = GAllowUnversionedContentInEditor;
+		bRestoreUnversionedContent = true;
+		GAllowUnversionedContentInEditor = true;
+#endif
+
+		AssetRegistry.Serialize(SerializedAssetData);
+		SerializedAssetData.Empty();
+
+		// the AssetRegistry can only be scanned from the game thread, this blocks for the time of the scan of the mounted path
+		ReportProgress(0.35f, TEXT("Scanning assets"));
+		AssetRegistry.ScanPathsSynchronous({ Mountpoint }, true);
+
+		TArray<FAssetData> AllAssetData;
+		AssetRegistry.GetAllAssets(AllAssetData, false);
+
+		TSet<FName> PackageNames;
+		for (const FAssetData& Asset : AllAssetData)
+		{
+#if ENGINE_MAJOR_VERSION >= 5 && ENGINE_MINOR_VERSION > 0
+			if (Asset.GetObjectPathString().StartsWith(Mountpoint))
+#else
+			if (Asset.ObjectPath.ToString().StartsWith(Mountpoint))
+#endif
+			{
+				AssetData.Add(Asset);
+				PackageNames.Add(Asset.PackageName);
+			}
+		}
+
+		NumPackages = PackageNames.Num();
+		if (NumPackages == 0)
+		{
+			Finish(TEXT(""));
+			return;
+		}
+
+		ReportProgress(0.4f, TEXT("Loading assets"));
+
+		// the packages (LuaCode assets included) are loaded by the async loading thread instead of blocking on each GetAsset()
+		TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe> Self = AsShared();
+		for (const FName& PackageName : PackageNames)
+		{
+			LoadPackageAsync(PackageName.ToString(), FLoadPackageAsyncDelegate::CreateLambda([Self](const FName& LoadedPackageName, UPackage* LoadedPackage, EAsyncLoadingResult::Type Result)
+				{
+					if (Result != EAsyncLoadingResult::Succeeded)
+					{
+						UE_LOG(LogLuaMachine, Warning, TEXT("%s: unable to load package %s"), *Self->Filename, *LoadedPackageName.ToString());
+					}
+					Self->NumLoadedPackages++;
+					Self->ReportProgress(0.4f + 0.6f * Self->NumLoadedPackages / Self->NumPackages, TEXT("Loading assets"));
+					if (Self->NumLoadedPackages == Self->NumPackages)
+					{
+						Self->Finish(TEXT(""));
+					}
+				}));
+		}
+	}
+
+	void Finish(const FString& FinishError)
+	{
+		// the queue could hold the last reference
+		TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe> Self = AsShared();
+
+		TArray<FLuaValue> Assets;
+		const bool bSuccess = FinishError.IsEmpty();
+		if (bSuccess)
+		{
+			for (const FAssetData& Asset : AssetData)
+			{
+				// already loaded, this is just a lookup
+				Assets.Add(FLuaValue(Asset.GetAsset()));
+			}
+			ReportProgress(1, TEXT("Completed"));
+		}
+		else
+		{
+			UE_LOG(LogLuaMachine, Error, TEXT("%s"), *FinishError);
+		}
+
+		if (bCustomPakPlatformFile)
+		{
+			FPlatformFileManager::Get().SetPlatformFile(*TopPlatformFile);
+			delete(PakPlatformFile);
+			PakPlatformFile = nullptr;
+			bCustomPakPlatformFile = false;
+		}
+
+#if WITH_EDITOR
+		if (bRestoreUnversionedContent)
+		{
+			GAllowUnversionedContentInEditor = bPreviousGAllowUnversionedContentInEditor;
+		}
+#endif
+
+		const double LoadTime = FPlatformTime::Seconds() - StartTime;
+		UE_LOG(LogLuaMachine, Log, TEXT("%s: loaded %d assets in %.3f ms"), *Filename, Assets.Num(), LoadTime * 1000);
+
+		Completed.ExecuteIfBound(bSuccess, Assets, LoadTime);
+
+		TArray<TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe>>& Queue = GetQueue();
+		Queue.RemoveAt(0);
+		if (Queue.Num() > 0)
+		{
+			Queue[0]->Start();
+		}
+	}
+};
+
+void ULuaBlueprintFunctionLibrary::LuaLoadPakFileAsync(const FString& Filename, FString Mountpoint, FString ContentPath, FString AssetRegistryPath, FLuaPakFileLoaded Completed, FLuaPakFileProgress Progress)
+{
+	TSharedRef<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe> AsyncLoad = MakeShared<FLuaPakFileAsyncLoad, ESPMode::ThreadSafe>();
+	AsyncLoad->Filename = Filename;
+	AsyncLoad->Mountpoint = Mountpoint;
+	AsyncLoad->ContentPath = ContentPath;
+	AsyncLoad->AssetRegistryPath = AssetRegistryPath;
+	AsyncLoad->Completed = Completed;
+	AsyncLoad->Progress = Progress;
+	// the queue, the pending tasks and the package callbacks keep it alive
+	FLuaPakFileAsyncLoad::Enqueue(AsyncLoad);
+}
+
 void ULuaBlueprintFunctionLibrary::SwitchOnLuaValueType(const FLuaValue& LuaValue, ELuaValueType& LuaValueTypes)
 {
 	LuaValueTypes = LuaValue.Type;
@@ -0,0 +1,140 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaByteCodeCompiler.h"
+#include "LuaState.h"
+#include "Async/ParallelFor.h"
+#include "HAL/ThreadSafeCounter.h"
+
+// after this amount of source bytes the scratch VM is fully collected
+constexpr int64 LuaByteCodeCompilerCollectThreshold = 4 * 1024 * 1024;
+
+int FLuaByteCodeCompiler::Writer(lua_State* L, const void* Ptr, size_t Size, void* UserData)
+{
+	TArray<uint8>* Output = (TArray<uint8>*)UserData;
+	Output->Append((uint8*)Ptr, Size);
+	return 0;
+}
+
+FLuaByteCodeCompileJob::FLuaByteCodeCompileJob(const FString& InCodePath, const FString& InCode)
+	: FLuaByteCodeCompileJob()
+{
+	CodePath = InCodePath;
+	FTCHARToUTF8 UTF8Code(*InCode);
+	Code.Append((const uint8*)UTF8Code.Get(), UTF8Code.Length());
+}
+
+FLuaByteCodeCompiler::FLuaByteCodeCompiler()
+{
+	// no libs are required for parsing
+	L = FLuaAllocator::NewState();
+	BytesSinceLastCollect = 0;
+}
+
+FLuaByteCodeCompiler::~FLuaByteCodeCompiler()
+{
+	if (L)
+	{
+		lua_close(L);
+		L = nullptr;
+	}
+}
+
+bool FLuaByteCodeCompiler::Compile(const uint8* Code, const int32 CodeLength, const FString& CodePath, TArray<uint8>& ByteCode, FString& ErrorString, const bool bStripDebugInfo)
+{
+	FString FullCodePath = FString("@") + CodePath;
+
+	ByteCode.Empty();
+
+	if (luaL_loadbuffer(L, (const char*)Code, CodeLength, TCHAR_TO_ANSI(*FullCodePath)))
+	{
+		ErrorString = ANSI_TO_TCHAR(lua_tostring(L, -1));
+		lua_settop(L, 0);
+		return false;
+	}
+
+	if (LuaCompat_Dump(L, FLuaByteCodeCompiler::Writer, &ByteCode, bStripDebugInfo ? 1 : 0))
+	{
+		ErrorString = ANSI_TO_TCHAR(lua_tostring(L, -1));
+		ByteCode.Empty();
+		lua_settop(L, 0);
+		return false;
+	}
+
+	lua_settop(L, 0);
+
+	// the compiled prototypes are garbage now, avoid the scratch VM growing when compiling thousands of chunks
+	BytesSinceLastCollect += CodeLength;
+	if (BytesSinceLastCollect > LuaByteCodeCompilerCollectThreshold)
+	{
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		BytesSinceLastCollect = 0;
+	}
+
+	return true;
+}
+
+bool FLuaByteCodeCompiler::Compile(const FString& Code, const FString& CodePath, TArray<uint8>& ByteCode, FString& ErrorString, const bool bStripDebugInfo)
+{
+	FTCHARToUTF8 UTF8Code(*Code);
+	return Compile((const uint8*)UTF8Code.Get(), UTF8Code.Length(), CodePath, ByteCode, ErrorString, bStripDebugInfo);
+}
+
+bool FLuaByteCodeCompiler::Compile(FLuaByteCodeCompileJob& Job, const bool bStripDebugInfo)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	Job.Error.Empty();
+	Job.bSuccess = Compile(Job.Code.GetData(), Job.Code.Num(), Job.CodePath, Job.ByteCode, Job.Error, bStripDebugInfo);
+	Job.CompileTime = FPlatformTime::Seconds() - StartTime;
+	return Job.bSuccess;
+}
+
+void FLuaByteCodeCompiler::CompileBatch(TArray<FLuaByteCodeCompileJob>& Jobs, const bool bStripDebugInfo, int32 NumWorkers)
+{
+	if (Jobs.Num() == 0)
+	{
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	if (NumWorkers <= 0)
+	{
+		// the calling thread participates too
+		NumWorkers = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	}
+	NumWorkers = FMath::Clamp(NumWorkers, 1, Jobs.Num());
+
+	// each worker owns a scratch VM and pulls the next job, so big chunks do not stall a whole partition
+	FThreadSafeCounter NextJob;
+	ParallelFor(NumWorkers, [&](int32 WorkerIndex)
+		{
+			FLuaByteCodeCompiler Compiler;
+			for (;;)
+			{
+				const int32 JobIndex = NextJob.Increment() - 1;
+				if (JobIndex >= Jobs.Num())
+				{
+					break;
+				}
+				Compiler.Compile(Jobs[JobIndex], bStripDebugInfo);
+			}
+		}, NumWorkers == 1);
+
+	int32 Failed = 0;
+	for (const FLuaByteCodeCompileJob& Job : Jobs)
+	{
+		UE_LOG(LogLuaMachine, Verbose, TEXT("Compiled %s in %.3f ms (%d -> %d bytes)"), *Job.CodePath, Job.CompileTime * 1000, Job.Code.Num(), Job.ByteCode.Num());
+		if (!Job.bSuccess)
+		{
+			Failed++;
+		}
+	}
+
+	UE_LOG(LogLuaMachine, Log, TEXT("Compiled %d Lua chunks (%d failed) in %.3f ms using %d workers"), Jobs.Num(), Failed, (FPlatformTime::Seconds() - StartTime) * 1000, NumWorkers);
+}
+
+FLuaByteCodeCompiler& FLuaByteCodeCompiler::GetThreadCompiler()
+{
+	static thread_local FLuaByteCodeCompiler ThreadCompiler;
+	return ThreadCompiler;
+}
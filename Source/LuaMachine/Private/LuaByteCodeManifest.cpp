@@ -0,0 +1,134 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaByteCodeManifest.h"
+#include "LuaState.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
+#include "Serialization/JsonSerializer.h"
+
+constexpr int32 LuaByteCodeManifestVersion = 1;
+
+FString FLuaByteCodeManifest::GetDefaultDirectory()
+{
+	return FPaths::Combine(FPaths::ProjectContentDir(), TEXT("LuaByteCode"));
+}
+
+FString FLuaByteCodeManifest::NormalizeKey(const FString& Filename)
+{
+	FString Key = Filename;
+	FPaths::NormalizeFilename(Key);
+	FPaths::RemoveDuplicateSlashes(Key);
+	Key.RemoveFromStart(TEXT("./"));
+	Key.RemoveFromStart(TEXT("/"));
+	return Key;
+}
+
+FString FLuaByteCodeManifest::HashSource(const TArray<uint8>& Source)
+{
+	uint8 Digest[16];
+	FMD5 MD5;
+	MD5.Update(Source.GetData(), Source.Num());
+	MD5.Final(Digest);
+	return BytesToHex(Digest, 16);
+}
+
+bool FLuaByteCodeManifest::Load(const FString& ManifestDirectory)
+{
+	Directory = ManifestDirectory;
+	Entries.Empty();
+
+	FString Json;
+	if (!FFileHelper::LoadFileToString(Json, *FPaths::Combine(Directory, TEXT("Manifest.json"))))
+	{
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> JsonObject;
+	TSharedRef<TJsonReader<TCHAR>> JsonReader = TJsonReaderFactory<TCHAR>::Create(Json);
+	if (!FJsonSerializer::Deserialize(JsonReader, JsonObject) || !JsonObject.IsValid())
+	{
+		UE_LOG(LogLuaMachine, Error, TEXT("Invalid Lua bytecode manifest in %s"), *Directory);
+		return false;
+	}
+
+	if (JsonObject->GetIntegerField(TEXT("Version")) != LuaByteCodeManifestVersion)
+	{
+		UE_LOG(LogLuaMachine, Warning, TEXT("Unsupported Lua bytecode manifest version in %s, ignoring it"), *Directory);
+		return false;
+	}
+
+	const TSharedPtr<FJsonObject>* Files = nullptr;
+	if (JsonObject->TryGetObjectField(TEXT("Files"), Files))
+	{
+		for (const TPair<FString, TSharedPtr<FJsonValue>>& Pair : (*Files)->Values)
+		{
+			const TSharedPtr<FJsonObject>* File = nullptr;
+			if (!Pair.Value.IsValid() || !Pair.Value->TryGetObject(File))
+			{
+				continue;
+			}
+			FLuaByteCodeManifestEntry Entry;
+			Entry.ByteCodeFilename = (*File)->GetStringField(TEXT("ByteCode"));
+			Entry.SourceHash = (*File)->GetStringField(TEXT("Hash"));
+			Entries.Add(NormalizeKey(Pair.Key), Entry);
+		}
+	}
+
+	return true;
+}
+
+bool FLuaByteCodeManifest::Save() const
+{
+	TSharedRef<FJsonObject> Files = MakeShared<FJsonObject>();
+	for (const TPair<FString, FLuaByteCodeManifestEntry>& Pair : Entries)
+	{
+		TSharedRef<FJsonObject> File = MakeShared<FJsonObject>();
+		File->SetStringField(TEXT("ByteCode"), Pair.Value.ByteCodeFilename);
+		File->SetStringField(TEXT("Hash"), Pair.Value.SourceHash);
+		Files->SetObjectField(Pair.Key, File);
+	}
+
+	TSharedRef<FJsonObject> JsonObject = MakeShared<FJsonObject>();
+	JsonObject->SetNumberField(TEXT("Version"), LuaByteCodeManifestVersion);
+	JsonObject->SetObjectField(TEXT("Files"), Files);
+
+	FString Json;
+	TSharedRef<TJsonWriter<TCHAR>> JsonWriter = TJsonWriterFactory<TCHAR>::Create(&Json);
+	if (!FJsonSerializer::Serialize(JsonObject, JsonWriter))
+	{
+		return false;
+	}
+
+	return FFileHelper::SaveStringToFile(Json, *FPaths::Combine(Directory, TEXT("Manifest.json")));
+}
+
+void FLuaByteCodeManifest::Add(const FString& Filename, const FLuaByteCodeManifestEntry& Entry)
+{
+	Entries.Add(NormalizeKey(Filename), Entry);
+}
+
+const FLuaByteCodeManifestEntry* FLuaByteCodeManifest::Find(const FString& Filename) const
+{
+	return Entries.Find(NormalizeKey(Filename));
+}
+
+bool FLuaByteCodeManifest::LoadByteCode(const FString& Filename, TArray<uint8>& ByteCode) const
+{
+	const FLuaByteCodeManifestEntry* Entry = Find(Filename);
+	if (!Entry)
+	{
+		return false;
+	}
+
+#if WITH_EDITOR
+	// scripts are constantly changed while in the editor, ensure the bytecode is still valid
+	TArray<uint8> Source;
+	if (!FFileHelper::LoadFileToArray(Source, *FPaths::Combine(FPaths::ProjectContentDir(), Filename)) || HashSource(Source) != Entry->SourceHash)
+	{
+		return false;
+	}
+#endif
+
+	return FFileHelper::LoadFileToArray(ByteCode, *FPaths::Combine(Directory, Entry->ByteCodeFilename));
+}
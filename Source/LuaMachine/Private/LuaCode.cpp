@@ -69,10 +69,12 @@ void ULuaCode::Serialize(FArchive& Ar)
 void ULuaCode::PreSave(FObjectPreSaveContext ObjectSaveContext)
 {
 	Super::PreSave(ObjectSaveContext);
+	const bool bIsCooking = ObjectSaveContext.IsCooking();
 #else
 void ULuaCode::PreSave(const ITargetPlatform * TargetPlatform)
 {
 	Super::PreSave(TargetPlatform);
+	const bool bIsCooking = TargetPlatform != nullptr;
 #endif
 
 	for (ULuaState* LuaState : FLuaMachineModule::Get().GetRegisteredLuaStates())
@@ -81,6 +83,11 @@ void ULuaCode::PreSave(const ITargetPlatform * TargetPlatform)
 		{
 			FLuaMachineModule::Get().UnregisterLuaState(LuaState);
 		}
+		// modules can be patched without rebuilding the whole state
+		else if (!bIsCooking && LuaState->bHotReloadModules)
+		{
+			LuaState->HotReloadCodeAsset(this);
+		}
 	}
 }
 
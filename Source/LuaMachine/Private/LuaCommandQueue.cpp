@@ -0,0 +1,75 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaCommandQueue.h"
+#include "LuaValue.h"
+#include "Async/Async.h"
+#include "Misc/ScopeRWLock.h"
+
+static void LuaCommandQueue_Fail(FLuaQueuedCallCompletion Completion)
+{
+	if (!Completion)
+	{
+		return;
+	}
+
+	if (IsInGameThread())
+	{
+		Completion(false, TArray<FLuaValue>());
+		return;
+	}
+
+	AsyncTask(ENamedThreads::GameThread, [Completion]()
+		{
+			Completion(false, TArray<FLuaValue>());
+		});
+}
+
+FLuaCommandQueue::FLuaCommandQueue()
+{
+	bClosed = false;
+}
+
+void FLuaCommandQueue::Enqueue(const FString& FunctionName, TArray<uint8> Args, FLuaQueuedCallCompletion Completion)
+{
+	{
+		FRWScopeLock ScopeLock(ClosedLock, SLT_ReadOnly);
+		if (!bClosed)
+		{
+			FLuaQueuedCall Call;
+			Call.FunctionName = FunctionName;
+			Call.Args = MoveTemp(Args);
+			Call.Completion = MoveTemp(Completion);
+			NumPending.Increment();
+			Calls.Enqueue(MoveTemp(Call));
+			return;
+		}
+	}
+
+	LuaCommandQueue_Fail(MoveTemp(Completion));
+}
+
+bool FLuaCommandQueue::Dequeue(FLuaQueuedCall& Call)
+{
+	if (!Calls.Dequeue(Call))
+	{
+		return false;
+	}
+	NumPending.Decrement();
+	return true;
+}
+
+void FLuaCommandQueue::Close()
+{
+	check(IsInGameThread());
+	{
+		// after this no producer can be in the middle of an Enqueue()
+		FRWScopeLock ScopeLock(ClosedLock, SLT_Write);
+		bClosed = true;
+	}
+
+	FLuaQueuedCall Call;
+	while (Dequeue(Call))
+	{
+		LuaCommandQueue_Fail(MoveTemp(Call.Completion));
+	}
+}
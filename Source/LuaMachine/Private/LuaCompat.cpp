@@ -0,0 +1,54 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaCompat.h"
+
+#if LUAMACHINE_LUAJIT
+#include <atomic>
+
+#define LUACOMPAT_EXTRASPACE_KEY "LuaMachine_ExtraSpace"
+
+// a new state can get the registry address of a closed one, so every new extra space invalidates the caches
+static std::atomic<uint32> LuaCompatExtraSpaceGeneration(0);
+
+struct FLuaCompatExtraSpaceCache
+{
+	const void* Registry = nullptr;
+	void* ExtraSpace = nullptr;
+	uint32 Generation = 0;
+};
+
+void LuaCompat_InitExtraSpace(lua_State* L)
+{
+	void* ExtraSpace = lua_newuserdata(L, sizeof(void*));
+	FMemory::Memzero(ExtraSpace, sizeof(void*));
+	lua_setfield(L, LUA_REGISTRYINDEX, LUACOMPAT_EXTRASPACE_KEY);
+	LuaCompatExtraSpaceGeneration++;
+}
+
+void* lua_getextraspace(lua_State* L)
+{
+	static thread_local FLuaCompatExtraSpaceCache Cache;
+
+	const void* Registry = lua_topointer(L, LUA_REGISTRYINDEX);
+	const uint32 Generation = LuaCompatExtraSpaceGeneration.load();
+	if (Cache.Registry == Registry && Cache.Generation == Generation)
+	{
+		return Cache.ExtraSpace;
+	}
+
+	lua_getfield(L, LUA_REGISTRYINDEX, LUACOMPAT_EXTRASPACE_KEY);
+	void* ExtraSpace = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	if (!ExtraSpace)
+	{
+		// states not created by FLuaAllocator::NewState()
+		LuaCompat_InitExtraSpace(L);
+		return lua_getextraspace(L);
+	}
+
+	Cache.Registry = Registry;
+	Cache.ExtraSpace = ExtraSpace;
+	Cache.Generation = Generation;
+	return ExtraSpace;
+}
+#endif
@@ -0,0 +1,76 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "CoreMinimal.h"
+
+#if LUAMACHINE_LUA_FROM_SOURCE
+
+// the same configuration used for the prebuilt libraries (see BuildingNotes.md)
+#if LUAMACHINE_LUA54
+#define LUA_COMPAT_5_3
+#else
+#define LUA_COMPAT_5_2
+#endif
+
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+#define LUA_USE_LINUX
+#elif PLATFORM_MAC
+#define LUA_USE_MACOSX
+#elif PLATFORM_IOS
+#define LUA_USE_POSIX
+#endif
+
+// the source directory (ThirdParty/lua/src or ThirdParty/lua54/src) is added to the include paths by LuaMachine.Build.cs
+
+// the core is compiled as C++ (for getting the engine compiler flags, LTO included), but engine code
+// is built without exceptions so keep the longjmp() based error handling of the prebuilt libraries
+#define LUA_USE_LONGJMP
+
+THIRD_PARTY_INCLUDES_START
+extern "C"
+{
+#if LUAMACHINE_LUA_USER_H
+#include "luauser.h"
+#endif
+
+// core
+#include "lzio.c"
+#include "lctype.c"
+#include "lopcodes.c"
+#include "lmem.c"
+#include "lundump.c"
+#include "ldump.c"
+#include "lstate.c"
+#include "lgc.c"
+#include "llex.c"
+#include "lcode.c"
+#include "lparser.c"
+#include "ldebug.c"
+#include "lfunc.c"
+#include "lobject.c"
+#include "ltm.c"
+#include "lstring.c"
+#include "ltable.c"
+#include "ldo.c"
+#include "lvm.c"
+#include "lapi.c"
+
+// auxiliary and standard libraries
+#include "lauxlib.c"
+#include "lbaselib.c"
+#if !LUAMACHINE_LUA54
+#include "lbitlib.c"
+#endif
+#include "lcorolib.c"
+#include "ldblib.c"
+#include "liolib.c"
+#include "lmathlib.c"
+#include "loslib.c"
+#include "lstrlib.c"
+#include "ltablib.c"
+#include "lutf8lib.c"
+#include "loadlib.c"
+#include "linit.c"
+}
+THIRD_PARTY_INCLUDES_END
+
+#endif
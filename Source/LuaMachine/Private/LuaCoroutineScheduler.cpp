@@ -0,0 +1,249 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaCoroutineScheduler.h"
+#include "LuaState.h"
+#include "LuaMachineStats.h"
+
+static bool LuaSleepingCoroutinePredicate(const FLuaSleepingCoroutine& A, const FLuaSleepingCoroutine& B)
+{
+	return A.WakeUp < B.WakeUp || (A.WakeUp == B.WakeUp && A.Sequence < B.Sequence);
+}
+
+static FLuaCoroutineScheduler& LuaCoroutineScheduler_Check(lua_State* L, const char* FunctionName)
+{
+	FLuaCoroutineScheduler& Scheduler = ULuaState::GetFromExtraSpace(L)->GetCoroutineScheduler();
+	if (!Scheduler.IsRunning(L))
+	{
+		luaL_error(L, "%s() can only be called from a coroutine started with spawn()", FunctionName);
+	}
+	// check it before parking the coroutine
+	if (!lua_isyieldable(L))
+	{
+		luaL_error(L, "%s() cannot yield across a C-call boundary", FunctionName);
+	}
+	return Scheduler;
+}
+
+static int LuaCoroutineScheduler_wait(lua_State* L)
+{
+	const lua_Number Seconds = luaL_optnumber(L, 1, 0);
+	LuaCoroutineScheduler_Check(L, "wait").Sleep(L, Seconds);
+	return lua_yield(L, 0);
+}
+
+static int LuaCoroutineScheduler_wait_frames(lua_State* L)
+{
+	const lua_Integer Frames = luaL_optinteger(L, 1, 1);
+	LuaCoroutineScheduler_Check(L, "wait_frames").SleepFrames(L, Frames);
+	return lua_yield(L, 0);
+}
+
+static int LuaCoroutineScheduler_wait_event(lua_State* L)
+{
+	const FString EventName = UTF8_TO_TCHAR(luaL_checkstring(L, 1));
+	LuaCoroutineScheduler_Check(L, "wait_event").WaitEvent(L, EventName);
+	return lua_yield(L, 0);
+}
+
+static int LuaCoroutineScheduler_spawn(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	ULuaState::GetFromExtraSpace(L)->GetCoroutineScheduler().Spawn(L, lua_gettop(L) - 1);
+	return 1;
+}
+
+static int LuaCoroutineScheduler_signal(lua_State* L)
+{
+	const FString EventName = UTF8_TO_TCHAR(luaL_checkstring(L, 1));
+	const int32 Woken = ULuaState::GetFromExtraSpace(L)->GetCoroutineScheduler().Signal(L, EventName, lua_gettop(L) - 1);
+	lua_pushinteger(L, Woken);
+	return 1;
+}
+
+FLuaCoroutineScheduler::FLuaCoroutineScheduler()
+{
+	CurrentThread = nullptr;
+	bCurrentThreadParked = false;
+	Time = 0;
+	Frame = 0;
+	Sequence = 0;
+}
+
+void FLuaCoroutineScheduler::RegisterLuaFunctions(lua_State* L)
+{
+	lua_pushcfunction(L, LuaCoroutineScheduler_wait);
+	lua_setfield(L, -2, "wait");
+	lua_pushcfunction(L, LuaCoroutineScheduler_wait_frames);
+	lua_setfield(L, -2, "wait_frames");
+	lua_pushcfunction(L, LuaCoroutineScheduler_wait_event);
+	lua_setfield(L, -2, "wait_event");
+	lua_pushcfunction(L, LuaCoroutineScheduler_spawn);
+	lua_setfield(L, -2, "spawn");
+	lua_pushcfunction(L, LuaCoroutineScheduler_signal);
+	lua_setfield(L, -2, "signal");
+}
+
+lua_State* FLuaCoroutineScheduler::Spawn(lua_State* L, const int NArgs)
+{
+	lua_State* Thread = ULuaState::GetFromExtraSpace(L)->GetLuaThreadPool().Acquire(L);
+	lua_pushvalue(L, -1);
+	INC_DWORD_STAT(STAT_LuaRefs);
+	const int ThreadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	// move the function and its arguments to the new thread, leaving it on the stack
+	lua_insert(L, -(NArgs + 2));
+	lua_xmove(L, Thread, NArgs + 1);
+
+	ThreadRefs.Add(Thread, ThreadRef);
+	ReadyQueue.Add({ Thread, NArgs });
+	return Thread;
+}
+
+int32 FLuaCoroutineScheduler::Signal(lua_State* L, const FString& EventName, const int NArgs)
+{
+	TArray<lua_State*> Waiters;
+	if (!EventWaiters.RemoveAndCopyValue(EventName, Waiters))
+	{
+		return 0;
+	}
+
+	const int FirstArg = lua_gettop(L) - NArgs + 1;
+	for (lua_State* Thread : Waiters)
+	{
+		// the values will be returned by wait_event()
+		lua_checkstack(Thread, NArgs);
+		for (int ArgIndex = 0; ArgIndex < NArgs; ArgIndex++)
+		{
+			lua_pushvalue(L, FirstArg + ArgIndex);
+		}
+		lua_xmove(L, Thread, NArgs);
+		ReadyQueue.Add({ Thread, NArgs });
+	}
+
+	return Waiters.Num();
+}
+
+void FLuaCoroutineScheduler::Sleep(lua_State* Thread, const double Seconds)
+{
+	bCurrentThreadParked = true;
+	TimerHeap.HeapPush({ Thread, Time + FMath::Max(Seconds, 0.0), Sequence++ }, LuaSleepingCoroutinePredicate);
+}
+
+void FLuaCoroutineScheduler::SleepFrames(lua_State* Thread, const int64 Frames)
+{
+	bCurrentThreadParked = true;
+	FrameHeap.HeapPush({ Thread, (double)(Frame + FMath::Max<int64>(Frames, 1)), Sequence++ }, LuaSleepingCoroutinePredicate);
+}
+
+void FLuaCoroutineScheduler::WaitEvent(lua_State* Thread, const FString& EventName)
+{
+	bCurrentThreadParked = true;
+	EventWaiters.FindOrAdd(EventName).Add(Thread);
+}
+
+void FLuaCoroutineScheduler::Tick(ULuaState* LuaState, const float DeltaTime, const double Budget)
+{
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_CoroutineScheduler);
+
+	Time += DeltaTime;
+	Frame++;
+
+	while (TimerHeap.Num() > 0 && TimerHeap.HeapTop().WakeUp <= Time)
+	{
+		ReadyQueue.Add({ TimerHeap.HeapTop().Thread, 0 });
+		TimerHeap.HeapPopDiscard(LuaSleepingCoroutinePredicate);
+	}
+
+	while (FrameHeap.Num() > 0 && FrameHeap.HeapTop().WakeUp <= Frame)
+	{
+		ReadyQueue.Add({ FrameHeap.HeapTop().Thread, 0 });
+		FrameHeap.HeapPopDiscard(LuaSleepingCoroutinePredicate);
+	}
+
+	if (ReadyQueue.Num() == 0)
+	{
+		return;
+	}
+
+	lua_State* L = LuaState->GetInternalLuaState();
+	const double StartTime = FPlatformTime::Seconds();
+
+	// coroutines made ready during this tick (spawn, signal) will be resumed in the next one
+	const int32 NumReady = ReadyQueue.Num();
+	int32 Resumed = 0;
+	while (Resumed < NumReady)
+	{
+		// always allow at least one resume for avoiding starvation
+		if (Budget > 0 && Resumed > 0 && FPlatformTime::Seconds() - StartTime >= Budget)
+		{
+			break;
+		}
+		const FLuaScheduledCoroutine Coroutine = ReadyQueue[Resumed++];
+		ResumeThread(LuaState, L, Coroutine);
+	}
+
+	// the skipped ones will have precedence in the next frame
+	ReadyQueue.RemoveAt(0, Resumed);
+}
+
+void FLuaCoroutineScheduler::ResumeThread(ULuaState* LuaState, lua_State* L, const FLuaScheduledCoroutine& Coroutine)
+{
+	lua_State* Thread = Coroutine.Thread;
+
+	CurrentThread = Thread;
+	bCurrentThreadParked = false;
+	LuaState->BeginExecutionBudget(Thread);
+	int NResults = 0;
+	const int Status = LuaCompat_Resume(Thread, L, Coroutine.NumArgs, &NResults);
+	LuaState->EndExecutionBudget();
+	CurrentThread = nullptr;
+
+	if (Status == LUA_YIELD)
+	{
+		// discard yielded values
+		lua_settop(Thread, 0);
+		// a plain coroutine.yield() (or the execution budget) continues in the next frame
+		if (!bCurrentThreadParked)
+		{
+			SleepFrames(Thread, 1);
+		}
+		return;
+	}
+
+	if (Status != LUA_OK)
+	{
+		luaL_traceback(L, Thread, lua_tostring(Thread, -1), 0);
+		LuaState->LastError = FString::Printf(TEXT("Lua coroutine error: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+		lua_pop(L, 1);
+		if (LuaState->bLogError)
+			LuaState->LogError(LuaState->LastError);
+		LuaState->ReceiveLuaError(LuaState->LastError);
+	}
+
+	lua_settop(Thread, 0);
+	Release(L, Thread);
+}
+
+void FLuaCoroutineScheduler::Release(lua_State* L, lua_State* Thread)
+{
+	int ThreadRef = LUA_NOREF;
+	if (!ThreadRefs.RemoveAndCopyValue(Thread, ThreadRef))
+	{
+		return;
+	}
+
+	// the thread has been returned by spawn()/SpawnCoroutine, so it is not given back to the pool (a kept reference would end up pointing to another coroutine)
+	INC_DWORD_STAT(STAT_LuaUnrefs);
+	luaL_unref(L, LUA_REGISTRYINDEX, ThreadRef);
+}
+
+void FLuaCoroutineScheduler::Reset()
+{
+	ThreadRefs.Empty();
+	ReadyQueue.Empty();
+	TimerHeap.Empty();
+	FrameHeap.Empty();
+	EventWaiters.Empty();
+	CurrentThread = nullptr;
+	bCurrentThreadParked = false;
+}
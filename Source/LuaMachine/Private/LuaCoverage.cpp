@@ -0,0 +1,137 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaCoverage.h"
+#include "Misc/FileHelper.h"
+
+FLuaCoverage::FLuaCoverage()
+{
+	bActive = false;
+	LastChunkId = INDEX_NONE;
+	LastLineDefined = 0;
+}
+
+void FLuaCoverage::Start()
+{
+	bActive = true;
+}
+
+void FLuaCoverage::Stop()
+{
+	bActive = false;
+}
+
+void FLuaCoverage::Reset()
+{
+	Chunks.Empty();
+	ChunkNames.Reset();
+	Functions.Empty();
+	LastChunkId = INDEX_NONE;
+	LastLineDefined = 0;
+}
+
+int32 FLuaCoverage::FindChunk(const char* Source)
+{
+	const int32 ChunkId = ChunkNames.Intern(Source);
+	if (ChunkId == Chunks.Num())
+	{
+		// skip the "@"
+		Chunks.AddDefaulted_GetRef().Name = ChunkNames.GetString(ChunkId).RightChop(1);
+	}
+	return ChunkId;
+}
+
+static void LuaCoverageSetLine(TBitArray<>& Lines, const int32 Line)
+{
+	if (Line >= Lines.Num())
+	{
+		Lines.Add(false, Line + 1 - Lines.Num());
+	}
+	Lines[Line] = true;
+}
+
+void FLuaCoverage::AddActiveLines(lua_State* L, lua_Debug* ar, FLuaCoverageChunk& Chunk)
+{
+	// pushes a table whose keys are the lines with code
+	if (!lua_getinfo(L, "L", ar))
+	{
+		return;
+	}
+	if (lua_istable(L, -1))
+	{
+		lua_pushnil(L);
+		while (lua_next(L, -2))
+		{
+			lua_pop(L, 1);
+			if (lua_type(L, -1) == LUA_TNUMBER)
+			{
+				LuaCoverageSetLine(Chunk.ExecutableLines, (int32)lua_tointeger(L, -1));
+			}
+		}
+	}
+	lua_pop(L, 1);
+}
+
+void FLuaCoverage::OnLuaHook(lua_State* L, lua_Debug* ar)
+{
+	const int32 Line = ar->currentline;
+	if (Line <= 0 || !lua_getinfo(L, "S", ar))
+	{
+		return;
+	}
+
+	// only file and LuaCode chunks (string chunks are named after their code)
+	const char* Source = ar->source;
+	if (!Source || Source[0] != '@')
+	{
+		return;
+	}
+
+	const int32 ChunkId = FindChunk(Source);
+	if (ChunkId != LastChunkId || ar->linedefined != LastLineDefined)
+	{
+		LastChunkId = ChunkId;
+		LastLineDefined = ar->linedefined;
+
+		const TPair<int32, int32> Function(LastChunkId, LastLineDefined);
+		if (!Functions.Contains(Function))
+		{
+			Functions.Add(Function);
+			AddActiveLines(L, ar, Chunks[LastChunkId]);
+		}
+	}
+
+	LuaCoverageSetLine(Chunks[LastChunkId].HitLines, Line);
+}
+
+FString FLuaCoverage::ExportLCOV(const FString& TestName) const
+{
+	FString LCOV;
+	for (const FLuaCoverageChunk& Chunk : Chunks)
+	{
+		LCOV += FString::Printf(TEXT("TN:%s\nSF:%s\n"), *TestName, *Chunk.Name);
+		int32 NumLines = 0;
+		int32 NumHitLines = 0;
+		for (int32 Line = 1; Line < FMath::Max(Chunk.ExecutableLines.Num(), Chunk.HitLines.Num()); Line++)
+		{
+			const bool bHit = Line < Chunk.HitLines.Num() && Chunk.HitLines[Line];
+			const bool bExecutable = Line < Chunk.ExecutableLines.Num() && Chunk.ExecutableLines[Line];
+			if (!bHit && !bExecutable)
+			{
+				continue;
+			}
+			LCOV += FString::Printf(TEXT("DA:%d,%d\n"), Line, bHit ? 1 : 0);
+			NumLines++;
+			if (bHit)
+			{
+				NumHitLines++;
+			}
+		}
+		LCOV += FString::Printf(TEXT("LH:%d\nLF:%d\nend_of_record\n"), NumHitLines, NumLines);
+	}
+	return LCOV;
+}
+
+bool FLuaCoverage::SaveLCOV(const FString& Filename, const FString& TestName) const
+{
+	return FFileHelper::SaveStringToFile(ExportLCOV(TestName), *Filename, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
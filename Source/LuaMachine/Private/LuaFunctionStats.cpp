@@ -0,0 +1,273 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaFunctionStats.h"
+
+FLuaFunctionStats::FLuaFunctionStats()
+{
+	bActive = false;
+	SlotsMask = 0;
+	CurrentCounters = 0;
+	IntervalTime = 0;
+	LastThread = nullptr;
+	LastStack = nullptr;
+}
+
+void FLuaFunctionStats::Start(const int32 TableSize)
+{
+	Reset();
+
+	const int32 NumSlots = FMath::RoundUpToPowerOfTwo(FMath::Max(TableSize, 16));
+	SlotsMask = NumSlots - 1;
+	Slots.SetNum(NumSlots + 1);
+	for (FSlot& Slot : Slots)
+	{
+		Slot.SourceId = INDEX_NONE;
+		Slot.CFunction = nullptr;
+		Slot.LineDefined = 0;
+		Slot.bUsed = false;
+		FMemory::Memzero(Slot.Counters);
+	}
+	Slots.Last().Name = TEXT("(other)");
+
+	bActive = true;
+}
+
+void FLuaFunctionStats::Stop()
+{
+	CloseOpenCalls();
+	bActive = false;
+}
+
+void FLuaFunctionStats::Reset()
+{
+	bActive = false;
+	Sources.Reset();
+	Slots.Empty();
+	UsedSlots.Empty();
+	SlotsMask = 0;
+	CurrentCounters = 0;
+	IntervalTime = 0;
+	Stacks.Empty();
+	LastThread = nullptr;
+	LastStack = nullptr;
+}
+
+void FLuaFunctionStats::Tick(const float DeltaTime, const float ResetInterval)
+{
+	if (!bActive || ResetInterval < 0)
+	{
+		return;
+	}
+
+	IntervalTime += DeltaTime;
+	if (IntervalTime >= ResetInterval)
+	{
+		NextInterval();
+	}
+}
+
+void FLuaFunctionStats::NextInterval()
+{
+	if (Slots.Num() == 0)
+	{
+		return;
+	}
+
+	CurrentCounters = 1 - CurrentCounters;
+	IntervalTime = 0;
+	for (const int32 SlotIndex : UsedSlots)
+	{
+		FMemory::Memzero(Slots[SlotIndex].Counters[CurrentCounters]);
+	}
+	FMemory::Memzero(Slots.Last().Counters[CurrentCounters]);
+}
+
+TArray<FLuaFunctionStats::FCallFrame>& FLuaFunctionStats::GetStack(lua_State* L)
+{
+	if (L != LastThread || !LastStack)
+	{
+		LastThread = L;
+		LastStack = &Stacks.FindOrAdd(L);
+	}
+	return *LastStack;
+}
+
+int32 FLuaFunctionStats::FindSlot(lua_State* L, lua_Debug* ar)
+{
+	const int32 OtherSlot = Slots.Num() - 1;
+
+	lua_getinfo(L, "S", ar);
+	int32 SourceId = INDEX_NONE;
+	lua_CFunction CFunction = nullptr;
+	if (ar->what && ar->what[0] == 'C')
+	{
+		// all of the C functions share the same source
+		lua_getinfo(L, "f", ar);
+		CFunction = lua_tocfunction(L, -1);
+		lua_pop(L, 1);
+	}
+	else
+	{
+		SourceId = Sources.Intern(ar->source);
+	}
+
+	if (SourceId == INDEX_NONE && !CFunction)
+	{
+		return OtherSlot;
+	}
+
+	int32 SlotIndex = HashCombine(HashCombine(GetTypeHash(SourceId), GetTypeHash((const void*)CFunction)), GetTypeHash(ar->linedefined)) & SlotsMask;
+	for (int32 Probe = 0; Probe <= SlotsMask; Probe++)
+	{
+		FSlot& Slot = Slots[SlotIndex];
+		if (Slot.bUsed && Slot.SourceId == SourceId && Slot.CFunction == CFunction && Slot.LineDefined == ar->linedefined)
+		{
+			return SlotIndex;
+		}
+
+		if (!Slot.bUsed)
+		{
+			// first call, this is the only time the name is retrieved
+			lua_getinfo(L, "n", ar);
+			Slot.SourceId = SourceId;
+			Slot.CFunction = CFunction;
+			Slot.LineDefined = ar->linedefined;
+			Slot.bUsed = true;
+			Slot.Source = UTF8_TO_TCHAR(ar->short_src);
+			if (ar->name)
+			{
+				Slot.Name = UTF8_TO_TCHAR(ar->name);
+			}
+			else if (ar->what && FCStringAnsi::Strcmp(ar->what, "main") == 0)
+			{
+				Slot.Name = TEXT("(main)");
+			}
+			else
+			{
+				Slot.Name = TEXT("(anonymous)");
+			}
+			UsedSlots.Add(SlotIndex);
+			return SlotIndex;
+		}
+
+		SlotIndex = (SlotIndex + 1) & SlotsMask;
+	}
+
+	return OtherSlot;
+}
+
+void FLuaFunctionStats::PopCall(TArray<FCallFrame>& Stack, const uint64 Now)
+{
+	const FCallFrame Frame = Stack.Pop(false);
+	const uint64 InclusiveCycles = Now - Frame.StartCycles;
+
+	FCounters& Counters = Slots[Frame.SlotIndex].Counters[CurrentCounters];
+	Counters.InclusiveCycles += InclusiveCycles;
+	Counters.ExclusiveCycles += InclusiveCycles > Frame.ChildrenCycles ? InclusiveCycles - Frame.ChildrenCycles : 0;
+
+	if (Stack.Num() > 0)
+	{
+		Stack.Last().ChildrenCycles += InclusiveCycles;
+	}
+}
+
+void FLuaFunctionStats::OnLuaHook(lua_State* L, lua_Debug* ar)
+{
+	const uint64 Now = FPlatformTime::Cycles64();
+	TArray<FCallFrame>& Stack = GetStack(L);
+
+	if (LuaHookEventToMask(ar->event) == LUA_MASKRET)
+	{
+		if (Stack.Num() == 0)
+		{
+			return;
+		}
+
+		const void* Function = LuaHookGetFunction(L, ar);
+		for (int32 Index = Stack.Num() - 1; Index >= 0; Index--)
+		{
+			if (Stack[Index].Function == Function)
+			{
+				// the frames above it have been unwound by an error caught in Lua
+				Stack.SetNum(Index + 1, false);
+				PopCall(Stack, Now);
+				return;
+			}
+		}
+		// returns of calls started before enabling the stats (or of already closed calls) are ignored
+		return;
+	}
+
+#ifdef LUA_HOOKTAILCALL
+	// the tail called function replaces the caller, there will be a single return
+	if (ar->event == LUA_HOOKTAILCALL && Stack.Num() > 0)
+	{
+		PopCall(Stack, Now);
+	}
+#endif
+
+	FCallFrame Frame;
+	Frame.SlotIndex = FindSlot(L, ar);
+	Frame.Function = LuaHookGetFunction(L, ar);
+	Frame.ChildrenCycles = 0;
+	Slots[Frame.SlotIndex].Counters[CurrentCounters].Calls++;
+	// do not account the time spent in the hook
+	Frame.StartCycles = FPlatformTime::Cycles64();
+	Stack.Add(Frame);
+}
+
+void FLuaFunctionStats::CloseOpenCalls()
+{
+	const uint64 Now = FPlatformTime::Cycles64();
+	for (TPair<lua_State*, TArray<FCallFrame>>& Pair : Stacks)
+	{
+		while (Pair.Value.Num() > 0)
+		{
+			PopCall(Pair.Value, Now);
+		}
+	}
+	Stacks.Empty();
+	LastThread = nullptr;
+	LastStack = nullptr;
+}
+
+TArray<FLuaFunctionStat> FLuaFunctionStats::GetTopFunctions(const int32 Count, const bool bCompletedInterval) const
+{
+	TArray<FLuaFunctionStat> Functions;
+	if (Slots.Num() == 0)
+	{
+		return Functions;
+	}
+
+	const int32 CountersIndex = bCompletedInterval ? 1 - CurrentCounters : CurrentCounters;
+
+	auto AddFunction = [&Functions, CountersIndex](const FSlot& Slot)
+	{
+		const FCounters& Counters = Slot.Counters[CountersIndex];
+		if (Counters.Calls == 0 && Counters.InclusiveCycles == 0)
+		{
+			return;
+		}
+		FLuaFunctionStat Function;
+		Function.Name = Slot.Name;
+		Function.Source = Slot.Source;
+		Function.Line = Slot.LineDefined;
+		Function.Calls = Counters.Calls;
+		Function.InclusiveTime = FPlatformTime::ToMilliseconds64(Counters.InclusiveCycles);
+		Function.ExclusiveTime = FPlatformTime::ToMilliseconds64(Counters.ExclusiveCycles);
+		Functions.Add(Function);
+	};
+
+	for (const int32 SlotIndex : UsedSlots)
+	{
+		AddFunction(Slots[SlotIndex]);
+	}
+	AddFunction(Slots.Last());
+
+	Functions.Sort([](const FLuaFunctionStat& A, const FLuaFunctionStat& B) { return A.ExclusiveTime > B.ExclusiveTime; });
+	if (Functions.Num() > Count)
+	{
+		Functions.SetNum(FMath::Max(Count, 0));
+	}
+	return Functions;
+}
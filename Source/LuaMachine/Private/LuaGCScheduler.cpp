@@ -0,0 +1,164 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaGCScheduler.h"
+
+static const int32 LuaGCMinStepSize = 1;
+static const int32 LuaGCMaxStepSize = 8192;
+// the automatic collector starts a cycle when memory doubles (default pause), stepping falling behind that much more triggers a full collection
+static const int64 LuaGCFullCollectFactor = 4;
+
+FLuaGCScheduler::FLuaGCScheduler()
+{
+	bActive = false;
+	StepSize = LuaGCMinStepSize;
+	LastUsedBytes = 0;
+	Debt = 0;
+	CycleUsedBytes = 0;
+	bRestoreGenerationalMode = false;
+}
+
+int64 FLuaGCScheduler::GetUsedBytes(lua_State* L)
+{
+	return (int64)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+void FLuaGCScheduler::Start(lua_State* L, const int32 InitialStepSize)
+{
+#if LUAMACHINE_LUA54
+	// a generational step is a full minor collection that never completes a cycle, so the pacing would not work
+	bRestoreGenerationalMode = lua_gc(L, LUA_GCINC, 0, 0, 0) == LUA_GCGEN;
+#endif
+	lua_gc(L, LUA_GCSTOP, 0);
+	bActive = true;
+	StepSize = FMath::Clamp(InitialStepSize, LuaGCMinStepSize, LuaGCMaxStepSize);
+	LastUsedBytes = GetUsedBytes(L);
+	CycleUsedBytes = LastUsedBytes;
+	Debt = 0;
+	Stats.StepSize = StepSize;
+	Stats.UsedMemory = LastUsedBytes / 1024;
+}
+
+void FLuaGCScheduler::Stop(lua_State* L, const bool bRestartCollector)
+{
+	bActive = false;
+	Debt = 0;
+#if LUAMACHINE_LUA54
+	if (bRestoreGenerationalMode)
+	{
+		lua_gc(L, LUA_GCGEN, 0, 0);
+	}
+#endif
+	bRestoreGenerationalMode = false;
+	if (bRestartCollector)
+	{
+		lua_gc(L, LUA_GCRESTART, 0);
+	}
+}
+
+void FLuaGCScheduler::Tick(lua_State* L, const float DeltaTime, const double Budget)
+{
+	if (!bActive)
+	{
+		return;
+	}
+
+	const int64 UsedBytes = GetUsedBytes(L);
+	// the automatic collector is stopped, so memory only decreases during our steps (or explicit collections)
+	const double Allocated = FMath::Max<int64>(UsedBytes - LastUsedBytes, 0) / 1024.0;
+
+	if (DeltaTime > 0)
+	{
+		const float AllocationRate = Allocated / DeltaTime;
+		Stats.AllocationRate = Stats.NumFrames > 0 ? FMath::Lerp(Stats.AllocationRate, AllocationRate, 0.1f) : AllocationRate;
+	}
+
+	// LUA_GCSTEP does the same work the automatic collector would do for the given amount of allocated KB,
+	// so nothing is done until at least a step worth of memory has been allocated
+	Debt = FMath::Clamp(Debt + Allocated, 0.0, FMath::Max(UsedBytes / 1024.0, (double)StepSize));
+
+	// a single step should never take more than a quarter of the budget
+	const double TargetStepTime = Budget / 4;
+
+	const double StartTime = FPlatformTime::Seconds();
+	double Now = StartTime;
+
+	// the steps cannot keep up with the allocations (or a long frame), the budget is ignored for avoiding unbounded growth
+	if (UsedBytes > CycleUsedBytes * LuaGCFullCollectFactor)
+	{
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		Now = FPlatformTime::Seconds();
+		Stats.NumFullCollections++;
+		Stats.NumCycles++;
+		CycleUsedBytes = GetUsedBytes(L);
+		Debt = 0;
+	}
+
+	while (Debt >= StepSize)
+	{
+		const double StepStartTime = Now;
+		const bool bCycleCompleted = lua_gc(L, LUA_GCSTEP, StepSize) != 0;
+		Now = FPlatformTime::Seconds();
+		Stats.NumSteps++;
+		Debt -= StepSize;
+
+		if (TargetStepTime > 0)
+		{
+			const double StepTime = Now - StepStartTime;
+			if (StepTime > TargetStepTime)
+			{
+				StepSize = FMath::Max(StepSize / 2, LuaGCMinStepSize);
+			}
+			else if (StepTime < TargetStepTime / 4)
+			{
+				StepSize = FMath::Min(StepSize * 2, LuaGCMaxStepSize);
+			}
+		}
+
+		if (bCycleCompleted)
+		{
+			// like the automatic collector, pause until new allocations happen
+			Stats.NumCycles++;
+			CycleUsedBytes = GetUsedBytes(L);
+			Debt = 0;
+			break;
+		}
+
+		if (Budget > 0 && Now - StartTime >= Budget)
+		{
+			break;
+		}
+	}
+
+	const double Pause = Now - StartTime;
+
+	Stats.NumFrames++;
+	Stats.LastPause = Pause * 1000;
+	Stats.MaxPause = FMath::Max(Stats.MaxPause, Stats.LastPause);
+	Stats.TotalPause += Stats.LastPause;
+	Stats.AveragePause = Stats.TotalPause / Stats.NumFrames;
+	if (Budget > 0 && Pause > Budget)
+	{
+		Stats.NumFramesOverBudget++;
+	}
+	Stats.StepSize = StepSize;
+
+	LastUsedBytes = GetUsedBytes(L);
+	Stats.UsedMemory = LastUsedBytes / 1024;
+}
+
+void FLuaGCScheduler::Reset()
+{
+	bActive = false;
+	Debt = 0;
+	LastUsedBytes = 0;
+	CycleUsedBytes = 0;
+	bRestoreGenerationalMode = false;
+}
+
+void FLuaGCScheduler::ResetStats()
+{
+	const int32 UsedMemory = Stats.UsedMemory;
+	Stats = FLuaGCStats();
+	Stats.StepSize = StepSize;
+	Stats.UsedMemory = UsedMemory;
+}
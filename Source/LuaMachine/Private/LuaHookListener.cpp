@@ -0,0 +1,89 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaHookListener.h"
+#include "LuaState.h"
+
+uint32 FLuaHookStringInterner::GlobalGeneration = 0;
+
+FLuaHookStringInterner::FLuaHookStringInterner()
+{
+	Generation = GlobalGeneration;
+}
+
+void FLuaHookStringInterner::Reset()
+{
+	Pointers.Empty();
+	Ids.Empty();
+	Strings.Empty();
+	Generation = GlobalGeneration;
+}
+
+int32 FLuaHookStringInterner::InternContents(const char* String)
+{
+	if (!String)
+	{
+		return INDEX_NONE;
+	}
+
+	FString Contents = UTF8_TO_TCHAR(String);
+	int32 Id = INDEX_NONE;
+	if (const int32* ExistingId = Ids.Find(Contents))
+	{
+		Id = *ExistingId;
+	}
+	else
+	{
+		Id = Strings.Add(Contents);
+		Ids.Add(MoveTemp(Contents), Id);
+	}
+
+	Pointers.Add(String, Id);
+	return Id;
+}
+
+FLuaBlueprintHookListener::FLuaBlueprintHookListener()
+{
+	HookMask = 0;
+	HookCount = 0;
+}
+
+void FLuaBlueprintHookListener::Configure(const int32 InHookMask, const int32 InHookCount)
+{
+	HookMask = InHookMask;
+	HookCount = InHookCount;
+	if (HookCount <= 0)
+	{
+		HookMask &= ~LUA_MASKCOUNT;
+	}
+}
+
+void FLuaBlueprintHookListener::OnLuaHook(lua_State* L, lua_Debug* ar)
+{
+	ULuaState* LuaState = ULuaState::GetFromExtraSpace(L);
+
+	FLuaDebug LuaDebug;
+	lua_getinfo(L, "lSn", ar);
+	LuaDebug.CurrentLine = ar->currentline;
+	LuaDebug.Source = ANSI_TO_TCHAR(ar->source);
+	LuaDebug.Name = ANSI_TO_TCHAR(ar->name);
+	LuaDebug.NameWhat = ANSI_TO_TCHAR(ar->namewhat);
+	LuaDebug.What = ANSI_TO_TCHAR(ar->what);
+
+	switch (ar->event)
+	{
+	case LUA_HOOKLINE:
+		LuaState->ReceiveLuaLineHook(LuaDebug);
+		break;
+	case LUA_HOOKCALL:
+		LuaState->ReceiveLuaCallHook(LuaDebug);
+		break;
+	case LUA_HOOKRET:
+		LuaState->ReceiveLuaReturnHook(LuaDebug);
+		break;
+	case LUA_HOOKCOUNT:
+		LuaState->ReceiveLuaCountHook(LuaDebug);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,563 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaJobSystem.h"
+#include "LuaBinarySerializer.h"
+#include "LuaMachine.h"
+#include "LuaState.h"
+#include "Async/Async.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+static int LuaWorker_print(lua_State* L)
+{
+	TArray<FString> Messages;
+	const int NumArgs = lua_gettop(L);
+	for (int Index = 1; Index <= NumArgs; Index++)
+	{
+		lua_getglobal(L, "tostring");
+		lua_pushvalue(L, Index);
+		lua_call(L, 1, 1);
+		const char* Message = lua_tostring(L, -1);
+		Messages.Add(Message ? UTF8_TO_TCHAR(Message) : TEXT(""));
+		lua_pop(L, 1);
+	}
+	UE_LOG(LogLuaMachine, Log, TEXT("[Worker] %s"), *FString::Join(Messages, TEXT("\t")));
+	return 0;
+}
+
+static void LuaWorker_AppendCode(TArray<TPair<FString, TArray<uint8>>>& Chunks, const FString& Name, ULuaCode* CodeAsset)
+{
+	TArray<uint8> Code;
+	if (CodeAsset->bCooked && CodeAsset->bCookAsBytecode)
+	{
+		Code = CodeAsset->ByteCode;
+#if PLATFORM_ANDROID && !LUAMACHINE_LUA54
+		// fix size_t of the bytecode
+		if (Code.Num() >= 14)
+			Code[13] = sizeof(size_t);
+#endif
+	}
+	else
+	{
+		FTCHARToUTF8 UTF8String(*CodeAsset->Code.ToString());
+		Code.Append(reinterpret_cast<const uint8*>(UTF8String.Get()), UTF8String.Length());
+	}
+	Chunks.Add(TPair<FString, TArray<uint8>>(Name, MoveTemp(Code)));
+}
+
+static bool LuaWorker_LoadFile(const FLuaWorkerConfig& Config, const FString& Filename, TArray<uint8>& Code)
+{
+	if (Config.bPreferByteCodeManifest && FLuaMachineModule::Get().GetSharedByteCodeManifest()->LoadByteCode(Filename, Code))
+	{
+#if PLATFORM_ANDROID && !LUAMACHINE_LUA54
+		// fix size_t of the bytecode
+		if (Code.Num() >= 14)
+			Code[13] = sizeof(size_t);
+#endif
+		return true;
+	}
+	return FFileHelper::LoadFileToArray(Code, *FPaths::Combine(FPaths::ProjectContentDir(), Filename), FILEREAD_Silent);
+}
+
+// package searcher mirroring ULuaState::TableFunction_package_preload (the stock one cannot read from pak files)
+static int LuaWorker_searcher(lua_State* L)
+{
+	const FLuaWorkerConfig* Config = reinterpret_cast<const FLuaWorkerConfig*>(lua_touserdata(L, lua_upvalueindex(1)));
+	const FString Key = UTF8_TO_TCHAR(luaL_checkstring(L, 1));
+
+	FString Message;
+	for (const FString& ModuleDir : Config->ModuleDirs)
+	{
+		const FString Filename = ModuleDir.IsEmpty() ? Key + ".lua" : ModuleDir / Key + ".lua";
+		TArray<uint8> Code;
+		if (!LuaWorker_LoadFile(*Config, Filename, Code))
+		{
+			Message += FString::Printf(TEXT("\n\tno file '%s'"), *Filename);
+			continue;
+		}
+
+		const FString ChunkName = FString("@") + FPaths::Combine(FPaths::ProjectContentDir(), Filename);
+		if (luaL_loadbuffer(L, reinterpret_cast<const char*>(Code.GetData()), Code.Num(), TCHAR_TO_UTF8(*ChunkName)))
+		{
+			return luaL_error(L, "error loading module '%s':\n\t%s", lua_tostring(L, 1), lua_tostring(L, -1));
+		}
+		lua_pushstring(L, TCHAR_TO_UTF8(*Filename));
+		return 2;
+	}
+
+	lua_pushstring(L, TCHAR_TO_UTF8(*Message));
+	return 1;
+}
+
+FLuaWorkerGroup::FLuaWorkerGroup(const FLuaWorkerConfig& InConfig) : Config(InConfig)
+{
+	NumStates = 0;
+}
+
+FLuaWorkerGroup::~FLuaWorkerGroup()
+{
+	// jobs keep a reference to the group, so every VM is idle here
+	for (lua_State* L : IdleStates)
+	{
+		lua_close(L);
+	}
+}
+
+int32 FLuaWorkerGroup::GetNumStates() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumStates;
+}
+
+int FLuaWorkerGroup::MessageHandler(lua_State* L)
+{
+	const char* Message = lua_tostring(L, 1);
+	luaL_traceback(L, L, Message ? Message : "(error object is not a string)", 1);
+	return 1;
+}
+
+lua_State* FLuaWorkerGroup::CreateState(FString& Error)
+{
+	lua_State* L = FLuaAllocator::NewState();
+
+	FLuaLibsLoader LibsLoader;
+	LibsLoader.bLoadBase = Config.bLoadBase;
+	LibsLoader.bLoadCoroutine = Config.bLoadCoroutine;
+	LibsLoader.bLoadTable = Config.bLoadTable;
+	LibsLoader.bLoadIO = Config.bLoadIO;
+	LibsLoader.bLoadOS = Config.bLoadOS;
+	LibsLoader.bLoadString = Config.bLoadString;
+	LibsLoader.bLoadMath = Config.bLoadMath;
+	LibsLoader.bLoadUTF8 = Config.bLoadUTF8;
+	LibsLoader.bLoadDebug = Config.bLoadDebug;
+	ULuaState::LoadLuaLibs(L, Config.bLuaOpenLibs, LibsLoader, Config.bAllowFFI);
+
+	lua_pushcfunction(L, LuaWorker_print);
+	lua_setglobal(L, "print");
+	// allows sharing code between the game thread and the workers
+	lua_pushboolean(L, 1);
+	lua_setglobal(L, "LUAMACHINE_WORKER");
+
+	lua_getglobal(L, "package");
+	if (!Config.PackagePath.IsEmpty())
+	{
+		lua_pushstring(L, TCHAR_TO_UTF8(*Config.PackagePath));
+		lua_setfield(L, -2, "path");
+	}
+
+	// the group outlives its VMs
+	lua_getfield(L, -1, LUACOMPAT_SEARCHERS);
+	lua_pushlightuserdata(L, &Config);
+	lua_pushcclosure(L, LuaWorker_searcher, 1);
+	lua_rawseti(L, -2, (int)lua_rawlen(L, -2) + 1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, -1, "preload");
+	for (const TPair<FString, TArray<uint8>>& Module : Config.Modules)
+	{
+		if (luaL_loadbuffer(L, reinterpret_cast<const char*>(Module.Value.GetData()), Module.Value.Num(), TCHAR_TO_UTF8(*(FString("@") + Module.Key))))
+		{
+			Error = FString::Printf(TEXT("Lua worker error: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+			lua_close(L);
+			return nullptr;
+		}
+		lua_setfield(L, -2, TCHAR_TO_UTF8(*Module.Key));
+	}
+	// pop package.preload and package
+	lua_pop(L, 2);
+
+	lua_pushcfunction(L, FLuaWorkerGroup::MessageHandler);
+	for (const TPair<FString, TArray<uint8>>& Chunk : Config.Chunks)
+	{
+		if (luaL_loadbuffer(L, reinterpret_cast<const char*>(Chunk.Value.GetData()), Chunk.Value.Num(), TCHAR_TO_UTF8(*(FString("@") + Chunk.Key))) || lua_pcall(L, 0, 0, 1))
+		{
+			Error = FString::Printf(TEXT("Lua worker error: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+			lua_close(L);
+			return nullptr;
+		}
+	}
+	lua_settop(L, 0);
+
+	return L;
+}
+
+lua_State* FLuaWorkerGroup::Acquire(FString& Error)
+{
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (IdleStates.Num() > 0)
+		{
+			return IdleStates.Pop();
+		}
+	}
+
+	// VMs are created outside of the lock, as running the initialization code could be slow
+	lua_State* L = CreateState(Error);
+	if (L)
+	{
+		FScopeLock ScopeLock(&Lock);
+		NumStates++;
+	}
+	return L;
+}
+
+void FLuaWorkerGroup::Release(lua_State* L)
+{
+	lua_settop(L, 0);
+	FScopeLock ScopeLock(&Lock);
+	IdleStates.Add(L);
+}
+
+bool FLuaWorkerGroup::PushFunction(lua_State* L, const FString& FunctionName)
+{
+	TArray<FString> Parts;
+	FunctionName.ParseIntoArray(Parts, TEXT("."));
+	if (Parts.Num() == 0)
+	{
+		return false;
+	}
+
+	lua_pushglobaltable(L);
+	for (const FString& Part : Parts)
+	{
+		if (!lua_istable(L, -1))
+		{
+			lua_pop(L, 1);
+			return false;
+		}
+		lua_getfield(L, -1, TCHAR_TO_UTF8(*Part));
+		lua_remove(L, -2);
+	}
+
+	if (!lua_isfunction(L, -1))
+	{
+		lua_pop(L, 1);
+		return false;
+	}
+	return true;
+}
+
+FLuaJobResult FLuaWorkerGroup::RunJob(const FString& FunctionName, const uint8* Args, const int64 ArgsSize)
+{
+	FLuaJobResult Result;
+
+	lua_State* L = Acquire(Result.Error);
+	if (!L)
+	{
+		return Result;
+	}
+
+	lua_pushcfunction(L, FLuaWorkerGroup::MessageHandler);
+	if (!PushFunction(L, FunctionName))
+	{
+		Result.Error = FString::Printf(TEXT("Lua worker error: %s is not a function"), *FunctionName);
+		Release(L);
+		return Result;
+	}
+
+	const int32 NumArgs = FLuaBinarySerializer::DeserializeAll(L, Args, ArgsSize, Result.Error);
+	if (NumArgs < 0)
+	{
+		Result.Error = FString::Printf(TEXT("Lua worker error: invalid arguments for %s: %s"), *FunctionName, *Result.Error);
+		Release(L);
+		return Result;
+	}
+
+	if (lua_pcall(L, NumArgs, LUA_MULTRET, 1))
+	{
+		Result.Error = FString::Printf(TEXT("Lua worker error: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+		Release(L);
+		return Result;
+	}
+
+	if (FLuaBinarySerializer::SerializeRange(L, 2, Result.Results, Result.Error) < 0)
+	{
+		Result.Error = FString::Printf(TEXT("Lua worker error: invalid return values from %s: %s"), *FunctionName, *Result.Error);
+		Release(L);
+		return Result;
+	}
+
+	Result.bSuccess = true;
+	Release(L);
+	return Result;
+}
+
+FLuaWorkerConfig FLuaJobSystem::BuildWorkerConfig(TSubclassOf<ULuaState> StateClass)
+{
+	const ULuaState* LuaState = StateClass->GetDefaultObject<ULuaState>();
+
+	FLuaWorkerConfig Config;
+	Config.Name = StateClass->GetName();
+	Config.bLuaOpenLibs = LuaState->bLuaOpenLibs;
+	Config.bLoadBase = LuaState->LuaLibsLoader.bLoadBase;
+	Config.bLoadCoroutine = LuaState->LuaLibsLoader.bLoadCoroutine;
+	Config.bLoadTable = LuaState->LuaLibsLoader.bLoadTable;
+	Config.bLoadIO = LuaState->LuaLibsLoader.bLoadIO;
+	Config.bLoadOS = LuaState->LuaLibsLoader.bLoadOS;
+	Config.bLoadString = LuaState->LuaLibsLoader.bLoadString;
+	Config.bLoadMath = LuaState->LuaLibsLoader.bLoadMath;
+	Config.bLoadUTF8 = LuaState->LuaLibsLoader.bLoadUTF8;
+	Config.bLoadDebug = LuaState->LuaLibsLoader.bLoadDebug;
+	Config.bAllowFFI = LuaState->bAllowLuaJITFFI;
+
+	if (!LuaState->OverridePackagePath.IsEmpty())
+	{
+		Config.PackagePath = LuaState->OverridePackagePath.Replace(TEXT("$(CONTENT_DIR)"), *FPaths::ProjectContentDir());
+	}
+	if (LuaState->bAddProjectContentDirToPackagePath)
+	{
+		Config.ModuleDirs.Add(FString());
+	}
+	Config.ModuleDirs.Append(LuaState->AppendProjectContentDirSubDir);
+	Config.bPreferByteCodeManifest = LuaState->bPreferByteCodeManifest;
+
+	for (const TPair<FString, ULuaCode*>& Pair : LuaState->RequireTable)
+	{
+		if (Pair.Value)
+		{
+			LuaWorker_AppendCode(Config.Modules, Pair.Key, Pair.Value);
+		}
+	}
+
+	if (LuaState->LuaCodeAsset)
+	{
+		LuaWorker_AppendCode(Config.Chunks, LuaState->LuaCodeAsset->GetPathName(), LuaState->LuaCodeAsset);
+	}
+
+	if (!LuaState->LuaFilename.IsEmpty())
+	{
+		TArray<uint8> Code;
+		if (LuaWorker_LoadFile(Config, LuaState->LuaFilename, Code))
+		{
+			// same chunk name of ULuaState::RunFile()
+			Config.Chunks.Add(TPair<FString, TArray<uint8>>(FPaths::Combine(FPaths::ProjectContentDir(), LuaState->LuaFilename), MoveTemp(Code)));
+		}
+	}
+
+	return Config;
+}
+
+TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe> FLuaJobSystem::GetWorkerGroup(TSubclassOf<ULuaState> StateClass)
+{
+	check(IsInGameThread());
+
+	if (!StateClass)
+	{
+		return nullptr;
+	}
+
+	TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe>* WorkerGroup = WorkerGroups.Find(StateClass);
+	if (WorkerGroup)
+	{
+		return *WorkerGroup;
+	}
+
+	TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe> NewWorkerGroup = MakeShared<FLuaWorkerGroup, ESPMode::ThreadSafe>(BuildWorkerConfig(StateClass));
+	WorkerGroups.Add(StateClass, NewWorkerGroup);
+	return NewWorkerGroup;
+}
+
+TFuture<FLuaJobResult> FLuaJobSystem::Submit(TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<uint8> Args)
+{
+	TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe> WorkerGroup = GetWorkerGroup(StateClass);
+	if (!WorkerGroup)
+	{
+		TPromise<FLuaJobResult> Promise;
+		FLuaJobResult Result;
+		Result.Error = TEXT("Lua worker error: invalid LuaState class");
+		Promise.SetValue(MoveTemp(Result));
+		return Promise.GetFuture();
+	}
+
+	return Async(EAsyncExecution::TaskGraph, [WorkerGroup, FunctionName, Args = MoveTemp(Args)]()
+		{
+			return WorkerGroup->RunJob(FunctionName, Args.GetData(), Args.Num());
+		});
+}
+
+void FLuaJobSystem::ResetWorkerGroup(TSubclassOf<ULuaState> StateClass)
+{
+	// running jobs keep the old VMs alive until they complete
+	WorkerGroups.Remove(StateClass);
+}
+
+void FLuaJobSystem::Reset()
+{
+	WorkerGroups.Empty();
+}
+
+/* state shared by the tasks of a ParallelFor(), the last task completing fulfills the promise */
+struct FLuaParallelForContext
+{
+	TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe> WorkerGroup;
+	FString FunctionName;
+	TArray<uint8> Inputs;
+	TArray<int64> Offsets;
+	int32 ChunkSize;
+	int32 NumChunks;
+
+	FThreadSafeCounter NextChunk;
+	FThreadSafeCounter PendingTasks;
+	FThreadSafeBool bFailed;
+
+	// every chunk is written by a single task, so no locking is required
+	TArray<TArray<uint8>> ChunkResults;
+
+	FCriticalSection ErrorLock;
+	FString Error;
+
+	TPromise<FLuaJobResult> Promise;
+
+	void SetError(const FString& InError)
+	{
+		FScopeLock ScopeLock(&ErrorLock);
+		if (!bFailed)
+		{
+			Error = InError;
+			bFailed = true;
+		}
+	}
+
+	bool RunChunk(lua_State* L, const int32 Chunk, FString& ChunkError)
+	{
+		const int32 FirstInput = Chunk * ChunkSize;
+		const int32 LastInput = FMath::Min(FirstInput + ChunkSize, Offsets.Num());
+		const int64 EndOffset = LastInput < Offsets.Num() ? Offsets[LastInput] : Inputs.Num();
+
+		TArray<uint8>& Results = ChunkResults[Chunk];
+		for (int32 InputIndex = FirstInput; InputIndex < LastInput; InputIndex++)
+		{
+			// 1 is the message handler, 2 the function
+			lua_pushvalue(L, 2);
+			// inputs are decoded straight from the shared buffer
+			int64 Offset = Offsets[InputIndex];
+			if (!FLuaBinarySerializer::Deserialize(L, Inputs.GetData(), EndOffset, Offset, ChunkError))
+			{
+				ChunkError = FString::Printf(TEXT("Lua worker error: invalid input %d for %s: %s"), InputIndex, *FunctionName, *ChunkError);
+				return false;
+			}
+			lua_pushinteger(L, InputIndex + 1);
+			if (lua_pcall(L, 2, 1, 1))
+			{
+				ChunkError = FString::Printf(TEXT("Lua worker error: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+				return false;
+			}
+			const bool bSerialized = FLuaBinarySerializer::Serialize(L, -1, Results, ChunkError);
+			lua_pop(L, 1);
+			if (!bSerialized)
+			{
+				ChunkError = FString::Printf(TEXT("Lua worker error: invalid return value from %s for input %d: %s"), *FunctionName, InputIndex, *ChunkError);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void RunTask()
+	{
+		FString TaskError;
+		lua_State* L = WorkerGroup->Acquire(TaskError);
+		if (!L)
+		{
+			SetError(TaskError);
+		}
+		else
+		{
+			lua_pushcfunction(L, FLuaWorkerGroup::MessageHandler);
+			if (!FLuaWorkerGroup::PushFunction(L, FunctionName))
+			{
+				SetError(FString::Printf(TEXT("Lua worker error: %s is not a function"), *FunctionName));
+			}
+			else
+			{
+				// chunks are claimed dynamically, so idle workers keep stealing work from the slower ones
+				while (!bFailed)
+				{
+					const int32 Chunk = NextChunk.Increment() - 1;
+					if (Chunk >= NumChunks)
+					{
+						break;
+					}
+					if (!RunChunk(L, Chunk, TaskError))
+					{
+						SetError(TaskError);
+						break;
+					}
+				}
+			}
+			WorkerGroup->Release(L);
+		}
+
+		if (PendingTasks.Decrement() == 0)
+		{
+			Complete();
+		}
+	}
+
+	void Complete()
+	{
+		FLuaJobResult Result;
+		if (bFailed)
+		{
+			Result.Error = Error;
+		}
+		else
+		{
+			int64 ResultsSize = 0;
+			for (const TArray<uint8>& ChunkResult : ChunkResults)
+			{
+				ResultsSize += ChunkResult.Num();
+			}
+			Result.Results.Reserve(ResultsSize);
+			for (const TArray<uint8>& ChunkResult : ChunkResults)
+			{
+				Result.Results.Append(ChunkResult);
+			}
+			Result.bSuccess = true;
+		}
+		Promise.SetValue(MoveTemp(Result));
+	}
+};
+
+TFuture<FLuaJobResult> FLuaJobSystem::ParallelFor(TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<uint8> Inputs, TArray<int64> Offsets, const int32 ChunkSize)
+{
+	TSharedPtr<FLuaParallelForContext, ESPMode::ThreadSafe> Context = MakeShared<FLuaParallelForContext, ESPMode::ThreadSafe>();
+	TFuture<FLuaJobResult> Future = Context->Promise.GetFuture();
+
+	Context->WorkerGroup = GetWorkerGroup(StateClass);
+	if (!Context->WorkerGroup)
+	{
+		Context->SetError(TEXT("Lua worker error: invalid LuaState class"));
+		Context->Complete();
+		return Future;
+	}
+
+	if (Offsets.Num() == 0)
+	{
+		Context->Complete();
+		return Future;
+	}
+
+	const int32 NumWorkers = FMath::Max(FTaskGraphInterface::Get().GetNumWorkerThreads(), 1);
+	// without an explicit size, make 4 chunks per worker to balance the load without too much claiming overhead
+	Context->ChunkSize = ChunkSize > 0 ? ChunkSize : FMath::Max(Offsets.Num() / (NumWorkers * 4), 1);
+	Context->NumChunks = FMath::DivideAndRoundUp(Offsets.Num(), Context->ChunkSize);
+	Context->FunctionName = FunctionName;
+	Context->Inputs = MoveTemp(Inputs);
+	Context->Offsets = MoveTemp(Offsets);
+	Context->ChunkResults.SetNum(Context->NumChunks);
+
+	const int32 NumTasks = FMath::Min(NumWorkers, Context->NumChunks);
+	Context->PendingTasks.Set(NumTasks);
+	for (int32 TaskIndex = 0; TaskIndex < NumTasks; TaskIndex++)
+	{
+		AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [Context]()
+			{
+				Context->RunTask();
+			});
+	}
+
+	return Future;
+}
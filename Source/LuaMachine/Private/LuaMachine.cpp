@@ -2,6 +2,9 @@
 
 #include "LuaMachine.h"
 #include "LuaBlueprintFunctionLibrary.h"
+#include "LuaMachineStats.h"
+#include "Misc/App.h"
+#include "Misc/ScopeLock.h"
 #if WITH_EDITOR
 #include "Editor/UnrealEd/Public/Editor.h"
 #include "Editor/PropertyEditor/Public/PropertyEditorModule.h"
@@ -27,6 +30,64 @@ void FLuaMachineModule::StartupModule()
 	FWorldDelegates::LevelAddedToWorld.AddRaw(this, &FLuaMachineModule::LuaLevelAddedToWorld);
 	FWorldDelegates::LevelRemovedFromWorld.AddRaw(this, &FLuaMachineModule::LuaLevelRemovedFromWorld);
 
+#if ENGINE_MAJOR_VERSION > 4
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FLuaMachineModule::Tick));
+#else
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FLuaMachineModule::Tick));
+#endif
+
+	// loaded here as async loads read it from worker threads
+	ReloadByteCodeManifest();
+
+	// -LuaCoverage[=Filename] collects the coverage of the whole session (like an automation tests run)
+	if (FParse::Param(FCommandLine::Get(), TEXT("LuaCoverage")) || FParse::Value(FCommandLine::Get(), TEXT("LuaCoverage="), CoverageFilename))
+	{
+		if (CoverageFilename.IsEmpty())
+		{
+			CoverageFilename = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Coverage"), TEXT("LuaMachine.info"));
+		}
+		StartCoverage();
+	}
+}
+
+bool FLuaMachineModule::Tick(float DeltaTime)
+{
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_Tick);
+
+	// memory is only collected when someone is looking at it (stat LuaMachine or the trace channel)
+#if STATS
+	const bool bCollectStats = FThreadStats::IsCollectingData(GET_STATID(STAT_LuaUsedMemory));
+#else
+	const bool bCollectStats = false;
+#endif
+	const bool bCollectCounters = LUAMACHINE_TRACE_IS_ENABLED() || bCollectStats;
+
+	int64 UsedMemory = 0;
+	int64 MaxStateMemory = 0;
+	float GCPause = 0;
+	int32 NumScheduledCoroutines = 0;
+	int32 NumStates = 0;
+	for (ULuaState* LuaState : GetRegisteredLuaStates())
+	{
+		LuaState->TickLuaState(DeltaTime);
+		if (bCollectCounters && LuaState->GetInternalLuaState())
+		{
+			const int64 StateMemory = (int64)LuaState->GC(LUA_GCCOUNT) * 1024 + LuaState->GC(LUA_GCCOUNTB);
+			UsedMemory += StateMemory;
+			MaxStateMemory = FMath::Max(MaxStateMemory, StateMemory);
+			GCPause += LuaState->GetGCStats().LastPause;
+			NumScheduledCoroutines += LuaState->GetNumScheduledCoroutines();
+			NumStates++;
+		}
+	}
+	if (LUAMACHINE_TRACE_IS_ENABLED())
+	{
+		FLuaTrace::UpdateCounters(UsedMemory, GCPause, NumScheduledCoroutines);
+	}
+	SET_DWORD_STAT(STAT_LuaNumStates, NumStates);
+	SET_MEMORY_STAT(STAT_LuaUsedMemory, UsedMemory);
+	SET_MEMORY_STAT(STAT_LuaMaxStateMemory, MaxStateMemory);
+	return true;
 }
 
 void FLuaMachineModule::LuaLevelAddedToWorld(ULevel* Level, UWorld* World)
@@ -63,6 +124,49 @@ void FLuaMachineModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+#if ENGINE_MAJOR_VERSION > 4
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+#else
+	FTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+#endif
+	JobSystem.Reset();
+
+	if (!CoverageFilename.IsEmpty())
+	{
+		Coverage.Stop();
+		if (Coverage.SaveLCOV(CoverageFilename, FApp::GetProjectName()))
+		{
+			UE_LOG(LogLuaMachine, Log, TEXT("Lua coverage (%d chunks) saved to %s"), Coverage.GetChunks().Num(), *CoverageFilename);
+		}
+	}
+}
+
+void FLuaMachineModule::StartCoverage()
+{
+	Coverage.Start();
+	for (ULuaState* LuaState : GetRegisteredLuaStates())
+	{
+		LuaState->UpdateHookMask();
+	}
+}
+
+void FLuaMachineModule::StopCoverage()
+{
+	Coverage.Stop();
+	for (ULuaState* LuaState : GetRegisteredLuaStates())
+	{
+		LuaState->UpdateHookMask();
+	}
+}
+
+void FLuaMachineModule::AddStartupStats(ULuaState* LuaState, const FLuaStartupStats& Stats)
+{
+	StartupStatsByClass.FindOrAdd(LuaState->GetClass()->GetName()).Add(Stats);
+}
+
+void FLuaMachineModule::ResetStartupStats()
+{
+	StartupStatsByClass.Empty();
 }
 
 void FLuaMachineModule::AddReferencedObjects(FReferenceCollector& Collector)
@@ -261,6 +365,30 @@ FLuaMachineModule& FLuaMachineModule::Get()
 	return *Singleton;
 }
 
+const FLuaByteCodeManifest& FLuaMachineModule::GetByteCodeManifest()
+{
+	check(IsInGameThread());
+	return *ByteCodeManifest;
+}
+
+TSharedRef<const FLuaByteCodeManifest, ESPMode::ThreadSafe> FLuaMachineModule::GetSharedByteCodeManifest()
+{
+	FScopeLock ByteCodeManifestScopeLock(&ByteCodeManifestLock);
+	return ByteCodeManifest.ToSharedRef();
+}
+
+void FLuaMachineModule::ReloadByteCodeManifest()
+{
+	TSharedRef<FLuaByteCodeManifest, ESPMode::ThreadSafe> NewByteCodeManifest = MakeShared<FLuaByteCodeManifest, ESPMode::ThreadSafe>();
+	if (NewByteCodeManifest->Load(FLuaByteCodeManifest::GetDefaultDirectory()))
+	{
+		UE_LOG(LogLuaMachine, Log, TEXT("Loaded Lua bytecode manifest (%d scripts)"), NewByteCodeManifest->Num());
+	}
+
+	FScopeLock ByteCodeManifestScopeLock(&ByteCodeManifestLock);
+	ByteCodeManifest = NewByteCodeManifest;
+}
+
 bool FLuaMachineModule::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& Ar)
 {
 	if (FParse::Command(&Cmd, TEXT("luaspawn")))
@@ -308,6 +436,258 @@ bool FLuaMachineModule::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& A
 		}
 	}
 
+	// luaprofile start [SampleInterval] [MaxSamples] [MaxDepth] | stop | save [Directory]
+	if (FParse::Command(&Cmd, TEXT("luaprofile")))
+	{
+		TArray<ULuaState*> RegisteredLuaStates = GetRegisteredLuaStates();
+		if (FParse::Command(&Cmd, TEXT("start")))
+		{
+			FString SampleIntervalString;
+			FString MaxSamplesString;
+			FString MaxDepthString;
+			FParse::Token(Cmd, SampleIntervalString, false);
+			FParse::Token(Cmd, MaxSamplesString, false);
+			FParse::Token(Cmd, MaxDepthString, false);
+			const int32 SampleInterval = FCString::Atoi(*SampleIntervalString);
+			const int32 MaxSamples = FCString::Atoi(*MaxSamplesString);
+			const int32 MaxDepth = FCString::Atoi(*MaxDepthString);
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				if (SampleInterval > 0)
+				{
+					LuaState->ProfilerSampleInterval = SampleInterval;
+				}
+				if (MaxSamples > 0)
+				{
+					LuaState->ProfilerMaxSamples = MaxSamples;
+				}
+				if (MaxDepth > 0)
+				{
+					LuaState->ProfilerMaxDepth = MaxDepth;
+				}
+				LuaState->StartProfiler();
+			}
+			Ar.Logf(TEXT("Lua profiler started on %d LuaStates"), RegisteredLuaStates.Num());
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("stop")))
+		{
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				LuaState->StopProfiler();
+			}
+			Ar.Logf(TEXT("Lua profiler stopped"));
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("save")))
+		{
+			const FString Directory = *Cmd ? FString(Cmd).TrimStartAndEnd() : FPaths::Combine(FPaths::ProfilingDir(), TEXT("LuaMachine"));
+			const FString Timestamp = FDateTime::Now().ToString();
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				if (LuaState->GetProfiler().GetNumSamples() == 0)
+				{
+					continue;
+				}
+				const FString BaseFilename = FPaths::Combine(Directory, FString::Printf(TEXT("%s-%s"), *LuaState->GetName(), *Timestamp));
+				LuaState->SaveProfilerCollapsed(BaseFilename + TEXT(".folded"));
+				LuaState->SaveProfilerSpeedscope(BaseFilename + TEXT(".speedscope.json"));
+				Ar.Logf(TEXT("%s: %d samples (%lld dropped) saved to %s"), *LuaState->GetName(), LuaState->GetProfiler().GetNumSamples(), LuaState->GetProfiler().GetNumDroppedSamples(), *BaseFilename);
+			}
+			return true;
+		}
+
+		Ar.Logf(TEXT("usage: luaprofile start [SampleInterval] [MaxSamples] [MaxDepth] | stop | save [Directory]"));
+		return true;
+	}
+
+	// luacoverage start | stop | reset | save [Filename]
+	if (FParse::Command(&Cmd, TEXT("luacoverage")))
+	{
+		if (FParse::Command(&Cmd, TEXT("start")))
+		{
+			StartCoverage();
+			Ar.Logf(TEXT("Lua coverage started"));
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("stop")))
+		{
+			StopCoverage();
+			Ar.Logf(TEXT("Lua coverage stopped"));
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("reset")))
+		{
+			Coverage.Reset();
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("save")))
+		{
+			const FString Filename = *Cmd ? FString(Cmd).TrimStartAndEnd() : FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Coverage"), TEXT("LuaMachine.info"));
+			if (Coverage.SaveLCOV(Filename, FApp::GetProjectName()))
+			{
+				Ar.Logf(TEXT("Lua coverage (%d chunks) saved to %s"), Coverage.GetChunks().Num(), *Filename);
+			}
+			return true;
+		}
+
+		Ar.Logf(TEXT("usage: luacoverage start | stop | reset | save [Filename]"));
+		return true;
+	}
+
+	// luastartup [reset]
+	if (FParse::Command(&Cmd, TEXT("luastartup")))
+	{
+		if (FParse::Command(&Cmd, TEXT("reset")))
+		{
+			ResetStartupStats();
+			return true;
+		}
+
+		for (const TPair<FString, FLuaStartupClassStats>& Pair : StartupStatsByClass)
+		{
+			const FLuaStartupStats Average = Pair.Value.GetAverage();
+			Ar.Logf(TEXT("%s: %d states, %.2f ms average, %.2f ms max, %lld KB average"), *Pair.Key, Pair.Value.NumStates, Average.Time, Pair.Value.MaxTime, Average.Bytes / 1024);
+			for (const FLuaStartupPhase& Phase : Average.Phases)
+			{
+				Ar.Logf(TEXT("  %-18s %8.3f ms %8lld KB %8lld allocations"), *Phase.Name, Phase.Time, Phase.Bytes / 1024, Phase.Allocations);
+			}
+		}
+		return true;
+	}
+
+	// luamemreport [fast]
+	if (FParse::Command(&Cmd, TEXT("luamemreport")))
+	{
+		const bool bWalkHeap = !FParse::Command(&Cmd, TEXT("fast"));
+		for (ULuaState* LuaState : GetRegisteredLuaStates())
+		{
+			const FLuaMemoryReport Report = LuaState->GetMemoryReport(bWalkHeap);
+			Ar.Logf(TEXT("%s: %lld bytes (peak %lld) in %lld allocations, %d registry entries, %d LuaValue refs, %d tracked UserDataObjects"), *LuaState->GetName(),
+				Report.UsedBytes, Report.PeakBytes, Report.NumAllocations, Report.RegistrySize, Report.NumLuaValueRefs, Report.NumTrackedUserDataObjects);
+			if (!bWalkHeap)
+			{
+				continue;
+			}
+			Ar.Logf(TEXT("  strings: %8d %12lld bytes"), Report.NumStrings, Report.StringBytes);
+			Ar.Logf(TEXT("  tables: %9d %12lld bytes"), Report.NumTables, Report.TableBytes);
+			Ar.Logf(TEXT("  functions: %6d %12lld bytes"), Report.NumFunctions, Report.FunctionBytes);
+			Ar.Logf(TEXT("  userdata: %7d %12lld bytes"), Report.NumUserData, Report.UserDataBytes);
+			Ar.Logf(TEXT("  threads: %8d %12lld bytes"), Report.NumThreads, Report.ThreadBytes);
+			Ar.Logf(TEXT("  other: %23lld bytes%s"), Report.OtherBytes, Report.bTruncated ? TEXT(" (heap walk truncated)") : TEXT(""));
+		}
+		return true;
+	}
+
+	// luafunctions [Count] | reset
+	if (FParse::Command(&Cmd, TEXT("luafunctions")))
+	{
+		TArray<ULuaState*> RegisteredLuaStates = GetRegisteredLuaStates();
+		if (FParse::Command(&Cmd, TEXT("reset")))
+		{
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				LuaState->ResetFunctionStats();
+			}
+			return true;
+		}
+
+		const int32 Count = *Cmd ? FCString::Atoi(Cmd) : 10;
+		for (ULuaState* LuaState : RegisteredLuaStates)
+		{
+			if (!LuaState->bEnableFunctionStats)
+			{
+				continue;
+			}
+			Ar.Logf(TEXT("%s:"), *LuaState->GetName());
+			for (const FLuaFunctionStat& Function : LuaState->GetTopLuaFunctions(Count))
+			{
+				Ar.Logf(TEXT("  %8.3f ms %8.3f ms %8d calls  %s (%s:%d)"), Function.ExclusiveTime, Function.InclusiveTime, Function.Calls, *Function.Name, *Function.Source, Function.Line);
+			}
+		}
+		return true;
+	}
+
+	// luarefs start | stop | dump [NumSites] | snapshot | diff [SnapshotA] [SnapshotB] [NumSites]
+	if (FParse::Command(&Cmd, TEXT("luarefs")))
+	{
+		TArray<ULuaState*> RegisteredLuaStates = GetRegisteredLuaStates();
+		if (FParse::Command(&Cmd, TEXT("start")))
+		{
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				LuaState->StartRefTracker();
+			}
+			Ar.Logf(TEXT("Lua ref tracker started on %d LuaStates"), RegisteredLuaStates.Num());
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("stop")))
+		{
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				LuaState->StopRefTracker();
+			}
+			Ar.Logf(TEXT("Lua ref tracker stopped"));
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("dump")))
+		{
+			const int32 NumSites = *Cmd ? FCString::Atoi(Cmd) : 10;
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				Ar.Logf(TEXT("%s:"), *LuaState->GetName());
+				LuaState->GetRefTracker().Dump(Ar, NumSites);
+			}
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("snapshot")))
+		{
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				const int32 Snapshot = LuaState->GetRefTracker().TakeSnapshot();
+				Ar.Logf(TEXT("%s: snapshot %d (%d live references)"), *LuaState->GetName(), Snapshot, LuaState->GetRefTracker().GetNumRefs());
+			}
+			return true;
+		}
+
+		if (FParse::Command(&Cmd, TEXT("diff")))
+		{
+			// by default compare the last two snapshots (or the last one with the live references)
+			FString SnapshotAString;
+			FString SnapshotBString;
+			FString NumSitesString;
+			FParse::Token(Cmd, SnapshotAString, false);
+			FParse::Token(Cmd, SnapshotBString, false);
+			FParse::Token(Cmd, NumSitesString, false);
+			const int32 NumSites = NumSitesString.IsEmpty() ? 10 : FCString::Atoi(*NumSitesString);
+			for (ULuaState* LuaState : RegisteredLuaStates)
+			{
+				const int32 NumSnapshots = LuaState->GetRefTracker().GetNumSnapshots();
+				int32 SnapshotA = NumSnapshots > 1 ? NumSnapshots - 2 : 0;
+				int32 SnapshotB = NumSnapshots > 1 ? NumSnapshots - 1 : INDEX_NONE;
+				if (!SnapshotAString.IsEmpty())
+				{
+					SnapshotA = FCString::Atoi(*SnapshotAString);
+					SnapshotB = SnapshotBString.IsEmpty() ? INDEX_NONE : FCString::Atoi(*SnapshotBString);
+				}
+				Ar.Logf(TEXT("%s:"), *LuaState->GetName());
+				LuaState->GetRefTracker().Diff(Ar, SnapshotA, SnapshotB, NumSites);
+			}
+			return true;
+		}
+
+		Ar.Logf(TEXT("usage: luarefs start | stop | dump [NumSites] | snapshot | diff [SnapshotA] [SnapshotB] [NumSites]"));
+		return true;
+	}
+
 	return false;
 }
 
@@ -0,0 +1,33 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaMachineStats.h"
+
+DEFINE_STAT(STAT_LuaFromLuaValue);
+DEFINE_STAT(STAT_LuaToLuaValue);
+DEFINE_STAT(STAT_LuaUFunctionCall);
+DEFINE_STAT(STAT_LuaUFunctionRawCall);
+DEFINE_STAT(STAT_LuaJsonConversion);
+
+DEFINE_STAT(STAT_LuaFromLuaValueCalls);
+DEFINE_STAT(STAT_LuaToLuaValueCalls);
+DEFINE_STAT(STAT_LuaConvertedNil);
+DEFINE_STAT(STAT_LuaConvertedBool);
+DEFINE_STAT(STAT_LuaConvertedNumber);
+DEFINE_STAT(STAT_LuaConvertedString);
+DEFINE_STAT(STAT_LuaConvertedTable);
+DEFINE_STAT(STAT_LuaConvertedFunction);
+DEFINE_STAT(STAT_LuaConvertedThread);
+DEFINE_STAT(STAT_LuaConvertedUObject);
+DEFINE_STAT(STAT_LuaConvertedUFunction);
+DEFINE_STAT(STAT_LuaConvertedDelegate);
+DEFINE_STAT(STAT_LuaUFunctionCalls);
+DEFINE_STAT(STAT_LuaUFunctionRawCalls);
+DEFINE_STAT(STAT_LuaUserDataAllocations);
+DEFINE_STAT(STAT_LuaMetaTableAllocations);
+DEFINE_STAT(STAT_LuaRefs);
+DEFINE_STAT(STAT_LuaUnrefs);
+DEFINE_STAT(STAT_LuaJsonConversions);
+
+DEFINE_STAT(STAT_LuaNumStates);
+DEFINE_STAT(STAT_LuaUsedMemory);
+DEFINE_STAT(STAT_LuaMaxStateMemory);
@@ -0,0 +1,256 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaMemory.h"
+#include "LuaState.h"
+#if ENGINE_MAJOR_VERSION > 4
+#include "HAL/LowLevelMemTracker.h"
+
+LLM_DEFINE_TAG(LuaMachine);
+#endif
+
+// estimated sizes of the Lua objects (64 bit Lua 5.3/5.4)
+static const int64 LuaMemoryStringSize = 24;
+static const int64 LuaMemoryTableSize = 56;
+static const int64 LuaMemoryTValueSize = 16;
+static const int64 LuaMemoryNodeSize = 32;
+static const int64 LuaMemoryClosureSize = 32;
+static const int64 LuaMemoryUpValueSize = 40;
+static const int64 LuaMemoryUserDataSize = 40;
+static const int64 LuaMemoryThreadSize = 208;
+static const int64 LuaMemoryThreadMinStack = 40;
+
+void* FLuaAllocator::Alloc(void* UserData, void* Ptr, size_t OldSize, size_t NewSize)
+{
+#if ENGINE_MAJOR_VERSION > 4
+	LLM_SCOPE_BYTAG(LuaMachine);
+#endif
+	FLuaAllocatorStats* Stats = (FLuaAllocatorStats*)UserData;
+	// when Ptr is null OldSize is the type of the new object
+	const int64 FreedSize = Ptr ? (int64)OldSize : 0;
+
+	if (NewSize == 0)
+	{
+		if (Ptr)
+		{
+			FMemory::Free(Ptr);
+			if (Stats)
+			{
+				Stats->UsedBytes -= FreedSize;
+				Stats->NumAllocations--;
+			}
+		}
+		return nullptr;
+	}
+
+	void* NewPtr = FMemory::Realloc(Ptr, NewSize);
+	if (Stats && NewPtr)
+	{
+		Stats->UsedBytes += (int64)NewSize - FreedSize;
+		Stats->PeakBytes = FMath::Max(Stats->PeakBytes, Stats->UsedBytes);
+		if (!Ptr)
+		{
+			Stats->NumAllocations++;
+			Stats->TotalAllocations++;
+		}
+	}
+	return NewPtr;
+}
+
+int FLuaAllocator::Panic(lua_State* L)
+{
+	const char* Message = lua_tostring(L, -1);
+	UE_LOG(LogLuaMachine, Error, TEXT("unprotected error in Lua: %s"), Message ? UTF8_TO_TCHAR(Message) : TEXT("(error object is not a string)"));
+	// Lua will abort()
+	return 0;
+}
+
+lua_State* FLuaAllocator::NewState(FLuaAllocatorStats* Stats)
+{
+#if LUAMACHINE_LUAJIT
+	lua_State* L = luaL_newstate();
+	if (L)
+	{
+		LuaCompat_InitExtraSpace(L);
+	}
+	return L;
+#else
+	lua_State* L = lua_newstate(FLuaAllocator::Alloc, Stats);
+	if (L)
+	{
+		lua_atpanic(L, FLuaAllocator::Panic);
+	}
+	return L;
+#endif
+}
+
+/* depth first walk using the Lua stack for the pending objects (so they are anchored) */
+struct FLuaHeapWalker
+{
+	lua_State* L;
+	FLuaMemoryReport& Report;
+	TSet<const void*> Visited;
+
+	FLuaHeapWalker(lua_State* InL, FLuaMemoryReport& InReport) : L(InL), Report(InReport)
+	{
+	}
+
+	/* consume the value on top of the stack, moving it below ObjectIndex (that is incremented) if it has to be traversed */
+	void Discover(int& ObjectIndex)
+	{
+		const int Type = lua_type(L, -1);
+		if (Type == LUA_TSTRING)
+		{
+			size_t Length = 0;
+			const char* String = lua_tolstring(L, -1, &Length);
+			bool bAlreadyVisited = false;
+			Visited.Add(String, &bAlreadyVisited);
+			if (!bAlreadyVisited)
+			{
+				Report.NumStrings++;
+				Report.StringBytes += LuaMemoryStringSize + Length + 1;
+			}
+			lua_pop(L, 1);
+			return;
+		}
+
+		const void* Pointer = (Type == LUA_TTABLE || Type == LUA_TFUNCTION || Type == LUA_TUSERDATA || Type == LUA_TTHREAD) ? lua_topointer(L, -1) : nullptr;
+		bool bAlreadyVisited = true;
+		if (Pointer)
+		{
+			Visited.Add(Pointer, &bAlreadyVisited);
+		}
+		// keep a free slot for each traversal step
+		if (bAlreadyVisited || !lua_checkstack(L, 8))
+		{
+			Report.bTruncated |= !bAlreadyVisited;
+			lua_pop(L, 1);
+			return;
+		}
+
+		lua_insert(L, ObjectIndex);
+		ObjectIndex++;
+	}
+
+	/* account and pop the object on top of the stack, discovering the objects it references */
+	void Traverse()
+	{
+		int ObjectIndex = lua_gettop(L);
+
+		if (lua_getmetatable(L, ObjectIndex))
+		{
+			Discover(ObjectIndex);
+		}
+
+		switch (lua_type(L, ObjectIndex))
+		{
+		case LUA_TTABLE:
+		{
+			const int64 ArraySize = (int64)lua_rawlen(L, ObjectIndex);
+			int64 NumEntries = 0;
+			lua_pushnil(L);
+			while (lua_next(L, ObjectIndex))
+			{
+				NumEntries++;
+				lua_pushvalue(L, -2);
+				Discover(ObjectIndex);
+				lua_pushvalue(L, -1);
+				Discover(ObjectIndex);
+				lua_pop(L, 1);
+			}
+			const int64 NumNodes = NumEntries > ArraySize ? (int64)FMath::RoundUpToPowerOfTwo64((uint64)(NumEntries - ArraySize)) : 0;
+			Report.NumTables++;
+			Report.TableBytes += LuaMemoryTableSize + ArraySize * LuaMemoryTValueSize + NumNodes * LuaMemoryNodeSize;
+		}
+		break;
+		case LUA_TFUNCTION:
+		{
+			const bool bCFunction = lua_iscfunction(L, ObjectIndex) != 0;
+			int NumUpValues = 0;
+			while (lua_getupvalue(L, ObjectIndex, NumUpValues + 1))
+			{
+				NumUpValues++;
+				Discover(ObjectIndex);
+			}
+#if LUAMACHINE_LUAJIT
+			lua_getfenv(L, ObjectIndex);
+			Discover(ObjectIndex);
+#endif
+			Report.NumFunctions++;
+			Report.FunctionBytes += LuaMemoryClosureSize + NumUpValues * (bCFunction ? LuaMemoryTValueSize : 8 + LuaMemoryUpValueSize);
+		}
+		break;
+		case LUA_TUSERDATA:
+		{
+#if LUAMACHINE_LUAJIT
+			lua_getfenv(L, ObjectIndex);
+			Discover(ObjectIndex);
+#elif LUAMACHINE_LUA54
+			for (int UserValue = 1; lua_getiuservalue(L, ObjectIndex, UserValue) != LUA_TNONE; UserValue++)
+			{
+				Discover(ObjectIndex);
+			}
+			lua_pop(L, 1);
+#else
+			lua_getuservalue(L, ObjectIndex);
+			Discover(ObjectIndex);
+#endif
+			Report.NumUserData++;
+			Report.UserDataBytes += LuaMemoryUserDataSize + (int64)lua_rawlen(L, ObjectIndex);
+		}
+		break;
+		case LUA_TTHREAD:
+		{
+			lua_State* Thread = lua_tothread(L, ObjectIndex);
+			const int ThreadTop = lua_gettop(Thread);
+			// the stack of the walking thread holds the pending objects
+			if (Thread != L && lua_checkstack(Thread, 1))
+			{
+				for (int Index = 1; Index <= ThreadTop; Index++)
+				{
+					lua_pushvalue(Thread, Index);
+					lua_xmove(Thread, L, 1);
+					Discover(ObjectIndex);
+				}
+			}
+			Report.NumThreads++;
+			Report.ThreadBytes += LuaMemoryThreadSize + FMath::Max(ThreadTop, (int)LuaMemoryThreadMinStack) * LuaMemoryTValueSize;
+		}
+		break;
+		default:
+			break;
+		}
+
+		lua_remove(L, ObjectIndex);
+	}
+};
+
+void FLuaAllocator::WalkHeap(lua_State* L, FLuaMemoryReport& Report)
+{
+	const int Top = lua_gettop(L);
+
+	lua_pushnil(L);
+	while (lua_next(L, LUA_REGISTRYINDEX))
+	{
+		Report.RegistrySize++;
+		lua_pop(L, 1);
+	}
+
+	FLuaHeapWalker HeapWalker(L, Report);
+	lua_pushvalue(L, LUA_REGISTRYINDEX);
+	int RootIndex = lua_gettop(L);
+	HeapWalker.Discover(RootIndex);
+#if LUAMACHINE_LUAJIT
+	// globals are not in the registry
+	lua_pushvalue(L, LUA_GLOBALSINDEX);
+	RootIndex = lua_gettop(L);
+	HeapWalker.Discover(RootIndex);
+#endif
+
+	while (lua_gettop(L) > Top)
+	{
+		HeapWalker.Traverse();
+	}
+
+	Report.UsedBytes = (int64)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+	Report.OtherBytes = FMath::Max<int64>(Report.UsedBytes - Report.StringBytes - Report.TableBytes - Report.FunctionBytes - Report.UserDataBytes - Report.ThreadBytes, 0);
+}
@@ -0,0 +1,247 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaProfiler.h"
+#include "Serialization/JsonWriter.h"
+#include "Policies/CondensedJsonPrintPolicy.h"
+
+// frame id used as the root of stacks deeper than MaxDepth
+static const int32 LuaProfilerTruncatedFrame = 0;
+
+FLuaProfiler::FLuaProfiler()
+{
+	bActive = false;
+	SampleInterval = 1000;
+	MaxSamples = 0;
+	MaxDepth = 0;
+	NextSample = 0;
+	NumSamples = 0;
+	NumDroppedSamples = 0;
+}
+
+void FLuaProfiler::Start(const int32 InSampleInterval, const int32 InMaxSamples, const int32 InMaxDepth)
+{
+	Reset();
+
+	SampleInterval = FMath::Max(InSampleInterval, 1);
+	MaxSamples = FMath::Max(InMaxSamples, 1);
+	MaxDepth = FMath::Clamp(InMaxDepth, 2, (int32)MAX_uint16);
+
+	SampleFrames.SetNumUninitialized(MaxSamples * MaxDepth);
+	SampleDepths.SetNumZeroed(MaxSamples);
+
+	bActive = true;
+}
+
+void FLuaProfiler::Stop()
+{
+	bActive = false;
+}
+
+void FLuaProfiler::Reset()
+{
+	bActive = false;
+	NextSample = 0;
+	NumSamples = 0;
+	NumDroppedSamples = 0;
+	SampleFrames.Empty();
+	SampleDepths.Empty();
+	Strings.Reset();
+	FrameIds.Empty();
+	Frames.Empty();
+
+	FLuaProfilerFrame TruncatedFrame;
+	TruncatedFrame.Name = TEXT("(truncated)");
+	TruncatedFrame.Line = 0;
+	Frames.Add(TruncatedFrame);
+}
+
+int32 FLuaProfiler::InternFrame(const lua_Debug& Debug)
+{
+	FFrameKey Key;
+	Key.SourceId = Strings.Intern(Debug.source);
+	Key.NameId = Strings.Intern(Debug.name);
+	Key.LineDefined = Debug.linedefined;
+
+	if (const int32* FrameId = FrameIds.Find(Key))
+	{
+		return *FrameId;
+	}
+
+	FLuaProfilerFrame Frame;
+	Frame.Source = UTF8_TO_TCHAR(Debug.short_src);
+	Frame.Line = Debug.linedefined;
+	if (Debug.name)
+	{
+		Frame.Name = UTF8_TO_TCHAR(Debug.name);
+	}
+	else if (Debug.what && FCStringAnsi::Strcmp(Debug.what, "main") == 0)
+	{
+		Frame.Name = TEXT("(main chunk)");
+	}
+	else
+	{
+		Frame.Name = TEXT("(anonymous)");
+	}
+
+	if (Debug.linedefined > 0)
+	{
+		Frame.Name += FString::Printf(TEXT(" (%s:%d)"), *Frame.Source, Debug.linedefined);
+	}
+	else if (Debug.what && FCStringAnsi::Strcmp(Debug.what, "C") != 0)
+	{
+		Frame.Name += FString::Printf(TEXT(" (%s)"), *Frame.Source);
+	}
+
+	const int32 FrameId = Frames.Add(MoveTemp(Frame));
+	FrameIds.Add(Key, FrameId);
+	return FrameId;
+}
+
+void FLuaProfiler::Sample(lua_State* L)
+{
+	if (!bActive)
+	{
+		return;
+	}
+
+	int32* Stack = SampleFrames.GetData() + NextSample * MaxDepth;
+	int32 Depth = 0;
+
+	lua_Debug Debug;
+	while (Depth < MaxDepth && lua_getstack(L, Depth, &Debug))
+	{
+		lua_getinfo(L, "Sn", &Debug);
+		Stack[Depth++] = InternFrame(Debug);
+	}
+
+	if (Depth == MaxDepth && lua_getstack(L, Depth, &Debug))
+	{
+		// keep the leaf frames, they are the most interesting ones
+		Stack[MaxDepth - 1] = LuaProfilerTruncatedFrame;
+	}
+
+	SampleDepths[NextSample] = (uint16)Depth;
+	NextSample = (NextSample + 1) % MaxSamples;
+	if (NumSamples < MaxSamples)
+	{
+		NumSamples++;
+	}
+	else
+	{
+		NumDroppedSamples++;
+	}
+}
+
+void FLuaProfiler::ForEachSample(TFunctionRef<void(const int32* FrameIds, const int32 Depth)> Visitor) const
+{
+	TArray<int32> RootFirst;
+	RootFirst.Reserve(MaxDepth);
+
+	const int32 FirstSample = NumSamples < MaxSamples ? 0 : NextSample;
+	for (int32 Index = 0; Index < NumSamples; Index++)
+	{
+		const int32 SampleIndex = (FirstSample + Index) % MaxSamples;
+		const int32* Stack = SampleFrames.GetData() + SampleIndex * MaxDepth;
+		const int32 Depth = SampleDepths[SampleIndex];
+
+		RootFirst.Reset();
+		for (int32 Level = Depth - 1; Level >= 0; Level--)
+		{
+			RootFirst.Add(Stack[Level]);
+		}
+		Visitor(RootFirst.GetData(), Depth);
+	}
+}
+
+FString FLuaProfiler::ExportCollapsed() const
+{
+	TMap<FString, int32> Stacks;
+	ForEachSample([&](const int32* Ids, const int32 Depth)
+		{
+			if (Depth == 0)
+			{
+				return;
+			}
+			FString Stack;
+			for (int32 Level = 0; Level < Depth; Level++)
+			{
+				if (Level > 0)
+				{
+					Stack += TEXT(";");
+				}
+				// ';' is the separator of the format
+				Stack += Frames[Ids[Level]].Name.Replace(TEXT(";"), TEXT(":"));
+			}
+			Stacks.FindOrAdd(Stack)++;
+		});
+
+	FString Output;
+	for (const TPair<FString, int32>& Pair : Stacks)
+	{
+		Output += FString::Printf(TEXT("%s %d\n"), *Pair.Key, Pair.Value);
+	}
+	return Output;
+}
+
+FString FLuaProfiler::ExportSpeedscope(const FString& ProfileName) const
+{
+	FString Output;
+	TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> Writer = TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&Output);
+
+	Writer->WriteObjectStart();
+	Writer->WriteValue(TEXT("$schema"), TEXT("https://www.speedscope.app/file-format-schema.json"));
+	Writer->WriteValue(TEXT("name"), ProfileName);
+	Writer->WriteValue(TEXT("exporter"), TEXT("LuaMachine"));
+
+	Writer->WriteObjectStart(TEXT("shared"));
+	Writer->WriteArrayStart(TEXT("frames"));
+	for (const FLuaProfilerFrame& Frame : Frames)
+	{
+		Writer->WriteObjectStart();
+		Writer->WriteValue(TEXT("name"), Frame.Name);
+		if (!Frame.Source.IsEmpty())
+		{
+			Writer->WriteValue(TEXT("file"), Frame.Source);
+		}
+		if (Frame.Line > 0)
+		{
+			Writer->WriteValue(TEXT("line"), Frame.Line);
+		}
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteArrayEnd();
+	Writer->WriteObjectEnd();
+
+	Writer->WriteArrayStart(TEXT("profiles"));
+	Writer->WriteObjectStart();
+	Writer->WriteValue(TEXT("type"), TEXT("sampled"));
+	Writer->WriteValue(TEXT("name"), ProfileName);
+	// every sample accounts for SampleInterval instructions
+	Writer->WriteValue(TEXT("unit"), TEXT("none"));
+	Writer->WriteValue(TEXT("startValue"), 0);
+	Writer->WriteValue(TEXT("endValue"), (int64)NumSamples * SampleInterval);
+	Writer->WriteArrayStart(TEXT("samples"));
+	ForEachSample([&](const int32* Ids, const int32 Depth)
+		{
+			Writer->WriteArrayStart();
+			for (int32 Level = 0; Level < Depth; Level++)
+			{
+				Writer->WriteValue(Ids[Level]);
+			}
+			Writer->WriteArrayEnd();
+		});
+	Writer->WriteArrayEnd();
+	Writer->WriteArrayStart(TEXT("weights"));
+	for (int32 Index = 0; Index < NumSamples; Index++)
+	{
+		Writer->WriteValue(SampleInterval);
+	}
+	Writer->WriteArrayEnd();
+	Writer->WriteObjectEnd();
+	Writer->WriteArrayEnd();
+
+	Writer->WriteObjectEnd();
+	Writer->Close();
+
+	return Output;
+}
@@ -0,0 +1,254 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaRefTracker.h"
+#include "HAL/PlatformStackWalk.h"
+#include "UObject/Script.h"
+#include "UObject/Stack.h"
+
+// OnRef() and ULuaState::NewRef()
+static const int32 LuaRefTrackerSkippedFrames = 2;
+static const int32 LuaRefTrackerMaxStackDepth = 64;
+
+static const TCHAR* LuaRefTrackerTypeNames[] = { TEXT("nil"), TEXT("boolean"), TEXT("lightuserdata"), TEXT("number"), TEXT("string"), TEXT("table"), TEXT("function"), TEXT("userdata"), TEXT("thread") };
+static const int32 LuaRefTrackerNumTypes = UE_ARRAY_COUNT(LuaRefTrackerTypeNames);
+
+FLuaRefTracker::FLuaRefTracker()
+{
+	bActive = false;
+	StackDepth = 0;
+	NextSerial = 0;
+}
+
+void FLuaRefTracker::Start(const int32 InStackDepth)
+{
+	Reset();
+	FPlatformStackWalk::InitStackWalking();
+	StackDepth = FMath::Clamp(InStackDepth, 0, LuaRefTrackerMaxStackDepth);
+	bActive = true;
+}
+
+void FLuaRefTracker::Stop()
+{
+	bActive = false;
+}
+
+void FLuaRefTracker::Reset()
+{
+	bActive = false;
+	NextSerial = 0;
+	Refs.Empty();
+	SiteIds.Empty();
+	Sites.Empty();
+	Snapshots.Empty();
+}
+
+void FLuaRefTracker::OnRef(lua_State* L, const int Ref)
+{
+	if (!bActive || Ref == LUA_REFNIL || Ref == LUA_NOREF)
+	{
+		return;
+	}
+
+	FLuaRefSite Site;
+
+	if (StackDepth > 0)
+	{
+		uint64 BackTrace[LuaRefTrackerMaxStackDepth + LuaRefTrackerSkippedFrames];
+		const int32 Depth = FPlatformStackWalk::CaptureStackBackTrace(BackTrace, StackDepth + LuaRefTrackerSkippedFrames);
+		if (Depth > LuaRefTrackerSkippedFrames)
+		{
+			Site.BackTrace.Append(BackTrace + LuaRefTrackerSkippedFrames, Depth - LuaRefTrackerSkippedFrames);
+		}
+	}
+
+#if DO_BLUEPRINT_GUARD
+#if ENGINE_MAJOR_VERSION > 4
+	TArrayView<const FFrame* const> ScriptStack = FBlueprintContextTracker::Get().GetCurrentScriptStack();
+#else
+	const TArray<const FFrame*>& ScriptStack = FBlueprintContextTracker::Get().GetScriptStack();
+#endif
+	if (ScriptStack.Num() > 0)
+	{
+		const FFrame* Frame = ScriptStack.Last();
+		if (Frame && Frame->Node)
+		{
+			const int32 CodeOffset = Frame->Code ? (int32)(Frame->Code - Frame->Node->Script.GetData()) : INDEX_NONE;
+			Site.Blueprint = FString::Printf(TEXT("%s +%d"), *Frame->Node->GetPathName(), CodeOffset);
+		}
+	}
+#endif
+
+	// the innermost Lua function (level 0 is the C function being called, if any)
+	lua_Debug Debug;
+	for (int32 Level = 0; lua_getstack(L, Level, &Debug); Level++)
+	{
+		lua_getinfo(L, "Sl", &Debug);
+		if (Debug.currentline > 0)
+		{
+			Site.Lua = FString::Printf(TEXT("%s:%d"), UTF8_TO_TCHAR(Debug.short_src), Debug.currentline);
+			break;
+		}
+	}
+
+	FRefRecord& Record = Refs.Add(Ref);
+	Record.Serial = NextSerial++;
+	Record.Time = FPlatformTime::Seconds();
+	Record.LuaType = lua_type(L, -1);
+	Record.SiteId = InternSite(MoveTemp(Site));
+}
+
+void FLuaRefTracker::OnUnref(const int Ref)
+{
+	// refs created before Start() are unknown
+	Refs.Remove(Ref);
+}
+
+int32 FLuaRefTracker::InternSite(FLuaRefSite&& Site)
+{
+	if (const int32* SiteId = SiteIds.Find(Site))
+	{
+		return *SiteId;
+	}
+
+	const int32 SiteId = Sites.Num();
+	SiteIds.Add(Site, SiteId);
+	Sites.Add(MoveTemp(Site));
+	return SiteId;
+}
+
+FLuaRefSnapshot FLuaRefTracker::GetLiveSnapshot() const
+{
+	FLuaRefSnapshot Snapshot;
+	Snapshot.Time = FPlatformTime::Seconds();
+	Snapshot.Refs.Reserve(Refs.Num());
+	for (const TPair<int, FRefRecord>& Pair : Refs)
+	{
+		Snapshot.Refs.Add(Pair.Value.Serial, Pair.Value.SiteId);
+	}
+	return Snapshot;
+}
+
+int32 FLuaRefTracker::TakeSnapshot()
+{
+	return Snapshots.Add(GetLiveSnapshot());
+}
+
+void FLuaRefTracker::LogSite(FOutputDevice& Ar, const int32 SiteId) const
+{
+	const FLuaRefSite& Site = Sites[SiteId];
+	if (!Site.Lua.IsEmpty())
+	{
+		Ar.Logf(TEXT("    Lua: %s"), *Site.Lua);
+	}
+	if (!Site.Blueprint.IsEmpty())
+	{
+		Ar.Logf(TEXT("    Blueprint: %s"), *Site.Blueprint);
+	}
+	for (int32 Index = 0; Index < Site.BackTrace.Num(); Index++)
+	{
+		ANSICHAR Buffer[1024];
+		Buffer[0] = 0;
+		FPlatformStackWalk::ProgramCounterToHumanReadableString(Index, Site.BackTrace[Index], Buffer, sizeof(Buffer));
+		Ar.Logf(TEXT("    %s"), ANSI_TO_TCHAR(Buffer));
+	}
+}
+
+void FLuaRefTracker::Dump(FOutputDevice& Ar, const int32 NumSites) const
+{
+	struct FSiteRefs
+	{
+		int32 SiteId;
+		int32 NumRefs;
+		double OldestTime;
+		int32 NumRefsByType[LuaRefTrackerNumTypes];
+	};
+
+	TMap<int32, FSiteRefs> SitesRefs;
+	for (const TPair<int, FRefRecord>& Pair : Refs)
+	{
+		FSiteRefs* SiteRefs = SitesRefs.Find(Pair.Value.SiteId);
+		if (!SiteRefs)
+		{
+			SiteRefs = &SitesRefs.Add(Pair.Value.SiteId);
+			FMemory::Memzero(*SiteRefs);
+			SiteRefs->SiteId = Pair.Value.SiteId;
+			SiteRefs->OldestTime = Pair.Value.Time;
+		}
+		SiteRefs->NumRefs++;
+		SiteRefs->OldestTime = FMath::Min(SiteRefs->OldestTime, Pair.Value.Time);
+		if (Pair.Value.LuaType >= 0 && Pair.Value.LuaType < LuaRefTrackerNumTypes)
+		{
+			SiteRefs->NumRefsByType[Pair.Value.LuaType]++;
+		}
+	}
+
+	TArray<FSiteRefs> SortedSites;
+	SitesRefs.GenerateValueArray(SortedSites);
+	SortedSites.Sort([](const FSiteRefs& A, const FSiteRefs& B) { return A.NumRefs > B.NumRefs; });
+
+	const double Now = FPlatformTime::Seconds();
+	Ar.Logf(TEXT("%d live references from %d sites"), Refs.Num(), SortedSites.Num());
+	for (int32 Index = 0; Index < FMath::Min(NumSites, SortedSites.Num()); Index++)
+	{
+		const FSiteRefs& SiteRefs = SortedSites[Index];
+		FString Types;
+		for (int32 LuaType = 0; LuaType < LuaRefTrackerNumTypes; LuaType++)
+		{
+			if (SiteRefs.NumRefsByType[LuaType] > 0)
+			{
+				Types += FString::Printf(TEXT(" %s=%d"), LuaRefTrackerTypeNames[LuaType], SiteRefs.NumRefsByType[LuaType]);
+			}
+		}
+		Ar.Logf(TEXT("#%d: %d references (oldest %.1fs ago)%s"), Index, SiteRefs.NumRefs, Now - SiteRefs.OldestTime, *Types);
+		LogSite(Ar, SiteRefs.SiteId);
+	}
+}
+
+void FLuaRefTracker::Diff(FOutputDevice& Ar, const int32 SnapshotA, const int32 SnapshotB, const int32 NumSites) const
+{
+	if (!Snapshots.IsValidIndex(SnapshotA) || (SnapshotB != INDEX_NONE && !Snapshots.IsValidIndex(SnapshotB)))
+	{
+		Ar.Logf(TEXT("invalid snapshot (%d snapshots available)"), Snapshots.Num());
+		return;
+	}
+
+	const FLuaRefSnapshot& A = Snapshots[SnapshotA];
+	const FLuaRefSnapshot LiveSnapshot = SnapshotB == INDEX_NONE ? GetLiveSnapshot() : FLuaRefSnapshot();
+	const FLuaRefSnapshot& B = SnapshotB == INDEX_NONE ? LiveSnapshot : Snapshots[SnapshotB];
+
+	// site id -> (created, released)
+	TMap<int32, TPair<int32, int32>> Changes;
+	for (const TPair<uint64, int32>& Pair : B.Refs)
+	{
+		if (!A.Refs.Contains(Pair.Key))
+		{
+			Changes.FindOrAdd(Pair.Value).Key++;
+		}
+	}
+	for (const TPair<uint64, int32>& Pair : A.Refs)
+	{
+		if (!B.Refs.Contains(Pair.Key))
+		{
+			Changes.FindOrAdd(Pair.Value).Value++;
+		}
+	}
+
+	TArray<TPair<int32, TPair<int32, int32>>> SortedChanges;
+	for (const TPair<int32, TPair<int32, int32>>& Pair : Changes)
+	{
+		SortedChanges.Add(TPair<int32, TPair<int32, int32>>(Pair.Key, Pair.Value));
+	}
+	// the sites growing more first
+	SortedChanges.Sort([](const TPair<int32, TPair<int32, int32>>& X, const TPair<int32, TPair<int32, int32>>& Y)
+		{
+			return X.Value.Key - X.Value.Value > Y.Value.Key - Y.Value.Value;
+		});
+
+	Ar.Logf(TEXT("%d -> %d live references in %.1fs"), A.Refs.Num(), B.Refs.Num(), B.Time - A.Time);
+	for (int32 Index = 0; Index < FMath::Min(NumSites, SortedChanges.Num()); Index++)
+	{
+		const TPair<int32, int32>& Change = SortedChanges[Index].Value;
+		Ar.Logf(TEXT("#%d: %+d references (%d created, %d released)"), Index, Change.Key - Change.Value, Change.Key, Change.Value);
+		LogSite(Ar, SortedChanges[Index].Key);
+	}
+}
@@ -7,12 +7,17 @@
 #include "LuaUserDataObject.h"
 #include "LuaMachine.h"
 #include "LuaBlueprintPackage.h"
+#include "LuaByteCodeCompiler.h"
+#include "LuaBinarySerializer.h"
+#include "LuaMachineStats.h"
+#include "Async/Async.h"
 #if ENGINE_MAJOR_VERSION >= 5 && ENGINE_MINOR_VERSION > 0
 #include "AssetRegistry/AssetRegistryModule.h"
 #else
 #include "AssetRegistryModule.h"
 #endif
 #include "GameFramework/Actor.h"
+#include "Engine/World.h"
 #include "Runtime/Core/Public/Misc/FileHelper.h"
 #include "Runtime/Core/Public/Misc/Paths.h"
 #include "Runtime/Core/Public/Serialization/BufferArchive.h"
@@ -36,27 +41,35 @@ ULuaState::ULuaState()
 	bEnableReturnHook = false;
 	bEnableCountHook = false;
 	bRawLuaFunctionCall = false;
+	bPreferByteCodeManifest = true;
+	bHotReloadModules = true;
+	bEnableCoroutineScheduler = false;
+	CoroutineSchedulerBudget = 2;
+	CoroutineSchedulerWorldTime = -1;
+	LuaThreadPoolSize = 64;
+	bEnableGCStepping = false;
+	bGenerationalGC = false;
+	bAllowLuaJITFFI = false;
+	GCStepBudget = 1;
+	GCStepSize = 16;
+	CommandQueueBudget = 2;
+	CommandQueue = MakeShared<FLuaCommandQueue, ESPMode::ThreadSafe>();
+	bEnableExecutionBudget = false;
+	bTraceLuaFunctions = false;
+	bEnableFunctionStats = false;
+	HookCountInterval = 0;
+	ExecutionBudgetDepth = 0;
+	ExecutionBudgetThread = nullptr;
+	ExecutionBudgetDeadline = 0;
+	ExecutionBudgetInstructions = 0;
+	NumLuaValueRefs = 0;
 
 	FCoreUObjectDelegates::GetPostGarbageCollect().AddUObject(this, &ULuaState::GCLuaDelegatesCheck);
 }
 
-ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
+void ULuaState::LoadLuaLibs(lua_State* L, const bool bOpenLibs, const FLuaLibsLoader& LibsLoader, const bool bAllowFFI)
 {
-	CurrentWorld = InWorld;
-
-	if (L != nullptr)
-	{
-		return this;
-	}
-
-	if (bDisabled)
-	{
-		return nullptr;
-	}
-
-	L = luaL_newstate();
-
-	if (bLuaOpenLibs)
+	if (bOpenLibs)
 	{
 		luaL_openlibs(L);
 	}
@@ -65,63 +78,127 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 	luaL_requiref(L, "package", luaopen_package, 1);
 	lua_pop(L, 1);
 
-	if (!bLuaOpenLibs)
+	if (!bOpenLibs)
 	{
-		if (LuaLibsLoader.bLoadBase)
+		if (LibsLoader.bLoadBase)
 		{
 			luaL_requiref(L, "_G", luaopen_base, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadCoroutine)
+		if (LibsLoader.bLoadCoroutine)
 		{
 			luaL_requiref(L, "coroutine", luaopen_coroutine, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadTable)
+		if (LibsLoader.bLoadTable)
 		{
 			luaL_requiref(L, "table", luaopen_table, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadIO)
+		if (LibsLoader.bLoadIO)
 		{
 			luaL_requiref(L, "io", luaopen_io, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadOS)
+		if (LibsLoader.bLoadOS)
 		{
 			luaL_requiref(L, "os", luaopen_os, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadString)
+		if (LibsLoader.bLoadString)
 		{
 			luaL_requiref(L, "string", luaopen_string, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadMath)
+		if (LibsLoader.bLoadMath)
 		{
 			luaL_requiref(L, "math", luaopen_math, 1);
 			lua_pop(L, 1);
 		}
 
-		if (LuaLibsLoader.bLoadUTF8)
+#if !LUAMACHINE_LUAJIT
+		if (LibsLoader.bLoadUTF8)
 		{
 			luaL_requiref(L, "utf8", luaopen_utf8, 1);
 			lua_pop(L, 1);
 		}
+#endif
 
-		if (LuaLibsLoader.bLoadDebug)
+		if (LibsLoader.bLoadDebug)
 		{
 			luaL_requiref(L, "debug", luaopen_debug, 1);
 			lua_pop(L, 1);
 		}
 	}
 
+#if LUAMACHINE_LUAJIT
+	// the ffi module gives unrestricted access to the process memory
+	if (!bAllowFFI)
+	{
+		lua_getfield(L, LUA_REGISTRYINDEX, "_PRELOAD");
+		if (lua_istable(L, -1))
+		{
+			lua_pushnil(L);
+			lua_setfield(L, -2, "ffi");
+		}
+		lua_pop(L, 1);
+		lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+		lua_pushnil(L);
+		lua_setfield(L, -2, "ffi");
+		lua_pop(L, 1);
+		lua_pushnil(L);
+		lua_setglobal(L, "ffi");
+	}
+#endif
+}
+
+ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
+{
+	CurrentWorld = InWorld;
+
+	if (L != nullptr)
+	{
+		return this;
+	}
+
+	if (bDisabled)
+	{
+		return nullptr;
+	}
+
+	StartupStats = FLuaStartupStats();
+	double StartupPhaseTime = FPlatformTime::Seconds();
+	int64 StartupPhaseBytes = 0;
+	int64 StartupPhaseAllocations = AllocatorStats.TotalAllocations;
+	auto EndStartupPhase = [this, &StartupPhaseTime, &StartupPhaseBytes, &StartupPhaseAllocations](const TCHAR* PhaseName)
+	{
+		const double Now = FPlatformTime::Seconds();
+		const int64 Bytes = (int64)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+		StartupStats.AddPhase(PhaseName, (Now - StartupPhaseTime) * 1000, Bytes - StartupPhaseBytes, AllocatorStats.TotalAllocations - StartupPhaseAllocations);
+		StartupPhaseBytes = Bytes;
+		StartupPhaseAllocations = AllocatorStats.TotalAllocations;
+		// do not account the phase bookkeeping
+		StartupPhaseTime = FPlatformTime::Seconds();
+	};
+
+	L = FLuaAllocator::NewState(&AllocatorStats);
+
+#if LUAMACHINE_LUA54
+	if (bGenerationalGC)
+	{
+		lua_gc(L, LUA_GCGEN, 0, 0);
+	}
+#endif
+
+	LoadLuaLibs(L, bLuaOpenLibs, LuaLibsLoader, bAllowLuaJITFFI);
+	EndStartupPhase(TEXT("OpenLibs"));
+
 	ULuaState** LuaExtraSpacePtr = (ULuaState**)lua_getextraspace(L);
 	*LuaExtraSpacePtr = this;
 	// get the global table
@@ -130,6 +207,20 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 	PushCFunction(ULuaState::TableFunction_print);
 	SetField(-2, "print");
 
+	if (bEnableCoroutineScheduler)
+	{
+		FLuaCoroutineScheduler::RegisterLuaFunctions(L);
+	}
+
+	// coroutine.acquire() and coroutine.release()
+	LuaThreadPool.SetMaxSize(LuaThreadPoolSize);
+	GetField(-1, "coroutine");
+	if (lua_istable(L, -1))
+	{
+		FLuaThreadPool::RegisterLuaFunctions(L);
+	}
+	Pop();
+
 	GetField(-1, "package");
 	if (!OverridePackagePath.IsEmpty())
 	{
@@ -190,20 +281,21 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 	Pop(1);
 
 	// manage searchers
-	GetField(-1, "searchers");
+	GetField(-1, LUACOMPAT_SEARCHERS);
 	PushCFunction(ULuaState::TableFunction_package_loader);
 	constexpr int PackageLoadersFirstAvailableIndex = 5;
 	lua_seti(L, -2, PackageLoadersFirstAvailableIndex);
 
 	// pop package.searchers (and package)
 	Pop(2);
-
+	EndStartupPhase(TEXT("PackagePaths"));
 
 	for (TPair<FString, FLuaValue>& Pair : Table)
 	{
 		FromLuaValue(Pair.Value, this, L);
 		SetField(-2, TCHAR_TO_ANSI(*Pair.Key));
 	}
+	EndStartupPhase(TEXT("Table"));
 
 	for (TPair<FString, TSubclassOf<ULuaBlueprintPackage>>& Pair : LuaBlueprintPackagesTable)
 	{
@@ -234,34 +326,15 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 
 	// pop global table
 	Pop();
+	EndStartupPhase(TEXT("BlueprintPackages"));
 
 	// This allows subclasses to do any last minute initialization on lua state before
 	// we load code
 	ReceiveLuaStatePreInitialized();
 
-	int DebugMask = 0;
 	// install hooks
-	if (bEnableLineHook)
-	{
-		DebugMask |= LUA_MASKLINE;
-	}
-	if (bEnableCallHook)
-	{
-		DebugMask |= LUA_MASKCALL;
-	}
-	if (bEnableReturnHook)
-	{
-		DebugMask |= LUA_MASKRET;
-	}
-	if (bEnableCountHook)
-	{
-		DebugMask |= LUA_MASKCOUNT;
-	}
-
-	if (DebugMask != 0)
-	{
-		lua_sethook(L, Debug_Hook, DebugMask, HookInstructionCount);
-	}
+	UpdateHookMask();
+	EndStartupPhase(TEXT("PreInitialized"));
 
 	if (LuaCodeAsset)
 	{
@@ -274,6 +347,7 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 			return nullptr;
 		}
 	}
+	EndStartupPhase(TEXT("LuaCodeAsset"));
 
 	if (!LuaFilename.IsEmpty())
 	{
@@ -286,6 +360,7 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 			return nullptr;
 		}
 	}
+	EndStartupPhase(TEXT("LuaFilename"));
 
 	if (UserDataMetaTableFromCodeAsset)
 	{
@@ -300,9 +375,26 @@ ULuaState* ULuaState::GetLuaState(UWorld* InWorld)
 		UserDataMetaTable = ToLuaValue(-1);
 		Pop();
 	}
+	EndStartupPhase(TEXT("UserDataMetaTable"));
 
 	LuaStateInit();
 	ReceiveLuaStateInitialized();
+	EndStartupPhase(TEXT("LuaStateInit"));
+
+	if (StartupLogThreshold >= 0 && StartupStats.Time > StartupLogThreshold)
+	{
+		UE_LOG(LogLuaMachine, Warning, TEXT("%s startup took %.2f ms (%lld KB): %s"), *GetName(), StartupStats.Time, StartupStats.Bytes / 1024, *StartupStats.ToString());
+	}
+	if (!(GetFlags() & RF_ClassDefaultObject))
+	{
+		FLuaMachineModule::Get().AddStartupStats(this, StartupStats);
+	}
+
+	// the initialization scripts are run with the automatic collector (that is kept in commandlets, as they do not tick the LuaStates)
+	if (bEnableGCStepping && !IsRunningCommandlet())
+	{
+		GCStartStepping();
+	}
 
 #if WITH_EDITOR
 	if (!(GetFlags() & RF_ClassDefaultObject))
@@ -564,6 +656,8 @@ FLuaValue ULuaState::TableFromMap(TMap<FString, FLuaValue> Map)
 
 bool ULuaState::ValueFromJson(const FString& Json, FLuaValue& LuaValue)
 {
+	SCOPE_CYCLE_COUNTER(STAT_LuaJsonConversion);
+
 	// default to nil
 	LuaValue = FLuaValue();
 
@@ -656,65 +750,839 @@ FLuaValue ULuaState::RunNonContentFile(const FString& Filename, const bool bIgno
 	return ReturnValue;
 }
 
-FLuaValue ULuaState::RunCodeAsset(ULuaCode* CodeAsset)
+FLuaValue ULuaState::RunCodeAsset(ULuaCode* CodeAsset)
+{
+	FLuaValue ReturnValue;
+
+	if (!CodeAsset)
+		return ReturnValue;
+
+	if (!this->_RunCodeAsset(CodeAsset, 1))
+	{
+		if (this->bLogError)
+			this->LogError(this->LastError);
+		this->ReceiveLuaError(this->LastError);
+	}
+	else {
+		ReturnValue = this->ToLuaValue(-1);
+	}
+	this->Pop();
+	return ReturnValue;
+}
+
+void ULuaState::RunFileAsync(const FString& Filename, const bool bIgnoreNonExistent, FLuaRunAsyncCompletion Completion)
+{
+	_RunFileAsync(Filename, bIgnoreNonExistent, false, MoveTemp(Completion));
+}
+
+void ULuaState::RunNonContentFileAsync(const FString& Filename, const bool bIgnoreNonExistent, FLuaRunAsyncCompletion Completion)
+{
+	_RunFileAsync(Filename, bIgnoreNonExistent, true, MoveTemp(Completion));
+}
+
+void ULuaState::RunCodeAssetAsync(ULuaCode* CodeAsset, FLuaRunAsyncCompletion Completion)
+{
+	if (!CodeAsset)
+	{
+		if (Completion)
+		{
+			Completion(false, FLuaValue());
+		}
+		return;
+	}
+
+	const FString CodePath = CodeAsset->GetPathName();
+	if (CodeAsset->bCooked && CodeAsset->bCookAsBytecode)
+	{
+		TArray<uint8> ByteCode = CodeAsset->ByteCode;
+#if PLATFORM_ANDROID && !LUAMACHINE_LUA54
+		// fix size_t of the bytecode (the 5.4 header does not store it)
+		if (ByteCode.Num() >= 14)
+			ByteCode[13] = sizeof(size_t);
+#endif
+		_RunLoadedChunkAsync([CodePath, ByteCode = MoveTemp(ByteCode)]() mutable
+			{
+				FLuaLoadedChunk Chunk;
+				Chunk.CodePath = CodePath;
+				Chunk.ByteCode = MoveTemp(ByteCode);
+				return Chunk;
+			}, false, MoveTemp(Completion));
+		return;
+	}
+
+	// the FText cannot be accessed from other threads
+	FTCHARToUTF8 UTF8Code(*CodeAsset->Code.ToString());
+	TArray<uint8> Code;
+	Code.Append(reinterpret_cast<const uint8*>(UTF8Code.Get()), UTF8Code.Length());
+
+	_RunLoadedChunkAsync([CodePath, Code = MoveTemp(Code)]()
+		{
+			FLuaLoadedChunk Chunk;
+			Chunk.CodePath = CodePath;
+			if (!FLuaByteCodeCompiler::GetThreadCompiler().Compile(Code.GetData(), Code.Num(), CodePath, Chunk.ByteCode, Chunk.Error, false))
+			{
+				Chunk.Error = FString::Printf(TEXT("Lua loading error: %s"), *Chunk.Error);
+			}
+			return Chunk;
+		}, false, MoveTemp(Completion));
+}
+
+void ULuaState::_RunFileAsync(const FString& Filename, const bool bIgnoreNonExistent, const bool bNonContentDirectory, FLuaRunAsyncCompletion Completion)
+{
+	const FString AbsoluteFilename = bNonContentDirectory ? Filename : FPaths::Combine(FPaths::ProjectContentDir(), Filename);
+
+	TSharedPtr<const FLuaByteCodeManifest, ESPMode::ThreadSafe> ByteCodeManifest;
+	if (!bNonContentDirectory && bPreferByteCodeManifest && !FLuaMachineModule::Get().GetCoverage().IsActive())
+	{
+		ByteCodeManifest = FLuaMachineModule::Get().GetSharedByteCodeManifest();
+	}
+
+	_RunLoadedChunkAsync([Filename, AbsoluteFilename, ByteCodeManifest]()
+		{
+			FLuaLoadedChunk Chunk;
+			Chunk.CodePath = AbsoluteFilename;
+
+			// precompiled scripts (generated by the LuaCompile commandlet) have precedence (the source file may not be shipped at all)
+			if (ByteCodeManifest.IsValid() && ByteCodeManifest->LoadByteCode(Filename, Chunk.ByteCode))
+			{
+#if PLATFORM_ANDROID && !LUAMACHINE_LUA54
+				// fix size_t of the bytecode (the 5.4 header does not store it)
+				if (Chunk.ByteCode.Num() >= 14)
+					Chunk.ByteCode[13] = sizeof(size_t);
+#endif
+				return Chunk;
+			}
+
+			if (!FPaths::FileExists(AbsoluteFilename))
+			{
+				Chunk.bFound = false;
+				Chunk.Error = FString::Printf(TEXT("Unable to open file %s"), *Filename);
+				return Chunk;
+			}
+
+			TArray<uint8> Code;
+			if (!FFileHelper::LoadFileToArray(Code, *AbsoluteFilename))
+			{
+				Chunk.Error = FString::Printf(TEXT("Unable to open file %s"), *Filename);
+				return Chunk;
+			}
+
+			// already compiled (the signature of both Lua and LuaJIT bytecode starts with ESC)
+			if (Code.Num() > 0 && Code[0] == 0x1b)
+			{
+				Chunk.ByteCode = MoveTemp(Code);
+				return Chunk;
+			}
+
+			// keep the debug info, so errors have the same line numbers of RunFile()
+			if (!FLuaByteCodeCompiler::GetThreadCompiler().Compile(Code.GetData(), Code.Num(), AbsoluteFilename, Chunk.ByteCode, Chunk.Error, false))
+			{
+				Chunk.Error = FString::Printf(TEXT("Lua loading error: %s"), *Chunk.Error);
+			}
+			return Chunk;
+		}, bIgnoreNonExistent, MoveTemp(Completion));
+}
+
+void ULuaState::_RunLoadedChunkAsync(TFunction<FLuaLoadedChunk()> LoadChunk, const bool bIgnoreNonExistent, FLuaRunAsyncCompletion Completion)
+{
+	TWeakObjectPtr<ULuaState> WeakLuaState(this);
+	// file reads could block, so use the thread pool instead of the task graph
+	Async(EAsyncExecution::ThreadPool, MoveTemp(LoadChunk)).Next([WeakLuaState, bIgnoreNonExistent, Completion](FLuaLoadedChunk Chunk)
+		{
+			AsyncTask(ENamedThreads::GameThread, [WeakLuaState, bIgnoreNonExistent, Completion, Chunk = MoveTemp(Chunk)]()
+				{
+					ULuaState* LuaState = WeakLuaState.Get();
+					// the LuaState could have been destroyed while loading
+					if (!LuaState || !LuaState->GetInternalLuaState())
+					{
+						return;
+					}
+					LuaState->RunLoadedChunk(Chunk, bIgnoreNonExistent, Completion);
+				});
+		});
+}
+
+void ULuaState::RunLoadedChunk(const FLuaLoadedChunk& Chunk, const bool bIgnoreNonExistent, const FLuaRunAsyncCompletion& Completion)
+{
+	FLuaValue ReturnValue;
+	bool bSuccess = false;
+
+	if (!Chunk.bFound && bIgnoreNonExistent)
+	{
+		bSuccess = true;
+	}
+	else if (!Chunk.Error.IsEmpty())
+	{
+		LastError = Chunk.Error;
+	}
+	else
+	{
+		// loading the bytecode is just a copy of the prototypes, the parsing has already been done
+		bSuccess = RunCode(Chunk.ByteCode, Chunk.CodePath, 1);
+		if (bSuccess)
+		{
+			ReturnValue = ToLuaValue(-1);
+		}
+		Pop();
+	}
+
+	if (!bSuccess)
+	{
+		if (bLogError)
+			LogError(LastError);
+		ReceiveLuaError(LastError);
+	}
+
+	if (Completion)
+	{
+		Completion(bSuccess, ReturnValue);
+	}
+}
+
+FLuaValue ULuaState::RunByteCode(const TArray<uint8>& ByteCode, const FString& CodePath)
+{
+	FLuaValue ReturnValue;
+
+	if (!this->RunCode(ByteCode, CodePath, 1))
+	{
+		if (this->bLogError)
+			this->LogError(this->LastError);
+		this->ReceiveLuaError(this->LastError);
+	}
+	else
+	{
+		ReturnValue = this->ToLuaValue(-1);
+	}
+	this->Pop();
+	return ReturnValue;
+}
+
+FLuaValue ULuaState::RunString(const FString& CodeString, FString CodePath)
+{
+	FLuaValue ReturnValue;
+	if (CodePath.IsEmpty())
+	{
+		CodePath = CodeString;
+	}
+
+	if (!RunCode(CodeString, CodePath, 1))
+	{
+		if (bLogError)
+			LogError(LastError);
+		ReceiveLuaError(LastError);
+	}
+	else
+	{
+		ReturnValue = ToLuaValue(-1);
+	}
+
+	Pop();
+	return ReturnValue;
+}
+
+static void LuaHotReload_JoinUpValues(lua_State* L, const int NewFunction, const int OldFunction, const int Visited, const int Functions)
+{
+	if (lua_iscfunction(L, NewFunction) || lua_iscfunction(L, OldFunction))
+	{
+		return;
+	}
+
+	// recursive local functions reference themselves
+	lua_pushvalue(L, NewFunction);
+	lua_rawget(L, Visited);
+	if (!lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+		return;
+	}
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, NewFunction);
+	lua_pushvalue(L, OldFunction);
+	lua_rawset(L, Visited);
+
+	luaL_checkstack(L, 8, "too many nested functions while hot reloading");
+
+	for (int NewUpValue = 1; ; NewUpValue++)
+	{
+		const char* NewName = lua_getupvalue(L, NewFunction, NewUpValue);
+		if (!NewName)
+		{
+			break;
+		}
+		const int NewValue = lua_gettop(L);
+
+		// stripped chunks have no upvalue names
+		if (NewName[0] == 0 || NewName[0] == '(')
+		{
+			lua_pop(L, 1);
+			continue;
+		}
+
+		for (int OldUpValue = 1; ; OldUpValue++)
+		{
+			const char* OldName = lua_getupvalue(L, OldFunction, OldUpValue);
+			if (!OldName)
+			{
+				break;
+			}
+			const int OldValue = lua_gettop(L);
+
+			if (!FCStringAnsi::Strcmp(NewName, OldName))
+			{
+				if (lua_type(L, NewValue) == LUA_TFUNCTION || lua_type(L, OldValue) == LUA_TFUNCTION)
+				{
+					// local functions keep the new code, only their data upvalues are joined
+					if (lua_type(L, NewValue) == LUA_TFUNCTION && lua_type(L, OldValue) == LUA_TFUNCTION)
+					{
+						LuaHotReload_JoinUpValues(L, NewValue, OldValue, Visited, Functions);
+						lua_pushvalue(L, NewValue);
+						lua_rawseti(L, Functions, (lua_Integer)lua_rawlen(L, Functions) + 1);
+					}
+				}
+				else
+				{
+					// the new closure will share the live value of the old one
+					lua_upvaluejoin(L, NewFunction, NewUpValue, OldFunction, OldUpValue);
+				}
+				lua_pop(L, 1);
+				break;
+			}
+			lua_pop(L, 1);
+		}
+
+		lua_pop(L, 1);
+	}
+}
+
+static void LuaHotReload_MergeTable(lua_State* L, const int OldTable, const int NewTable, const int Visited, const int Functions)
+{
+	lua_pushvalue(L, NewTable);
+	lua_rawget(L, Visited);
+	if (!lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+		return;
+	}
+	lua_pop(L, 1);
+
+	// map the new table to the old one (used for fixing upvalues later)
+	lua_pushvalue(L, NewTable);
+	lua_pushvalue(L, OldTable);
+	lua_rawset(L, Visited);
+
+	luaL_checkstack(L, 8, "too many nested tables while hot reloading");
+
+	lua_pushnil(L);
+	while (lua_next(L, NewTable))
+	{
+		const int NewValue = lua_gettop(L);
+		lua_pushvalue(L, NewValue - 1);
+		lua_rawget(L, OldTable);
+		const int OldValue = lua_gettop(L);
+
+		const int NewType = lua_type(L, NewValue);
+		const int OldType = lua_type(L, OldValue);
+
+		if (NewType == LUA_TFUNCTION)
+		{
+			if (OldType == LUA_TFUNCTION)
+			{
+				LuaHotReload_JoinUpValues(L, NewValue, OldValue, Visited, Functions);
+			}
+			lua_pushvalue(L, NewValue);
+			lua_rawseti(L, Functions, (lua_Integer)lua_rawlen(L, Functions) + 1);
+
+			lua_pushvalue(L, NewValue - 1);
+			lua_pushvalue(L, NewValue);
+			lua_rawset(L, OldTable);
+		}
+		else if (NewType == LUA_TTABLE && OldType == LUA_TTABLE)
+		{
+			if (!lua_rawequal(L, NewValue, OldValue))
+			{
+				LuaHotReload_MergeTable(L, OldValue, NewValue, Visited, Functions);
+			}
+		}
+		else if (OldType == LUA_TNIL)
+		{
+			lua_pushvalue(L, NewValue - 1);
+			lua_pushvalue(L, NewValue);
+			lua_rawset(L, OldTable);
+		}
+		// any other value is runtime data, keep it
+
+		lua_pop(L, 2);
+	}
+
+	if (lua_getmetatable(L, NewTable))
+	{
+		if (lua_getmetatable(L, OldTable))
+		{
+			const int OldMetaTable = lua_gettop(L);
+			if (!lua_rawequal(L, OldMetaTable - 1, OldMetaTable))
+			{
+				LuaHotReload_MergeTable(L, OldMetaTable, OldMetaTable - 1, Visited, Functions);
+			}
+			lua_pop(L, 2);
+		}
+		else
+		{
+			lua_setmetatable(L, OldTable);
+		}
+	}
+}
+
+static void LuaHotReload_RemapUpValues(lua_State* L, const int Visited, const int Functions)
+{
+	// closures referencing the new (discarded) tables must see the old ones
+	const lua_Integer NumFunctions = (lua_Integer)lua_rawlen(L, Functions);
+	for (lua_Integer FunctionIndex = 1; FunctionIndex <= NumFunctions; FunctionIndex++)
+	{
+		lua_rawgeti(L, Functions, FunctionIndex);
+		const int Function = lua_gettop(L);
+		for (int UpValue = 1; lua_getupvalue(L, Function, UpValue); UpValue++)
+		{
+			if (lua_istable(L, -1))
+			{
+				lua_rawget(L, Visited);
+			}
+			if (lua_type(L, -1) == LUA_TTABLE)
+			{
+				lua_setupvalue(L, Function, UpValue);
+			}
+			else
+			{
+				lua_pop(L, 1);
+			}
+		}
+		lua_pop(L, 1);
+	}
+}
+
+/* protected merge of the new module (2) into the old one (1), stack exhaustion and memory errors fail the reload instead of panicking */
+static int LuaHotReload_Merge(lua_State* L)
+{
+	lua_newtable(L);
+	const int Visited = 3;
+	lua_newtable(L);
+	const int Functions = 4;
+
+	if (lua_istable(L, 1))
+	{
+		LuaHotReload_MergeTable(L, 1, 2, Visited, Functions);
+	}
+	else
+	{
+		LuaHotReload_JoinUpValues(L, 2, 1, Visited, Functions);
+	}
+	LuaHotReload_RemapUpValues(L, Visited, Functions);
+	return 0;
+}
+
+static FString LuaHotReload_NormalizeSource(const FString& Source)
+{
+	if (FPackageName::IsValidObjectPath(Source))
+	{
+		return Source;
+	}
+
+	FString NormalizedFilename = Source;
+	FPaths::NormalizeFilename(NormalizedFilename);
+	FPaths::RemoveDuplicateSlashes(NormalizedFilename);
+	FPaths::CollapseRelativeDirectories(NormalizedFilename);
+	return NormalizedFilename;
+}
+
+bool ULuaState::HotReloadModule(const FString& ModuleName)
+{
+	const FString* Source = LoadedModules.Find(ModuleName);
+	if (!Source)
+	{
+		LastError = FString::Printf(TEXT("Lua module %s has not been loaded with require()"), *ModuleName);
+		if (bLogError)
+			LogError(LastError);
+		return false;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	const int Top = lua_gettop(L);
+
+	bool bSuccess = false;
+	if (FPackageName::IsValidObjectPath(*Source))
+	{
+		ULuaCode* LuaCode = LoadObject<ULuaCode>(nullptr, **Source);
+		if (LuaCode)
+		{
+			bSuccess = _RunCodeAsset(LuaCode, 1);
+		}
+		else
+		{
+			LastError = FString::Printf(TEXT("Unable to load LuaCode asset %s"), **Source);
+		}
+	}
+	else
+	{
+		bSuccess = _RunFile(*Source, false, 1);
+	}
+
+	if (!bSuccess)
+	{
+		if (bLogError)
+			LogError(LastError);
+		ReceiveLuaError(LastError);
+		lua_settop(L, Top);
+		return false;
+	}
+
+	const int NewModule = Top + 1;
+	lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	const int LoadedTable = Top + 2;
+	lua_getfield(L, LoadedTable, TCHAR_TO_UTF8(*ModuleName));
+	const int OldModule = Top + 3;
+
+	const bool bMergeTables = lua_istable(L, OldModule) && lua_istable(L, NewModule) && !lua_rawequal(L, OldModule, NewModule);
+	const bool bJoinFunctions = lua_isfunction(L, OldModule) && lua_isfunction(L, NewModule);
+	if (bMergeTables || bJoinFunctions)
+	{
+		lua_pushcfunction(L, LuaHotReload_Merge);
+		lua_pushvalue(L, OldModule);
+		lua_pushvalue(L, NewModule);
+		if (lua_pcall(L, 2, 0, 0))
+		{
+			LastError = FString::Printf(TEXT("Unable to hot reload Lua module %s: %s"), *ModuleName, UTF8_TO_TCHAR(lua_tostring(L, -1)));
+			if (bLogError)
+				LogError(LastError);
+			ReceiveLuaError(LastError);
+			lua_settop(L, Top);
+			return false;
+		}
+	}
+
+	// a nil return means the module only changed globals, running it again is enough
+	if (!(lua_istable(L, OldModule) && lua_istable(L, NewModule)) && !lua_isnil(L, NewModule))
+	{
+		lua_pushvalue(L, NewModule);
+		lua_setfield(L, LoadedTable, TCHAR_TO_UTF8(*ModuleName));
+	}
+
+	lua_settop(L, Top);
+
+	UE_LOG(LogLuaMachine, Log, TEXT("Hot reloaded Lua module %s (%s) in %.3f ms"), *ModuleName, **Source, (FPlatformTime::Seconds() - StartTime) * 1000);
+	return true;
+}
+
+int32 ULuaState::HotReloadFile(const FString& Filename)
+{
+	const FString NormalizedFilename = LuaHotReload_NormalizeSource(Filename);
+
+	TArray<FString> ModuleNames;
+	for (const TPair<FString, FString>& Pair : LoadedModules)
+	{
+		if (Pair.Value == NormalizedFilename)
+		{
+			ModuleNames.Add(Pair.Key);
+		}
+	}
+
+	int32 Reloaded = 0;
+	for (const FString& ModuleName : ModuleNames)
+	{
+		if (HotReloadModule(ModuleName))
+		{
+			Reloaded++;
+		}
+	}
+	return Reloaded;
+}
+
+int32 ULuaState::HotReloadCodeAsset(ULuaCode* CodeAsset)
+{
+	if (!CodeAsset)
+	{
+		return 0;
+	}
+
+	const FString CodeAssetPath = CodeAsset->GetPathName();
+
+	TArray<FString> ModuleNames;
+	for (const TPair<FString, FString>& Pair : LoadedModules)
+	{
+		if (Pair.Value == CodeAssetPath)
+		{
+			ModuleNames.Add(Pair.Key);
+		}
+	}
+
+	int32 Reloaded = 0;
+	for (const FString& ModuleName : ModuleNames)
+	{
+		if (HotReloadModule(ModuleName))
+		{
+			Reloaded++;
+		}
+	}
+	return Reloaded;
+}
+
+void ULuaState::TrackLoadedModule(const FString& ModuleName, const FString& Source)
+{
+	LoadedModules.Add(ModuleName, LuaHotReload_NormalizeSource(Source));
+}
+
+FLuaValue ULuaState::SpawnCoroutine(FLuaValue Function, TArray<FLuaValue> Args)
+{
+	FLuaValue ReturnValue;
+	if (!L || Function.Type != ELuaValueType::Function)
+	{
+		return ReturnValue;
+	}
+
+	// nothing would resume it
+	if (!bEnableCoroutineScheduler)
+	{
+		LastError = TEXT("Lua error: SpawnCoroutine() requires bEnableCoroutineScheduler");
+		if (bLogError)
+			LogError(LastError);
+		ReceiveLuaError(LastError);
+		return ReturnValue;
+	}
+
+	FromLuaValue(Function);
+	for (FLuaValue& Arg : Args)
+	{
+		FromLuaValue(Arg);
+	}
+	CoroutineScheduler.Spawn(L, Args.Num());
+	ReturnValue = ToLuaValue(-1);
+	Pop();
+	return ReturnValue;
+}
+
+int32 ULuaState::SignalCoroutineEvent(const FString& EventName, TArray<FLuaValue> Args)
+{
+	if (!L)
+	{
+		return 0;
+	}
+
+	for (FLuaValue& Arg : Args)
+	{
+		FromLuaValue(Arg);
+	}
+	const int32 Woken = CoroutineScheduler.Signal(L, EventName, Args.Num());
+	Pop(Args.Num());
+	return Woken;
+}
+
+bool ULuaState::SerializeLuaValues(const TArray<FLuaValue>& Values, TArray<uint8>& Data, TArray<int64>* Offsets)
+{
+	for (const FLuaValue& Value : Values)
+	{
+		if (Offsets)
+		{
+			Offsets->Add(Data.Num());
+		}
+		FromLuaValue(const_cast<FLuaValue&>(Value));
+		const bool bSuccess = FLuaBinarySerializer::Serialize(L, -1, Data, LastError);
+		Pop();
+		if (!bSuccess)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ULuaState::DeserializeLuaValues(const TArray<uint8>& Data, TArray<FLuaValue>& Values)
+{
+	const int32 NumValues = FLuaBinarySerializer::DeserializeAll(L, Data.GetData(), Data.Num(), LastError);
+	if (NumValues < 0)
+	{
+		return false;
+	}
+
+	for (int32 Index = -NumValues; Index < 0; Index++)
+	{
+		Values.Add(ToLuaValue(Index));
+	}
+	Pop(NumValues);
+	return true;
+}
+
+TFuture<FLuaJobResult> ULuaState::RunJob(const FString& FunctionName, const TArray<FLuaValue>& Args)
+{
+	TArray<uint8> Data;
+	if (!SerializeLuaValues(Args, Data))
+	{
+		TPromise<FLuaJobResult> Promise;
+		FLuaJobResult Result;
+		Result.Error = FString::Printf(TEXT("Lua worker error: invalid arguments for %s: %s"), *FunctionName, *LastError);
+		Promise.SetValue(MoveTemp(Result));
+		return Promise.GetFuture();
+	}
+	return FLuaMachineModule::Get().GetJobSystem().Submit(GetClass(), FunctionName, MoveTemp(Data));
+}
+
+void ULuaState::RunJobAsync(const FString& FunctionName, const TArray<FLuaValue>& Args, FLuaJobCompleted Completed)
+{
+	CompleteJobOnGameThread(RunJob(FunctionName, Args), Completed);
+}
+
+TFuture<FLuaJobResult> ULuaState::ParallelFor(const FString& FunctionName, const TArray<FLuaValue>& Inputs, const int32 ChunkSize)
+{
+	TArray<uint8> Data;
+	TArray<int64> Offsets;
+	if (!SerializeLuaValues(Inputs, Data, &Offsets))
+	{
+		TPromise<FLuaJobResult> Promise;
+		FLuaJobResult Result;
+		Result.Error = FString::Printf(TEXT("Lua worker error: invalid inputs for %s: %s"), *FunctionName, *LastError);
+		Promise.SetValue(MoveTemp(Result));
+		return Promise.GetFuture();
+	}
+	return FLuaMachineModule::Get().GetJobSystem().ParallelFor(GetClass(), FunctionName, MoveTemp(Data), MoveTemp(Offsets), ChunkSize);
+}
+
+void ULuaState::ParallelForAsync(const FString& FunctionName, const TArray<FLuaValue>& Inputs, const int32 ChunkSize, FLuaJobCompleted Completed)
+{
+	CompleteJobOnGameThread(ParallelFor(FunctionName, Inputs, ChunkSize), Completed);
+}
+
+void ULuaState::CompleteJobOnGameThread(TFuture<FLuaJobResult>&& Future, FLuaJobCompleted Completed)
+{
+	TWeakObjectPtr<ULuaState> WeakLuaState(this);
+	Future.Next([WeakLuaState, Completed](FLuaJobResult Result)
+		{
+			AsyncTask(ENamedThreads::GameThread, [WeakLuaState, Completed, Result = MoveTemp(Result)]()
+				{
+					ULuaState* LuaState = WeakLuaState.Get();
+					// the LuaState could have been destroyed while the job was running
+					if (!LuaState || !LuaState->GetInternalLuaState())
+					{
+						return;
+					}
+
+					TArray<FLuaValue> ReturnValues;
+					FString Error = Result.Error;
+					bool bSuccess = Result.bSuccess;
+					if (bSuccess && !LuaState->DeserializeLuaValues(Result.Results, ReturnValues))
+					{
+						bSuccess = false;
+						Error = LuaState->LastError;
+					}
+
+					if (!bSuccess)
+					{
+						LuaState->LogError(Error);
+					}
+
+					Completed.ExecuteIfBound(ReturnValues, bSuccess, Error);
+				});
+		});
+}
+
+void ULuaState::EnqueueCall(const FString& FunctionName, TArray<uint8> Args, FLuaQueuedCallCompletion Completion)
 {
-	FLuaValue ReturnValue;
+	CommandQueue->Enqueue(FunctionName, MoveTemp(Args), MoveTemp(Completion));
+}
 
-	if (!CodeAsset)
-		return ReturnValue;
+int32 ULuaState::ExecuteQueuedCalls(const double Budget)
+{
+	check(IsInGameThread());
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_CommandQueue);
 
-	if (!this->_RunCodeAsset(CodeAsset, 1))
+	const double StartTime = FPlatformTime::Seconds();
+	// calls enqueued by the executed ones will wait for the next drain
+	const int32 NumQueuedCalls = CommandQueue->GetNumPending();
+	int32 NumCalls = 0;
+	FLuaQueuedCall QueuedCall;
+	while (NumCalls < NumQueuedCalls && CommandQueue->Dequeue(QueuedCall))
 	{
-		if (this->bLogError)
-			this->LogError(this->LastError);
-		this->ReceiveLuaError(this->LastError);
-	}
-	else {
-		ReturnValue = this->ToLuaValue(-1);
+		ExecuteQueuedCall(QueuedCall);
+		NumCalls++;
+		// the remaining calls will be executed in the next frames
+		if (Budget > 0 && FPlatformTime::Seconds() - StartTime >= Budget)
+		{
+			break;
+		}
 	}
-	this->Pop();
-	return ReturnValue;
+	return NumCalls;
 }
 
-FLuaValue ULuaState::RunByteCode(const TArray<uint8>& ByteCode, const FString& CodePath)
+void ULuaState::ExecuteQueuedCall(FLuaQueuedCall& QueuedCall)
 {
-	FLuaValue ReturnValue;
+	TArray<FLuaValue> ReturnValues;
+	bool bSuccess = false;
 
-	if (!this->RunCode(ByteCode, CodePath, 1))
+	const int32 Top = lua_gettop(L);
+	if (!FLuaWorkerGroup::PushFunction(L, QueuedCall.FunctionName))
 	{
-		if (this->bLogError)
-			this->LogError(this->LastError);
-		this->ReceiveLuaError(this->LastError);
+		LastError = FString::Printf(TEXT("Lua error: %s is not a function (queued call)"), *QueuedCall.FunctionName);
 	}
 	else
 	{
-		ReturnValue = this->ToLuaValue(-1);
-	}
-	this->Pop();
-	return ReturnValue;
-}
-
-FLuaValue ULuaState::RunString(const FString& CodeString, FString CodePath)
-{
-	FLuaValue ReturnValue;
-	if (CodePath.IsEmpty())
-	{
-		CodePath = CodeString;
+		const int32 NumArgs = FLuaBinarySerializer::DeserializeAll(L, QueuedCall.Args.GetData(), QueuedCall.Args.Num(), LastError);
+		if (NumArgs < 0)
+		{
+			LastError = FString::Printf(TEXT("Lua error: invalid arguments for queued call to %s: %s"), *QueuedCall.FunctionName, *LastError);
+		}
+		else
+		{
+			FLuaValue LastReturnValue;
+			bSuccess = Call(NumArgs, LastReturnValue, LUA_MULTRET);
+			if (bSuccess)
+			{
+				for (int32 Index = Top + 1; Index <= lua_gettop(L); Index++)
+				{
+					ReturnValues.Add(ToLuaValue(Index));
+				}
+			}
+		}
 	}
+	lua_settop(L, Top);
 
-	if (!RunCode(CodeString, CodePath, 1))
+	if (!bSuccess)
 	{
 		if (bLogError)
 			LogError(LastError);
 		ReceiveLuaError(LastError);
 	}
-	else
+
+	if (QueuedCall.Completion)
 	{
-		ReturnValue = ToLuaValue(-1);
+		QueuedCall.Completion(bSuccess, ReturnValues);
 	}
+}
 
-	Pop();
-	return ReturnValue;
+void ULuaState::TickLuaState(float DeltaTime)
+{
+	if (!L)
+	{
+		return;
+	}
+
+	// before the coroutines, so queued calls can signal/spawn them in the same frame
+	ExecuteQueuedCalls(CommandQueueBudget / 1000.0);
+
+	if (bEnableCoroutineScheduler)
+	{
+		// the world time honors pause and time dilation
+		float SchedulerDeltaTime = DeltaTime;
+		if (CurrentWorld)
+		{
+			const double WorldTime = CurrentWorld->GetTimeSeconds();
+			SchedulerDeltaTime = CoroutineSchedulerWorldTime >= 0 ? FMath::Max<float>(WorldTime - CoroutineSchedulerWorldTime, 0) : 0;
+			CoroutineSchedulerWorldTime = WorldTime;
+		}
+		CoroutineScheduler.Tick(this, SchedulerDeltaTime, CoroutineSchedulerBudget / 1000.0);
+	}
+
+	FunctionStats.Tick(DeltaTime, FunctionStatsResetInterval);
+
+	// after the coroutines, for collecting the garbage they just generated
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_GCStep);
+	GCScheduler.Tick(L, DeltaTime, GCStepBudget / 1000.0);
 }
 
 void ULuaState::RunURL(UObject* WorldContextObject, const FString& URL, TMap<FString, FString> Headers, const FString& SecurityHeader, const FString& SignaturePublicExponent, const FString& SignatureModulus, FLuaHttpSuccess Completed)
@@ -769,6 +1637,30 @@ int32 ULuaState::GetUsedMemory()
 	return this->GC(LUA_GCCOUNT);
 }
 
+FLuaMemoryReport ULuaState::GetMemoryReport(const bool bWalkHeap)
+{
+	FLuaMemoryReport Report;
+	if (!L)
+	{
+		return Report;
+	}
+
+	if (bWalkHeap)
+	{
+		FLuaAllocator::WalkHeap(L, Report);
+	}
+	else
+	{
+		Report.UsedBytes = (int64)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+	}
+
+	Report.PeakBytes = AllocatorStats.PeakBytes;
+	Report.NumAllocations = AllocatorStats.NumAllocations;
+	Report.NumLuaValueRefs = NumLuaValueRefs;
+	Report.NumTrackedUserDataObjects = TrackedLuaUserDataObjects.Num();
+	return Report;
+}
+
 void ULuaState::GCCollect()
 {
 	this->GC(LUA_GCCOLLECT);
@@ -776,14 +1668,29 @@ void ULuaState::GCCollect()
 
 void ULuaState::GCStop()
 {
+	GCScheduler.Stop(L, false);
 	this->GC(LUA_GCSTOP);
 }
 
 void ULuaState::GCRestart()
 {
+	GCScheduler.Stop(L, false);
 	this->GC(LUA_GCRESTART);
 }
 
+void ULuaState::GCStartStepping()
+{
+	if (L && !GCScheduler.IsActive())
+	{
+		GCScheduler.Start(L, GCStepSize);
+	}
+}
+
+void ULuaState::ResetGCStats()
+{
+	GCScheduler.ResetStats();
+}
+
 FLuaValue ULuaState::TableAssetToLuaTable(ULuaTableAsset* TableAsset)
 {
 	return TableAsset->ToLuaTable(this);
@@ -804,8 +1711,8 @@ bool ULuaState::_RunCodeAsset(ULuaCode* CodeAsset, int NRet)
 
 	if (CodeAsset->bCooked && CodeAsset->bCookAsBytecode)
 	{
-#if PLATFORM_ANDROID
-		// fix size_t of the bytecode
+#if PLATFORM_ANDROID && !LUAMACHINE_LUA54
+		// fix size_t of the bytecode (the 5.4 header does not store it)
 		if (CodeAsset->ByteCode.Num() >= 14)
 			CodeAsset->ByteCode[13] = sizeof(size_t);
 #endif
@@ -826,6 +1733,18 @@ bool ULuaState::_RunFile(const FString& Filename, bool bIgnoreNonExistent, int N
 		AbsoluteFilename = Filename;
 	}
 
+	// precompiled scripts (generated by the LuaCompile commandlet) have precedence, unless collecting coverage (they are stripped)
+	// the source file may not be shipped at all
+	if (!bNonContentDirectory && bPreferByteCodeManifest && !FLuaMachineModule::Get().GetCoverage().IsActive() && FLuaMachineModule::Get().GetByteCodeManifest().LoadByteCode(Filename, Code))
+	{
+#if PLATFORM_ANDROID && !LUAMACHINE_LUA54
+		// fix size_t of the bytecode (the 5.4 header does not store it)
+		if (Code.Num() >= 14)
+			Code[13] = sizeof(size_t);
+#endif
+		return RunCode(Code, AbsoluteFilename, NRet);
+	}
+
 	if (!FPaths::FileExists(AbsoluteFilename))
 	{
 		if (bIgnoreNonExistent)
@@ -851,6 +1770,16 @@ bool ULuaState::_RunFile(const FString& Filename, bool bIgnoreNonExistent, int N
 	return false;
 }
 
+bool ULuaState::ModuleFileExists(const FString& Filename) const
+{
+	// same check of _RunFile()
+	if (bPreferByteCodeManifest && !FLuaMachineModule::Get().GetCoverage().IsActive() && FLuaMachineModule::Get().GetByteCodeManifest().Find(Filename))
+	{
+		return true;
+	}
+	return FPaths::FileExists(FPaths::Combine(FPaths::ProjectContentDir(), Filename));
+}
+
 bool ULuaState::RunCode(const FString& Code, const FString& CodePath, int NRet)
 {
 	TArray<uint8> Bytes;
@@ -860,8 +1789,13 @@ bool ULuaState::RunCode(const FString& Code, const FString& CodePath, int NRet)
 
 bool ULuaState::RunCode(const TArray<uint8>& Code, const FString& CodePath, int NRet)
 {
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_RunCode);
+
 	FString FullCodePath = FString("@") + CodePath;
 
+	// the new chunk strings could reuse the memory of collected ones
+	FLuaHookStringInterner::Invalidate();
+
 	if (luaL_loadbuffer(L, (const char*)Code.GetData(), Code.Num(), TCHAR_TO_ANSI(*FullCodePath)))
 	{
 		LastError = FString::Printf(TEXT("Lua loading error: %s"), ANSI_TO_TCHAR(lua_tostring(L, -1)));
@@ -869,8 +1803,11 @@ bool ULuaState::RunCode(const TArray<uint8>& Code, const FString& CodePath, int
 	}
 	else
 	{
+		BeginExecutionBudget(nullptr);
+		const int Ret = lua_pcall(L, 0, NRet, 0);
+		EndExecutionBudget();
 
-		if (lua_pcall(L, 0, NRet, 0))
+		if (Ret)
 		{
 			LastError = FString::Printf(TEXT("Lua execution error: %s"), ANSI_TO_TCHAR(lua_tostring(L, -1)));
 			return false;
@@ -882,40 +1819,23 @@ bool ULuaState::RunCode(const TArray<uint8>& Code, const FString& CodePath, int
 
 int ULuaState::ToByteCode_Writer(lua_State* L, const void* Ptr, size_t Size, void* UserData)
 {
-	TArray<uint8>* Output = (TArray<uint8>*)UserData;
-	Output->Append((uint8*)Ptr, Size);
-	return 0;
+	return FLuaByteCodeCompiler::Writer(L, Ptr, Size, UserData);
 }
 
 TArray<uint8> ULuaState::ToByteCode(const FString& Code, const FString& CodePath, FString& ErrorString)
 {
-	const TCHAR* CodeRaw = *Code;
-	FString FullCodePath = FString("@") + CodePath;
 	TArray<uint8> Output;
-
-	lua_State* L = luaL_newstate();
-	if (luaL_loadbuffer(L, TCHAR_TO_UTF8(CodeRaw), FCStringAnsi::Strlen(TCHAR_TO_UTF8(CodeRaw)), TCHAR_TO_ANSI(*FullCodePath)))
-	{
-		ErrorString = ANSI_TO_TCHAR(lua_tostring(L, -1));
-		Output.Empty();
-		lua_close(L);
-		return Output;
-	}
-
-	if (lua_dump(L, ULuaState::ToByteCode_Writer, &Output, 1))
-	{
-		ErrorString = ANSI_TO_TCHAR(lua_tostring(L, -1));
-		Output.Empty();
-		lua_close(L);
-		return Output;
-	}
-
-	lua_close(L);
+	// reuse the scratch VM of the current thread instead of spawning a new state for each chunk
+	FLuaByteCodeCompiler::GetThreadCompiler().Compile(Code, CodePath, Output, ErrorString);
 	return Output;
 }
 
 void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_State* State)
 {
+	SCOPE_CYCLE_COUNTER(STAT_LuaFromLuaValue);
+	INC_DWORD_STAT(STAT_LuaFromLuaValueCalls);
+	LuaMachineStats_CountConversion(LuaValue.Type);
+
 	if (!State)
 	{
 		State = this->L;
@@ -944,7 +1864,7 @@ void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_Stat
 			lua_newtable(State);
 			lua_pushvalue(State, -1);
 			// hold references in the main state
-			LuaValue.LuaRef = luaL_ref(this->L, LUA_REGISTRYINDEX);
+			LuaValue.LuaRef = NewRef();
 			LuaValue.LuaState = this;
 			break;
 		}
@@ -962,7 +1882,7 @@ void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_Stat
 		{
 			lua_newthread(State);
 			lua_pushvalue(State, -1);
-			LuaValue.LuaRef = luaL_ref(this->L, LUA_REGISTRYINDEX);
+			LuaValue.LuaRef = NewRef();
 			LuaValue.LuaState = this;
 			break;
 		}
@@ -1027,6 +1947,7 @@ void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_Stat
 			else
 			{
 				lua_newtable(State);
+				INC_DWORD_STAT(STAT_LuaMetaTableAllocations);
 				// allow comparison between userdata/UObject/UFunction
 				lua_pushcfunction(State, ULuaState::MetaTableFunctionUserData__eq);
 				lua_setfield(State, -2, "__eq");
@@ -1061,11 +1982,13 @@ void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_Stat
 			{
 				// cache it for context-less calls
 				LuaValue.Object = CallContext;
-				FLuaUserData* LuaCallContext = (FLuaUserData*)lua_newuserdata(State, sizeof(FLuaUserData));
+				FLuaUserData* LuaCallContext = (FLuaUserData*)LuaCompat_NewUserData(State, sizeof(FLuaUserData));
 				LuaCallContext->Type = ELuaValueType::UFunction;
 				LuaCallContext->Context = CallContext;
 				LuaCallContext->Function = Function;
 				lua_newtable(State);
+				INC_DWORD_STAT(STAT_LuaUserDataAllocations);
+				INC_DWORD_STAT(STAT_LuaMetaTableAllocations);
 				lua_pushcfunction(State, bRawLuaFunctionCall ? ULuaState::MetaTableFunction__rawcall : ULuaState::MetaTableFunction__call);
 				lua_setfield(State, -2, "__call");
 				lua_setmetatable(State, -2);
@@ -1086,11 +2009,13 @@ void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_Stat
 			break;
 		}
 		{
-			FLuaUserData* LuaCallContext = (FLuaUserData*)lua_newuserdata(State, sizeof(FLuaUserData));
+			FLuaUserData* LuaCallContext = (FLuaUserData*)LuaCompat_NewUserData(State, sizeof(FLuaUserData));
 			LuaCallContext->Type = ELuaValueType::MulticastDelegate;
 			LuaCallContext->Function = reinterpret_cast<UFunction*>(LuaValue.Object);
 			LuaCallContext->MulticastScriptDelegate = LuaValue.MulticastScriptDelegate;
 			lua_newtable(State);
+			INC_DWORD_STAT(STAT_LuaUserDataAllocations);
+			INC_DWORD_STAT(STAT_LuaMetaTableAllocations);
 			lua_pushcfunction(State, bRawLuaFunctionCall ? ULuaState::MetaTableFunction__rawbroadcast : ULuaState::MetaTableFunction__rawbroadcast);
 			lua_setfield(State, -2, "__call");
 			lua_setmetatable(State, -2);
@@ -1104,6 +2029,9 @@ void ULuaState::FromLuaValue(FLuaValue& LuaValue, UObject* CallContext, lua_Stat
 
 FLuaValue ULuaState::ToLuaValue(int Index, lua_State* State)
 {
+	SCOPE_CYCLE_COUNTER(STAT_LuaToLuaValue);
+	INC_DWORD_STAT(STAT_LuaToLuaValueCalls);
+
 	if (!State)
 	{
 		State = this->L;
@@ -1136,7 +2064,7 @@ FLuaValue ULuaState::ToLuaValue(int Index, lua_State* State)
 			lua_xmove(State, this->L, 1);
 		LuaValue.Type = ELuaValueType::Table;
 		LuaValue.LuaState = this;
-		LuaValue.LuaRef = luaL_ref(this->L, LUA_REGISTRYINDEX);
+		LuaValue.LuaRef = NewRef();
 	}
 	else if (lua_isthread(State, Index))
 	{
@@ -1145,7 +2073,7 @@ FLuaValue ULuaState::ToLuaValue(int Index, lua_State* State)
 			lua_xmove(State, this->L, 1);
 		LuaValue.Type = ELuaValueType::Thread;
 		LuaValue.LuaState = this;
-		LuaValue.LuaRef = luaL_ref(this->L, LUA_REGISTRYINDEX);
+		LuaValue.LuaRef = NewRef();
 	}
 	else if (lua_isfunction(State, Index))
 	{
@@ -1154,7 +2082,7 @@ FLuaValue ULuaState::ToLuaValue(int Index, lua_State* State)
 			lua_xmove(State, this->L, 1);
 		LuaValue.Type = ELuaValueType::Function;
 		LuaValue.LuaState = this;
-		LuaValue.LuaRef = luaL_ref(this->L, LUA_REGISTRYINDEX);
+		LuaValue.LuaRef = NewRef();
 	}
 	else if (lua_isuserdata(State, Index))
 	{
@@ -1181,6 +2109,8 @@ FLuaValue ULuaState::ToLuaValue(int Index, lua_State* State)
 		}
 	}
 
+	LuaMachineStats_CountConversion(LuaValue.Type);
+
 	return LuaValue;
 }
 
@@ -1367,33 +2297,222 @@ TMap<FString, FLuaValue> ULuaState::LuaGetLocals(int32 Level)
 	return ReturnValue;
 }
 
+void ULuaState::UpdateHookMask()
+{
+	if (!L)
+	{
+		return;
+	}
+
+	int DebugMask = 0;
+	HookCountInterval = 0;
+
+	BlueprintHookListener.Configure(
+		(bEnableLineHook ? LUA_MASKLINE : 0) | (bEnableCallHook ? LUA_MASKCALL : 0) | (bEnableReturnHook ? LUA_MASKRET : 0) | (bEnableCountHook ? LUA_MASKCOUNT : 0),
+		HookInstructionCount);
+
+	ActiveHookListeners.Reset();
+	auto ActivateHookListener = [this, &DebugMask](ILuaHookListener* Listener)
+	{
+		FLuaHookListenerEntry Entry;
+		Entry.Listener = Listener;
+		Entry.HookMask = Listener->GetHookMask();
+		Entry.HookCount = Listener->GetHookCount();
+		Entry.PendingInstructions = 0;
+		if (Entry.HookCount <= 0)
+		{
+			Entry.HookMask &= ~LUA_MASKCOUNT;
+		}
+		if (Entry.HookMask == 0)
+		{
+			return;
+		}
+		DebugMask |= Entry.HookMask;
+		// the count hook is shared, use the smallest interval
+		if (Entry.HookMask & LUA_MASKCOUNT)
+		{
+			HookCountInterval = HookCountInterval > 0 ? FMath::Min(HookCountInterval, Entry.HookCount) : Entry.HookCount;
+		}
+		ActiveHookListeners.Add(Entry);
+	};
+
+	if (bTraceLuaFunctions)
+	{
+		ActivateHookListener(&LuaTrace);
+	}
+	if (bEnableFunctionStats != FunctionStats.IsActive())
+	{
+		if (bEnableFunctionStats)
+		{
+			FunctionStats.Start(FunctionStatsTableSize);
+		}
+		else
+		{
+			FunctionStats.Reset();
+		}
+	}
+	ActivateHookListener(&FunctionStats);
+	ActivateHookListener(&Profiler);
+	ActivateHookListener(&FLuaMachineModule::Get().GetCoverage());
+	for (ILuaHookListener* Listener : HookListeners)
+	{
+		ActivateHookListener(Listener);
+	}
+	ActivateHookListener(&BlueprintHookListener);
+
+	if (bEnableExecutionBudget && (ExecutionTimeBudget > 0 || ExecutionInstructionBudget > 0))
+	{
+		DebugMask |= LUA_MASKCOUNT;
+		const int32 CheckInterval = FMath::Max(ExecutionBudgetCheckInterval, 1);
+		HookCountInterval = HookCountInterval > 0 ? FMath::Min(HookCountInterval, CheckInterval) : CheckInterval;
+	}
+
+	lua_sethook(L, DebugMask != 0 ? Debug_Hook : nullptr, DebugMask, HookCountInterval);
+}
+
+void ULuaState::AddHookListener(ILuaHookListener* Listener)
+{
+	if (Listener)
+	{
+		HookListeners.AddUnique(Listener);
+		UpdateHookMask();
+	}
+}
+
+void ULuaState::RemoveHookListener(ILuaHookListener* Listener)
+{
+	if (HookListeners.Remove(Listener) > 0)
+	{
+		UpdateHookMask();
+	}
+}
+
+void ULuaState::DispatchHook(lua_State* State, lua_Debug* ar)
+{
+	const int32 EventMask = LuaHookEventToMask(ar->event);
+	// Blueprint hooks could call UpdateHookMask(), so do not keep references to the entries across calls
+	for (int32 Index = 0; Index < ActiveHookListeners.Num(); Index++)
+	{
+		FLuaHookListenerEntry& Entry = ActiveHookListeners[Index];
+		if ((Entry.HookMask & EventMask) == 0)
+		{
+			continue;
+		}
+		if (EventMask == LUA_MASKCOUNT)
+		{
+			Entry.PendingInstructions += HookCountInterval;
+			if (Entry.PendingInstructions < Entry.HookCount)
+			{
+				continue;
+			}
+			Entry.PendingInstructions = 0;
+		}
+		Entry.Listener->OnLuaHook(State, ar);
+	}
+}
+
+void ULuaState::StartProfiler()
+{
+	Profiler.Start(ProfilerSampleInterval, ProfilerMaxSamples, ProfilerMaxDepth);
+	UpdateHookMask();
+}
+
+void ULuaState::StopProfiler()
+{
+	Profiler.Stop();
+	UpdateHookMask();
+}
+
+TArray<FLuaFunctionStat> ULuaState::GetTopLuaFunctions(const int32 Count) const
+{
+	return FunctionStats.GetTopFunctions(Count, FunctionStatsResetInterval >= 0);
+}
+
+void ULuaState::ResetFunctionStats()
+{
+	if (FunctionStats.IsActive())
+	{
+		FunctionStats.Start(FunctionStatsTableSize);
+	}
+}
+
+void ULuaState::StartRefTracker()
+{
+	RefTracker.Start(RefTrackerStackDepth);
+}
+
+void ULuaState::StopRefTracker()
+{
+	RefTracker.Stop();
+}
+
+bool ULuaState::SaveProfilerCollapsed(const FString& Filename)
+{
+	return FFileHelper::SaveStringToFile(Profiler.ExportCollapsed(), *Filename, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
+
+bool ULuaState::SaveProfilerSpeedscope(const FString& Filename)
+{
+	return FFileHelper::SaveStringToFile(Profiler.ExportSpeedscope(GetClass()->GetName()), *Filename, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
+
+void ULuaState::BeginExecutionBudget(lua_State* Thread)
+{
+	// nested calls share the budget of the outermost one
+	if (ExecutionBudgetDepth++ > 0)
+	{
+		return;
+	}
+
+	ExecutionBudgetThread = Thread;
+	ExecutionBudgetDeadline = ExecutionTimeBudget > 0 ? FPlatformTime::Seconds() + ExecutionTimeBudget / 1000.0 : 0;
+	ExecutionBudgetInstructions = 0;
+}
+
+void ULuaState::EndExecutionBudget()
+{
+	if (--ExecutionBudgetDepth <= 0)
+	{
+		ExecutionBudgetDepth = 0;
+		ExecutionBudgetThread = nullptr;
+		// errors and yields skip the return hook
+		LuaTrace.CloseOpenEvents();
+		FunctionStats.CloseOpenCalls();
+	}
+}
+
+bool ULuaState::CheckExecutionBudget()
+{
+	if (!bEnableExecutionBudget || ExecutionBudgetDepth == 0)
+	{
+		return false;
+	}
+
+	ExecutionBudgetInstructions += HookCountInterval;
+	if (ExecutionInstructionBudget > 0 && ExecutionBudgetInstructions > ExecutionInstructionBudget)
+	{
+		return true;
+	}
+
+	return ExecutionBudgetDeadline > 0 && FPlatformTime::Seconds() > ExecutionBudgetDeadline;
+}
+
 void ULuaState::Debug_Hook(lua_State* L, lua_Debug* ar)
 {
 	ULuaState* LuaState = ULuaState::GetFromExtraSpace(L);
-	FLuaDebug LuaDebug;
-	lua_getinfo(L, "lSn", ar);
-	LuaDebug.CurrentLine = ar->currentline;
-	LuaDebug.Source = ANSI_TO_TCHAR(ar->source);
-	LuaDebug.Name = ANSI_TO_TCHAR(ar->name);
-	LuaDebug.NameWhat = ANSI_TO_TCHAR(ar->namewhat);
-	LuaDebug.What = ANSI_TO_TCHAR(ar->what);
 
-	switch (ar->event)
+	LuaState->DispatchHook(L, ar);
+
+	// no C++ objects must be alive here, as luaL_error will longjmp
+	if (ar->event == LUA_HOOKCOUNT && LuaState->CheckExecutionBudget())
 	{
-	case LUA_HOOKLINE:
-		LuaState->ReceiveLuaLineHook(LuaDebug);
-		break;
-	case LUA_HOOKCALL:
-		LuaState->ReceiveLuaCallHook(LuaDebug);
-		break;
-	case LUA_HOOKRET:
-		LuaState->ReceiveLuaReturnHook(LuaDebug);
-		break;
-	case LUA_HOOKCOUNT:
-		LuaState->ReceiveLuaCountHook(LuaDebug);
-		break;
-	default:
-		break;
+		if (L == LuaState->ExecutionBudgetThread && lua_isyieldable(L))
+		{
+			// the coroutine will continue in the next resume
+			lua_yield(L, 0);
+			return;
+		}
+		luaL_error(L, "execution budget exceeded (%f ms, %d instructions)", LuaState->ExecutionTimeBudget, (int)LuaState->ExecutionBudgetInstructions);
 	}
 }
 
@@ -1465,6 +2584,10 @@ int ULuaState::MetaTableFunctionUserData__gc(lua_State* L)
 
 int ULuaState::MetaTableFunction__call(lua_State* L)
 {
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_UFunctionCall);
+	SCOPE_CYCLE_COUNTER(STAT_LuaUFunctionCall);
+	INC_DWORD_STAT(STAT_LuaUFunctionCalls);
+
 	ULuaState* LuaState = ULuaState::GetFromExtraSpace(L);
 	FLuaUserData* LuaCallContext = (FLuaUserData*)lua_touserdata(L, 1);
 
@@ -1705,6 +2828,9 @@ int ULuaState::MetaTableFunction__call(lua_State* L)
 
 int ULuaState::MetaTableFunction__rawcall(lua_State * L)
 {
+	SCOPE_CYCLE_COUNTER(STAT_LuaUFunctionRawCall);
+	INC_DWORD_STAT(STAT_LuaUFunctionRawCalls);
+
 	ULuaState* LuaState = ULuaState::GetFromExtraSpace(L);
 	FLuaUserData* LuaCallContext = (FLuaUserData*)lua_touserdata(L, 1);
 
@@ -1970,6 +3096,7 @@ int ULuaState::TableFunction_package_loader_codeasset(lua_State * L)
 			{
 				return luaL_error(L, "%s", lua_tostring(L, -1));
 			}
+			LuaState->TrackLoadedModule(UTF8_TO_TCHAR(lua_tostring(L, 1)), LuaCode->GetPathName());
 			return 1;
 		}
 	}
@@ -1986,6 +3113,7 @@ int ULuaState::TableFunction_package_loader_asset(lua_State * L)
 
 	if (LuaState->_RunFile(Key, true, 1))
 	{
+		LuaState->TrackLoadedModule(UTF8_TO_TCHAR(lua_tostring(L, 1)), Key);
 		return 1;
 	}
 	return luaL_error(L, "%s", lua_tostring(L, -1));
@@ -2062,16 +3190,18 @@ int ULuaState::TableFunction_package_preload(lua_State * L)
 	ULuaCode** LuaCodePtr = LuaState->RequireTable.Find(Key);
 	if (!LuaCodePtr)
 	{
-		if (LuaState->bAddProjectContentDirToPackagePath && LuaState->_RunFile(Key + ".lua", true, 1))
+		if (LuaState->bAddProjectContentDirToPackagePath && LuaState->ModuleFileExists(Key + ".lua") && LuaState->_RunFile(Key + ".lua", false, 1))
 		{
+			LuaState->TrackLoadedModule(Key, Key + ".lua");
 			return 1;
 		}
 
 		// now search in additional paths
 		for (FString AdditionalPath : LuaState->AppendProjectContentDirSubDir)
 		{
-			if (LuaState->_RunFile(AdditionalPath / Key + ".lua", true, 1))
+			if (LuaState->ModuleFileExists(AdditionalPath / Key + ".lua") && LuaState->_RunFile(AdditionalPath / Key + ".lua", false, 1))
 			{
+				LuaState->TrackLoadedModule(Key, AdditionalPath / Key + ".lua");
 				return 1;
 			}
 
@@ -2090,6 +3220,7 @@ int ULuaState::TableFunction_package_preload(lua_State * L)
 		return luaL_error(L, "%s", lua_tostring(L, -1));
 	}
 
+	LuaState->TrackLoadedModule(Key, LuaCode->GetPathName());
 	return 1;
 }
 
@@ -2250,7 +3381,8 @@ void ULuaState::NewUObject(UObject * Object, lua_State * State)
 	{
 		State = this->L;
 	}
-	FLuaUserData* UserData = (FLuaUserData*)lua_newuserdata(State, sizeof(FLuaUserData));
+	FLuaUserData* UserData = (FLuaUserData*)LuaCompat_NewUserData(State, sizeof(FLuaUserData));
+	INC_DWORD_STAT(STAT_LuaUserDataAllocations);
 	UserData->Type = ELuaValueType::UObject;
 	UserData->Context = Object;
 	UserData->Function = nullptr;
@@ -2292,7 +3424,13 @@ bool ULuaState::PCall(int NArgs, FLuaValue & Value, int NRet)
 
 bool ULuaState::Call(int NArgs, FLuaValue & Value, int NRet)
 {
-	if (lua_pcall(L, NArgs, NRet, 0))
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_Call);
+
+	BeginExecutionBudget(nullptr);
+	const int Ret = lua_pcall(L, NArgs, NRet, 0);
+	EndExecutionBudget();
+
+	if (Ret)
 	{
 		LastError = FString::Printf(TEXT("Lua error: %s"), ANSI_TO_TCHAR(lua_tostring(L, -1)));
 		return false;
@@ -2322,11 +3460,18 @@ void ULuaState::PushCFunction(lua_CFunction Function)
 
 void* ULuaState::NewUserData(size_t DataSize)
 {
-	return lua_newuserdata(L, DataSize);
+	INC_DWORD_STAT(STAT_LuaUserDataAllocations);
+	return LuaCompat_NewUserData(L, DataSize);
 }
 
 void ULuaState::Unref(int Ref)
 {
+	INC_DWORD_STAT(STAT_LuaUnrefs);
+	RefTracker.OnUnref(Ref);
+	if (Ref >= 0)
+	{
+		NumLuaValueRefs--;
+	}
 	luaL_unref(L, LUA_REGISTRYINDEX, Ref);
 }
 
@@ -2341,7 +3486,27 @@ void ULuaState::UnrefChecked(int Ref)
 
 int ULuaState::NewRef()
 {
-	return luaL_ref(L, LUA_REGISTRYINDEX);
+	INC_DWORD_STAT(STAT_LuaRefs);
+	if (RefTracker.IsActive())
+	{
+		// keep a copy of the value for the tracker
+		lua_pushvalue(L, -1);
+		const int Ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		RefTracker.OnRef(L, Ref);
+		lua_pop(L, 1);
+		if (Ref >= 0)
+		{
+			NumLuaValueRefs++;
+		}
+		return Ref;
+	}
+	const int Ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	// nil values are not referenced
+	if (Ref >= 0)
+	{
+		NumLuaValueRefs++;
+	}
+	return Ref;
 }
 
 void ULuaState::GetRef(int Ref)
@@ -2397,8 +3562,13 @@ bool ULuaState::Resume(int Index, int NArgs)
 		return false;
 	}
 
+	LUAMACHINE_TRACE_SCOPE(LuaMachine_Resume);
+
 	lua_xmove(L, Coroutine, NArgs);
-	int Ret = lua_resume(Coroutine, L, NArgs);
+	BeginExecutionBudget(Coroutine);
+	int NRet = 0;
+	int Ret = LuaCompat_Resume(Coroutine, L, NArgs, &NRet);
+	EndExecutionBudget();
 	if (Ret != LUA_OK && Ret != LUA_YIELD)
 	{
 		lua_pushboolean(L, 0);
@@ -2406,7 +3576,6 @@ bool ULuaState::Resume(int Index, int NArgs)
 		return false;
 	}
 
-	int NRet = lua_gettop(Coroutine);
 	lua_pushboolean(L, 1);
 	lua_xmove(Coroutine, L, NRet);
 	return true;
@@ -2453,16 +3622,25 @@ FLuaValue ULuaState::CreateLuaLazyTable()
 
 FLuaValue ULuaState::CreateLuaThread(FLuaValue Value)
 {
-	FLuaValue NewThread;
-	NewThread.Type = ELuaValueType::Thread;
-	NewThread.LuaState = this;
-	FromLuaValue(NewThread);
-	lua_State* NewLuaThread = lua_tothread(L, -1);
+	// finished threads are recycled
+	lua_State* NewLuaThread = LuaThreadPool.Acquire(L);
+	FLuaValue NewThread = ToLuaValue(-1);
 	FromLuaValue(Value, nullptr, NewLuaThread);
 	Pop();
 	return NewThread;
 }
 
+bool ULuaState::ReleaseLuaThread(FLuaValue Value)
+{
+	if (Value.Type != ELuaValueType::Thread || Value.LuaState != this)
+		return false;
+
+	FromLuaValue(Value);
+	const bool bReleased = LuaThreadPool.Release(L, -1);
+	Pop();
+	return bReleased;
+}
+
 ELuaThreadStatus ULuaState::GetLuaThreadStatus(FLuaValue Value)
 {
 	if (Value.Type != ELuaValueType::Thread || Value.LuaState != this)
@@ -2524,10 +3702,20 @@ ULuaState::~ULuaState()
 
 	FLuaMachineModule::Get().UnregisterLuaState(this);
 
+	CoroutineScheduler.Reset();
+	LuaThreadPool.Reset();
+	GCScheduler.Reset();
+	LuaTrace.Reset();
+	RefTracker.Reset();
+	FunctionStats.Reset();
+	// producers could still retain the queue
+	CommandQueue->Close();
+
 	if (L)
 	{
 		lua_close(L);
 		L = nullptr;
+		FLuaHookStringInterner::Invalidate();
 	}
 }
 
@@ -3053,6 +4241,7 @@ void ULuaState::SetupAndAssignUserDataMetatable(UObject * Context, TMap<FString,
 	}
 
 	lua_newtable(State);
+	INC_DWORD_STAT(STAT_LuaMetaTableAllocations);
 	lua_pushcfunction(State, ULuaState::MetaTableFunctionUserData__index);
 	lua_setfield(State, -2, "__index");
 	lua_pushcfunction(State, ULuaState::MetaTableFunctionUserData__newindex);
@@ -3081,12 +4270,14 @@ void ULuaState::SetupAndAssignUserDataMetatable(UObject * Context, TMap<FString,
 				UFunction* Function = FunctionOwner->FindFunction(Pair.Value.FunctionName);
 				if (Function)
 				{
-					FLuaUserData* LuaCallContext = (FLuaUserData*)lua_newuserdata(State, sizeof(FLuaUserData));
+					FLuaUserData* LuaCallContext = (FLuaUserData*)LuaCompat_NewUserData(State, sizeof(FLuaUserData));
 					LuaCallContext->Type = ELuaValueType::UFunction;
 					LuaCallContext->Context = Context;
 					LuaCallContext->Function = Function;
 
 					lua_newtable(State);
+					INC_DWORD_STAT(STAT_LuaUserDataAllocations);
+					INC_DWORD_STAT(STAT_LuaMetaTableAllocations);
 					lua_pushcfunction(State, bRawLuaFunctionCall ? ULuaState::MetaTableFunction__rawcall : ULuaState::MetaTableFunction__call);
 					lua_setfield(State, -2, "__call");
 					lua_setmetatable(State, -2);
@@ -0,0 +1,93 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaThreadPool.h"
+#include "LuaState.h"
+#include "LuaMachineStats.h"
+
+static int LuaThreadPool_acquire(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	lua_State* Thread = ULuaState::GetFromExtraSpace(L)->GetLuaThreadPool().Acquire(L);
+	lua_pushvalue(L, 1);
+	lua_xmove(L, Thread, 1);
+	return 1;
+}
+
+static int LuaThreadPool_release(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTHREAD);
+	lua_pushboolean(L, ULuaState::GetFromExtraSpace(L)->GetLuaThreadPool().Release(L, 1));
+	return 1;
+}
+
+FLuaThreadPool::FLuaThreadPool()
+{
+	MaxSize = 0;
+	NumCreated = 0;
+	NumReused = 0;
+}
+
+void FLuaThreadPool::RegisterLuaFunctions(lua_State* L)
+{
+	lua_pushcfunction(L, LuaThreadPool_acquire);
+	lua_setfield(L, -2, "acquire");
+	lua_pushcfunction(L, LuaThreadPool_release);
+	lua_setfield(L, -2, "release");
+}
+
+bool FLuaThreadPool::IsFinished(lua_State* Thread)
+{
+	// same logic of coroutine.status() for 'dead' coroutines (excluding the errored ones)
+	lua_Debug Debug;
+	return lua_status(Thread) == LUA_OK && lua_getstack(Thread, 0, &Debug) == 0 && lua_gettop(Thread) == 0;
+}
+
+lua_State* FLuaThreadPool::Acquire(lua_State* L)
+{
+	if (Threads.Num() > 0)
+	{
+		const FLuaPooledThread PooledThread = Threads.Pop();
+		lua_rawgeti(L, LUA_REGISTRYINDEX, PooledThread.ThreadRef);
+		INC_DWORD_STAT(STAT_LuaUnrefs);
+		luaL_unref(L, LUA_REGISTRYINDEX, PooledThread.ThreadRef);
+		// hooks could have been changed after the thread creation
+		lua_sethook(PooledThread.Thread, lua_gethook(L), lua_gethookmask(L), lua_gethookcount(L));
+		NumReused++;
+		return PooledThread.Thread;
+	}
+
+	NumCreated++;
+	return lua_newthread(L);
+}
+
+bool FLuaThreadPool::Release(lua_State* L, int Index)
+{
+	lua_State* Thread = lua_tothread(L, Index);
+	if (!Thread || Thread == L || Threads.Num() >= MaxSize || !IsFinished(Thread))
+	{
+		return false;
+	}
+
+	// the main thread cannot be reused
+	if (lua_pushthread(Thread))
+	{
+		lua_pop(Thread, 1);
+		return false;
+	}
+	lua_pop(Thread, 1);
+
+	if (Threads.ContainsByPredicate([Thread](const FLuaPooledThread& PooledThread) { return PooledThread.Thread == Thread; }))
+	{
+		return false;
+	}
+
+	lua_pushvalue(L, Index);
+	INC_DWORD_STAT(STAT_LuaRefs);
+	Threads.Add({ Thread, luaL_ref(L, LUA_REGISTRYINDEX) });
+	return true;
+}
+
+void FLuaThreadPool::Reset()
+{
+	Threads.Empty();
+}
@@ -0,0 +1,131 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaTrace.h"
+
+#if LUAMACHINE_TRACE_ENABLED
+#include "ProfilingDebugging/CountersTrace.h"
+
+UE_TRACE_CHANNEL_DEFINE(LuaMachineChannel);
+
+TRACE_DECLARE_INT_COUNTER(LuaMachineUsedMemory, TEXT("LuaMachine/UsedMemory"));
+TRACE_DECLARE_FLOAT_COUNTER(LuaMachineGCPause, TEXT("LuaMachine/GCPause"));
+TRACE_DECLARE_INT_COUNTER(LuaMachineScheduledCoroutines, TEXT("LuaMachine/ScheduledCoroutines"));
+#endif
+
+FLuaTrace::FLuaTrace()
+{
+}
+
+#if LUAMACHINE_TRACE_ENABLED
+uint32 FLuaTrace::GetEventType(lua_State* L, lua_Debug* ar)
+{
+	lua_getinfo(L, "Sn", ar);
+
+	// different names of the same C function (like the UFunctions) are different events
+	const TPair<int32, int32> Key(Strings.Intern(ar->what && ar->what[0] == 'C' ? ar->name : ar->source), ar->linedefined);
+	if (const uint32* EventTypeId = EventTypes.Find(Key))
+	{
+		return *EventTypeId;
+	}
+
+	FString Name = ar->name ? UTF8_TO_TCHAR(ar->name) : TEXT("(anonymous)");
+	if (ar->linedefined > 0)
+	{
+		Name += FString::Printf(TEXT(" (%s:%d)"), UTF8_TO_TCHAR(ar->short_src), ar->linedefined);
+	}
+	const uint32 EventTypeId = FCpuProfilerTrace::OutputEventType(*Name);
+	EventTypes.Add(Key, EventTypeId);
+	return EventTypeId;
+}
+#endif
+
+void FLuaTrace::OnCall(lua_State* L, lua_Debug* ar, const bool bTailCall)
+{
+#if LUAMACHINE_TRACE_ENABLED
+	if (!LUAMACHINE_TRACE_IS_ENABLED())
+	{
+		return;
+	}
+
+	// the tail called function replaces the caller, there will be a single return
+	if (bTailCall && OpenEvents.Num() > 0 && OpenEvents.Last().Thread == L)
+	{
+		CloseEvents(OpenEvents.Num() - 1);
+	}
+
+	const void* Function = LuaHookGetFunction(L, ar);
+	FCpuProfilerTrace::OutputBeginEvent(GetEventType(L, ar));
+	OpenEvents.Add({ L, Function });
+#endif
+}
+
+void FLuaTrace::OnReturn(lua_State* L, lua_Debug* ar)
+{
+#if LUAMACHINE_TRACE_ENABLED
+	if (OpenEvents.Num() == 0)
+	{
+		return;
+	}
+
+	const void* Function = LuaHookGetFunction(L, ar);
+	for (int32 Index = OpenEvents.Num() - 1; Index >= 0; Index--)
+	{
+		if (OpenEvents[Index].Thread == L && OpenEvents[Index].Function == Function)
+		{
+			CloseEvents(Index);
+			return;
+		}
+	}
+	// returns of calls started before enabling the channel (or of already closed events) are ignored
+#endif
+}
+
+#if LUAMACHINE_TRACE_ENABLED
+void FLuaTrace::CloseEvents(const int32 Index)
+{
+	while (OpenEvents.Num() > Index)
+	{
+		FCpuProfilerTrace::OutputEndEvent();
+		OpenEvents.Pop(false);
+	}
+}
+#endif
+
+void FLuaTrace::OnLuaHook(lua_State* L, lua_Debug* ar)
+{
+	if (LuaHookEventToMask(ar->event) == LUA_MASKRET)
+	{
+		OnReturn(L, ar);
+		return;
+	}
+#ifdef LUA_HOOKTAILCALL
+	OnCall(L, ar, ar->event == LUA_HOOKTAILCALL);
+#else
+	OnCall(L, ar, false);
+#endif
+}
+
+void FLuaTrace::CloseOpenEvents()
+{
+#if LUAMACHINE_TRACE_ENABLED
+	CloseEvents(0);
+#endif
+}
+
+void FLuaTrace::Reset()
+{
+	CloseOpenEvents();
+#if LUAMACHINE_TRACE_ENABLED
+	EventTypes.Empty();
+	Strings.Reset();
+#endif
+}
+
+void FLuaTrace::UpdateCounters(const int64 UsedMemory, const float GCPause, const int32 NumScheduledCoroutines)
+{
+#if LUAMACHINE_TRACE_ENABLED
+	TRACE_COUNTER_SET(LuaMachineUsedMemory, UsedMemory);
+	TRACE_COUNTER_SET(LuaMachineGCPause, GCPause);
+	TRACE_COUNTER_SET(LuaMachineScheduledCoroutines, NumScheduledCoroutines);
+#endif
+}
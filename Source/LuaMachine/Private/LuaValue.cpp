@@ -2,6 +2,7 @@
 
 #include "LuaValue.h"
 #include "LuaState.h"
+#include "LuaMachineStats.h"
 #include "Misc/Base64.h"
 
 FString FLuaValue::ToString() const
@@ -270,6 +271,8 @@ bool FLuaValue::IsNil() const
 
 FLuaValue FLuaValue::FromJsonValue(ULuaState* L, FJsonValue& JsonValue)
 {
+	INC_DWORD_STAT(STAT_LuaJsonConversions);
+
 	if (JsonValue.Type == EJson::String)
 	{
 		return FLuaValue(JsonValue.AsString());
@@ -320,6 +323,8 @@ FLuaValue FLuaValue::FromJsonValue(ULuaState* L, FJsonValue& JsonValue)
 
 TSharedPtr<FJsonValue> FLuaValue::ToJsonValue()
 {
+	INC_DWORD_STAT(STAT_LuaJsonConversions);
+
 	switch (Type)
 	{
 	case ELuaValueType::Integer:
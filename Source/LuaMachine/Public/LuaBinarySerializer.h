@@ -0,0 +1,33 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+
+/**
+ * Compact binary encoding of plain Lua data (nil, booleans, numbers, strings and tables of them),
+ * used for moving values between isolated Lua VMs (and threads) without touching the source VM.
+ * Values are appended one after the other, so a buffer can contain a whole list of arguments/results.
+ */
+struct LUAMACHINE_API FLuaBinarySerializer
+{
+	/* append the value at Index to Data */
+	static bool Serialize(lua_State* L, int Index, TArray<uint8>& Data, FString& Error);
+
+	/* append the values between FirstIndex and the top of the stack, returns the number of serialized values (or -1 on error) */
+	static int32 SerializeRange(lua_State* L, int FirstIndex, TArray<uint8>& Data, FString& Error);
+
+	/* push the value starting at Data + Offset (Offset is advanced to the next value) */
+	static bool Deserialize(lua_State* L, const uint8* Data, const int64 Size, int64& Offset, FString& Error);
+
+	/* push all of the values in the buffer, returns the number of pushed values (or -1 on error, with nothing pushed) */
+	static int32 DeserializeAll(lua_State* L, const uint8* Data, const int64 Size, FString& Error);
+
+	/* encode scalar values without a Lua VM (for building arguments from any thread) */
+	static void WriteNil(TArray<uint8>& Data);
+	static void WriteBool(TArray<uint8>& Data, const bool bValue);
+	static void WriteInteger(TArray<uint8>& Data, const int64 Value);
+	static void WriteNumber(TArray<uint8>& Data, const double Value);
+	static void WriteString(TArray<uint8>& Data, const FString& Value);
+};
@@ -28,6 +28,9 @@ enum class ELuaReflectionType : uint8
 };
 
 
+DECLARE_DYNAMIC_DELEGATE_ThreeParams(FLuaPakFileLoaded, bool, bSuccess, const TArray<FLuaValue>&, Assets, float, LoadTime);
+DECLARE_DYNAMIC_DELEGATE_TwoParams(FLuaPakFileProgress, float, Progress, const FString&, Stage);
+
 UCLASS()
 class LUAMACHINE_API ULuaBlueprintFunctionLibrary : public UBlueprintFunctionLibrary
 {
@@ -248,6 +251,10 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "Lua")
 	static void LuaStateReload(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass);
 
+	/* Re-run a single module loaded with require(), patching its functions without rebuilding the whole state */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "Lua")
+	static bool LuaStateReloadModule(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& ModuleName);
+
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "Lua")
 	static FLuaValue LuaRunFile(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& Filename, const bool bIgnoreNonExistent);
 
@@ -257,6 +264,17 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category="Lua")
 	static FLuaValue LuaRunCodeAsset(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, ULuaCode* CodeAsset);
 
+	/* Like LuaRunFile, but the file is read and compiled on a worker thread */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject", Latent, LatentInfo = "LatentInfo"), Category = "Lua")
+	static void LuaRunFileAsync(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& Filename, const bool bIgnoreNonExistent, FLatentActionInfo LatentInfo, FLuaValue& ReturnValue, bool& bSuccess);
+
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject", Latent, LatentInfo = "LatentInfo"), Category = "Lua")
+	static void LuaRunNonContentFileAsync(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& Filename, const bool bIgnoreNonExistent, FLatentActionInfo LatentInfo, FLuaValue& ReturnValue, bool& bSuccess);
+
+	/* Like LuaRunCodeAsset, but the code is compiled on a worker thread */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject", Latent, LatentInfo = "LatentInfo"), Category = "Lua")
+	static void LuaRunCodeAssetAsync(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, ULuaCode* CodeAsset, FLatentActionInfo LatentInfo, FLuaValue& ReturnValue, bool& bSuccess);
+
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category="Lua")
 	static FLuaValue LuaRunByteCode(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const TArray<uint8>& ByteCode, const FString& CodePath);
 
@@ -280,6 +298,10 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	static bool LuaLoadPakFile(const FString& Filename, FString Mountpoint, TArray<FLuaValue>& Assets, FString ContentPath, FString AssetRegistryPath);
 
+	/* Like LuaLoadPakFile, but the pak is opened/mounted and its assets are loaded in the background (LoadTime is in seconds), multiple calls are queued and the asset registry scan still blocks the game thread */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	static void LuaLoadPakFileAsync(const FString& Filename, FString Mountpoint, FString ContentPath, FString AssetRegistryPath, FLuaPakFileLoaded Completed, FLuaPakFileProgress Progress);
+
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "Lua")
 	static FLuaValue LuaNewLuaUserDataObject(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, TSubclassOf<ULuaUserDataObject> UserDataObjectClass, bool bTrackObject=true);
 
@@ -421,6 +443,18 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "Lua")
 	static ULuaState* CreateDynamicLuaState(UObject* WorldContextObject, TSubclassOf<ULuaState> LuaStateClass);
 
+	/* Run a function on a worker VM (it cannot access UObjects), arguments and return values must be plain data */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Args"), Category = "Lua")
+	static void LuaRunJob(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<FLuaValue> Args, FLuaJobCompleted Completed);
+
+	/* Call FunctionName(Input, Index) for each input on multiple worker VMs (ChunkSize 0 for automatic sizing), ReturnValues are in the inputs order */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "Lua")
+	static void LuaParallelFor(UObject* WorldContextObject, TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<FLuaValue> Inputs, const int32 ChunkSize, FLuaJobCompleted Completed);
+
+	/* Close the worker VMs of the LuaState class, the next job will reload its code */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	static void LuaResetJobStates(TSubclassOf<ULuaState> StateClass);
+
 	// For custom K2Node Graph logic
 	static FEdGraphPinType LuaValueToPinType(const FLuaValue& LuaValue);
 
@@ -0,0 +1,59 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+
+struct LUAMACHINE_API FLuaByteCodeCompileJob
+{
+	// used as the chunk name (prefixed with '@')
+	FString CodePath;
+	TArray<uint8> Code;
+
+	TArray<uint8> ByteCode;
+	FString Error;
+	bool bSuccess;
+	// seconds spent in parsing + dumping
+	double CompileTime;
+
+	FLuaByteCodeCompileJob()
+		: bSuccess(false)
+		, CompileTime(0)
+	{
+	}
+
+	FLuaByteCodeCompileJob(const FString& InCodePath, const FString& InCode);
+};
+
+/**
+ * Compiles Lua sources to (stripped) bytecode reusing a single scratch lua_State.
+ * An instance is not thread safe: use one compiler per thread (CompileBatch does it for you).
+ */
+class LUAMACHINE_API FLuaByteCodeCompiler
+{
+public:
+	FLuaByteCodeCompiler();
+	~FLuaByteCodeCompiler();
+
+	FLuaByteCodeCompiler(const FLuaByteCodeCompiler&) = delete;
+	FLuaByteCodeCompiler& operator=(const FLuaByteCodeCompiler&) = delete;
+
+	bool Compile(const uint8* Code, const int32 CodeLength, const FString& CodePath, TArray<uint8>& ByteCode, FString& ErrorString, const bool bStripDebugInfo = true);
+	bool Compile(const FString& Code, const FString& CodePath, TArray<uint8>& ByteCode, FString& ErrorString, const bool bStripDebugInfo = true);
+
+	bool Compile(FLuaByteCodeCompileJob& Job, const bool bStripDebugInfo = true);
+
+	/* compile all of the jobs using up to NumWorkers threads (0 means all of the task graph workers), each one with its own scratch VM */
+	static void CompileBatch(TArray<FLuaByteCodeCompileJob>& Jobs, const bool bStripDebugInfo = true, int32 NumWorkers = 0);
+
+	/* compiler reserved to the calling thread */
+	static FLuaByteCodeCompiler& GetThreadCompiler();
+
+	/* lua_Writer appending to the TArray<uint8> passed as UserData */
+	static int Writer(lua_State* L, const void* Ptr, size_t Size, void* UserData);
+
+private:
+	lua_State* L;
+	int64 BytesSinceLastCollect;
+};
@@ -0,0 +1,40 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct LUAMACHINE_API FLuaByteCodeManifestEntry
+{
+	// relative to the manifest directory
+	FString ByteCodeFilename;
+	// MD5 of the original source
+	FString SourceHash;
+};
+
+/**
+ * Maps Content/ relative Lua scripts to their precompiled bytecode (generated by the LuaCompile commandlet).
+ */
+class LUAMACHINE_API FLuaByteCodeManifest
+{
+public:
+	static FString GetDefaultDirectory();
+	static FString NormalizeKey(const FString& Filename);
+	static FString HashSource(const TArray<uint8>& Source);
+
+	bool Load(const FString& ManifestDirectory);
+	bool Save() const;
+
+	void Add(const FString& Filename, const FLuaByteCodeManifestEntry& Entry);
+	const FLuaByteCodeManifestEntry* Find(const FString& Filename) const;
+
+	/* load the bytecode of a Content/ relative script, returns false if the script is not in the manifest (or it is stale) */
+	bool LoadByteCode(const FString& Filename, TArray<uint8>& ByteCode) const;
+
+	FORCEINLINE const FString& GetDirectory() const { return Directory; }
+	FORCEINLINE int32 Num() const { return Entries.Num(); }
+
+private:
+	FString Directory;
+	TMap<FString, FLuaByteCodeManifestEntry> Entries;
+};
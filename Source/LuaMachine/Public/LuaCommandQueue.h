@@ -0,0 +1,51 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/CriticalSection.h"
+
+struct FLuaValue;
+
+/* called on the game thread after the queued function has been executed (ReturnValues are empty on errors) */
+typedef TFunction<void(bool bSuccess, const TArray<FLuaValue>& ReturnValues)> FLuaQueuedCallCompletion;
+
+struct FLuaQueuedCall
+{
+	/* global or dotted path (like "events.on_download") */
+	FString FunctionName;
+	/* arguments encoded with FLuaBinarySerializer */
+	TArray<uint8> Args;
+	FLuaQueuedCallCompletion Completion;
+};
+
+/**
+ * Lock-free multiple producers/single consumer queue of calls into a LuaState (producers only share a read lock with Close()).
+ * Any thread can enqueue calls, the LuaState executes them on the game thread during its tick (within a time budget).
+ * The queue is shared (ULuaState::GetCommandQueue()), so producers can safely outlive the LuaState: once it is closed
+ * the calls are not queued anymore and their completion is called with bSuccess=false.
+ */
+class LUAMACHINE_API FLuaCommandQueue
+{
+public:
+	FLuaCommandQueue();
+
+	/* can be called from any thread */
+	void Enqueue(const FString& FunctionName, TArray<uint8> Args, FLuaQueuedCallCompletion Completion = nullptr);
+
+	/* consumer side (game thread only) */
+	bool Dequeue(FLuaQueuedCall& Call);
+
+	/* fail every pending call and every call enqueued after it (game thread only) */
+	void Close();
+
+	int32 GetNumPending() const { return NumPending.GetValue(); }
+
+private:
+	TQueue<FLuaQueuedCall, EQueueMode::Mpsc> Calls;
+	FThreadSafeCounter NumPending;
+	FRWLock ClosedLock;
+	bool bClosed;
+};
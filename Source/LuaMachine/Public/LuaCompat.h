@@ -0,0 +1,163 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// the Lua version is selected by the LUAMACHINE_LUA_VERSION and LUAMACHINE_LUAJIT build options (see BuildingNotes.md)
+#if LUAMACHINE_LUAJIT
+#include "ThirdParty/luajit/include/lua.hpp"
+#elif LUAMACHINE_LUA54
+#include "ThirdParty/lua54/src/lua.hpp"
+#elif LUAMACHINE_LUA_FROM_SOURCE
+// the luaconf.h of the compiled sources, the prebuilt one could not match them
+#include "ThirdParty/lua/src/lua.hpp"
+#else
+#include "ThirdParty/lua/lua.hpp"
+#endif
+
+FORCEINLINE int LuaCompat_AbsIndex(lua_State* L, int Index)
+{
+#if LUAMACHINE_LUAJIT
+	return (Index > 0 || Index <= LUA_REGISTRYINDEX) ? Index : lua_gettop(L) + Index + 1;
+#else
+	return lua_absindex(L, Index);
+#endif
+}
+
+#if LUAMACHINE_LUAJIT
+// shims for the Lua 5.3 api used by the plugin (LuaJIT implements the 5.1 api with some 5.2/5.3 extensions)
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#define LUA_LOADED_TABLE "_LOADED"
+#define lua_rawlen lua_objlen
+#define lua_pushglobaltable(L) lua_pushvalue(L, LUA_GLOBALSINDEX)
+
+/* there is no per-state extra space in LuaJIT, so the memory is allocated as a userdata referenced by the registry (LuaCompat_InitExtraSpace() must be called on every new state) */
+LUAMACHINE_API void LuaCompat_InitExtraSpace(lua_State* L);
+
+/* the registry lookup is cached per thread */
+LUAMACHINE_API void* lua_getextraspace(lua_State* L);
+
+/* LuaJIT numbers are always doubles, integral values are reported as integers (like the 5.3 integer subtype) */
+FORCEINLINE int lua_isinteger(lua_State* L, int Index)
+{
+	if (lua_type(L, Index) != LUA_TNUMBER)
+	{
+		return 0;
+	}
+	const lua_Number Number = lua_tonumber(L, Index);
+	return FMath::Abs(Number) <= 9007199254740992.0 && FMath::FloorToDouble(Number) == Number;
+}
+
+/* there is no C api for it, coroutines are yieldable (LuaJIT raises an error when yielding across a C-call boundary) */
+FORCEINLINE int lua_isyieldable(lua_State* L)
+{
+	const int bIsMainThread = lua_pushthread(L);
+	lua_pop(L, 1);
+	return !bIsMainThread;
+}
+
+FORCEINLINE void lua_seti(lua_State* L, int Index, lua_Integer N)
+{
+	Index = LuaCompat_AbsIndex(L, Index);
+	lua_pushinteger(L, N);
+	lua_insert(L, -2);
+	lua_settable(L, Index);
+}
+
+FORCEINLINE void lua_len(lua_State* L, int Index)
+{
+	Index = LuaCompat_AbsIndex(L, Index);
+	if (!luaL_callmeta(L, Index, "__len"))
+	{
+		lua_pushinteger(L, (lua_Integer)lua_objlen(L, Index));
+	}
+}
+
+FORCEINLINE lua_Integer luaL_len(lua_State* L, int Index)
+{
+	lua_len(L, Index);
+	if (!lua_isnumber(L, -1))
+	{
+		luaL_error(L, "object length is not a number");
+	}
+	const lua_Integer Length = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	return Length;
+}
+
+FORCEINLINE void luaL_requiref(lua_State* L, const char* ModuleName, lua_CFunction OpenFunction, int bGlobal)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	lua_getfield(L, -1, ModuleName);
+	if (!lua_toboolean(L, -1))
+	{
+		lua_pop(L, 1);
+		lua_pushcfunction(L, OpenFunction);
+		lua_pushstring(L, ModuleName);
+		lua_call(L, 1, 1);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -3, ModuleName);
+	}
+	lua_remove(L, -2);
+	if (bGlobal)
+	{
+		lua_pushvalue(L, -1);
+		lua_setglobal(L, ModuleName);
+	}
+}
+
+/* the coroutine library is part of the base one in LuaJIT */
+FORCEINLINE int luaopen_coroutine(lua_State* L)
+{
+	lua_getglobal(L, LUA_COLIBNAME);
+	return 1;
+}
+#endif
+
+/* lua_resume() with the 5.4 signature: the number of values yielded/returned (on top of the thread stack) is stored in NResults */
+FORCEINLINE int LuaCompat_Resume(lua_State* L, lua_State* From, int NArgs, int* NResults)
+{
+#if LUAMACHINE_LUA54
+	return lua_resume(L, From, NArgs, NResults);
+#elif LUAMACHINE_LUAJIT
+	const int Status = lua_resume(L, NArgs);
+	*NResults = lua_gettop(L);
+	return Status;
+#else
+	const int Status = lua_resume(L, From, NArgs);
+	*NResults = lua_gettop(L);
+	return Status;
+#endif
+}
+
+/* allocate a full userdata without user values (5.4 would reserve one by default) */
+FORCEINLINE void* LuaCompat_NewUserData(lua_State* L, size_t Size)
+{
+#if LUAMACHINE_LUA54
+	return lua_newuserdatauv(L, Size, 0);
+#else
+	return lua_newuserdata(L, Size);
+#endif
+}
+
+/* lua_dump() with the strip argument (ignored by LuaJIT) */
+FORCEINLINE int LuaCompat_Dump(lua_State* L, lua_Writer Writer, void* Data, int bStrip)
+{
+#if LUAMACHINE_LUAJIT
+	return lua_dump(L, Writer, Data);
+#else
+	return lua_dump(L, Writer, Data, bStrip);
+#endif
+}
+
+/* name of the package searchers table (LuaJIT exposes it as package.loaders unless built with LUAJIT_ENABLE_LUA52COMPAT) */
+#if LUAMACHINE_LUAJIT
+#define LUACOMPAT_SEARCHERS "loaders"
+#else
+#define LUACOMPAT_SEARCHERS "searchers"
+#endif
@@ -0,0 +1,76 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+
+class ULuaState;
+
+struct FLuaScheduledCoroutine
+{
+	lua_State* Thread;
+	// values already pushed on the thread stack for the next resume
+	int32 NumArgs;
+};
+
+struct FLuaSleepingCoroutine
+{
+	lua_State* Thread;
+	// seconds for timers, frame number for frame waits
+	double WakeUp;
+	// keeps FIFO order between coroutines waking up at the same time
+	uint64 Sequence;
+};
+
+/**
+ * Native per-LuaState coroutine scheduler, ticked once per frame by the LuaMachine module.
+ * Lua code can use spawn(fn, ...), wait(seconds), wait_frames(n), wait_event(name) and signal(name, ...).
+ */
+class LUAMACHINE_API FLuaCoroutineScheduler
+{
+public:
+	FLuaCoroutineScheduler();
+
+	/* register the scheduler functions in the table on top of the stack */
+	static void RegisterLuaFunctions(lua_State* L);
+
+	/* resume every ready coroutine until the budget (in seconds, 0 for unlimited) is spent */
+	void Tick(ULuaState* LuaState, const float DeltaTime, const double Budget);
+
+	/* turn the function (followed by NArgs) on top of the stack in a scheduled coroutine, the thread is left on the stack */
+	lua_State* Spawn(lua_State* L, const int NArgs);
+
+	/* wake up all the coroutines waiting for the event, passing them the NArgs values on top of the stack */
+	int32 Signal(lua_State* L, const FString& EventName, const int NArgs);
+
+	void Sleep(lua_State* Thread, const double Seconds);
+	void SleepFrames(lua_State* Thread, const int64 Frames);
+	void WaitEvent(lua_State* Thread, const FString& EventName);
+
+	/* drop every coroutine without touching the Lua VM (must be called before closing it) */
+	void Reset();
+
+	FORCEINLINE bool IsRunning(lua_State* Thread) const { return CurrentThread == Thread; }
+	FORCEINLINE int32 Num() const { return ThreadRefs.Num(); }
+	FORCEINLINE double GetTime() const { return Time; }
+	FORCEINLINE uint64 GetFrame() const { return Frame; }
+
+private:
+	void ResumeThread(ULuaState* LuaState, lua_State* L, const FLuaScheduledCoroutine& Coroutine);
+	void Release(lua_State* L, lua_State* Thread);
+
+	TMap<lua_State*, int> ThreadRefs;
+
+	TArray<FLuaScheduledCoroutine> ReadyQueue;
+	TArray<FLuaSleepingCoroutine> TimerHeap;
+	TArray<FLuaSleepingCoroutine> FrameHeap;
+	TMap<FString, TArray<lua_State*>> EventWaiters;
+
+	lua_State* CurrentThread;
+	bool bCurrentThreadParked;
+
+	double Time;
+	uint64 Frame;
+	uint64 Sequence;
+};
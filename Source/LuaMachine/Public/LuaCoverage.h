@@ -0,0 +1,61 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "LuaHookListener.h"
+
+/* lines of a chunk ("@" chunk name: content-dir file or LuaCode asset path) */
+struct LUAMACHINE_API FLuaCoverageChunk
+{
+	FString Name;
+	/* lines with code of the functions that have been called at least once */
+	TBitArray<> ExecutableLines;
+	TBitArray<> HitLines;
+};
+
+/**
+ * Line coverage collector driven by the line hook, shared by all of the LuaStates (ULuaState::UpdateHookMask attaches it while active).
+ * Each chunk has two bitsets indexed by line: the hit lines and the lines with code (the active lines of every function seen running,
+ * so the body of functions never called is not reported). Chunks loaded from stripped bytecode have no line information.
+ */
+class LUAMACHINE_API FLuaCoverage : public ILuaHookListener
+{
+public:
+	FLuaCoverage();
+
+	void Start();
+	void Stop();
+
+	/* forget the collected lines */
+	void Reset();
+
+	virtual int32 GetHookMask() const override { return bActive ? LUA_MASKLINE : 0; }
+	virtual void OnLuaHook(lua_State* L, lua_Debug* ar) override;
+
+	FORCEINLINE bool IsActive() const { return bActive; }
+	FORCEINLINE const TArray<FLuaCoverageChunk>& GetChunks() const { return Chunks; }
+
+	/* LCOV tracefile (genhtml, codecov, ...) */
+	FString ExportLCOV(const FString& TestName) const;
+
+	bool SaveLCOV(const FString& Filename, const FString& TestName) const;
+
+private:
+	int32 FindChunk(const char* Source);
+
+	void AddActiveLines(lua_State* L, lua_Debug* ar, FLuaCoverageChunk& Chunk);
+
+	bool bActive;
+
+	TArray<FLuaCoverageChunk> Chunks;
+	// only the chunk names are interned, so the string id is the chunk id
+	FLuaHookStringInterner ChunkNames;
+	// functions (chunk id and linedefined) whose active lines have been added
+	TSet<TPair<int32, int32>> Functions;
+
+	// the function of the previous line event, consecutive events are usually in the same function
+	int32 LastChunkId;
+	int32 LastLineDefined;
+};
@@ -0,0 +1,132 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "LuaHookListener.h"
+#include "LuaFunctionStats.generated.h"
+
+USTRUCT(BlueprintType)
+struct LUAMACHINE_API FLuaFunctionStat
+{
+	GENERATED_BODY()
+
+	/* Name of the function (as seen by the first call) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	FString Name;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	FString Source;
+
+	/* Line where the function is defined */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 Line;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 Calls;
+
+	/* Milliseconds spent in the function, callees included */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float InclusiveTime;
+
+	/* Milliseconds spent in the function itself */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float ExclusiveTime;
+
+	FLuaFunctionStat()
+		: Line(0)
+		, Calls(0)
+		, InclusiveTime(0)
+		, ExclusiveTime(0)
+	{
+	}
+};
+
+/**
+ * Calls and inclusive/exclusive time of each Lua function prototype (C functions are keyed by their pointer) driven by the call/return hooks.
+ * The functions are stored in a fixed-size open addressing table (functions not fitting in it are accounted as "(other)").
+ * Counters are double buffered: NextInterval() makes the current counters the completed interval and starts a new one.
+ */
+class LUAMACHINE_API FLuaFunctionStats : public ILuaHookListener
+{
+public:
+	FLuaFunctionStats();
+
+	/* allocate the table (TableSize is rounded up to a power of two) and start counting */
+	void Start(const int32 TableSize);
+	void Stop();
+
+	/* forget the functions and the counters */
+	void Reset();
+
+	/* start a new interval when ResetInterval seconds are elapsed (every frame when 0, never when negative) */
+	void Tick(const float DeltaTime, const float ResetInterval);
+
+	void NextInterval();
+
+	/* account the calls left open by errors and yields (no return hook is called for the unwound functions) */
+	void CloseOpenCalls();
+
+	/* the Count functions with the highest exclusive time, of the last completed interval or of the current one */
+	TArray<FLuaFunctionStat> GetTopFunctions(const int32 Count, const bool bCompletedInterval) const;
+
+	virtual int32 GetHookMask() const override { return bActive ? LUA_MASKCALL | LUA_MASKRET : 0; }
+	virtual void OnLuaHook(lua_State* L, lua_Debug* ar) override;
+
+	FORCEINLINE bool IsActive() const { return bActive; }
+
+private:
+	struct FCounters
+	{
+		int32 Calls;
+		uint64 InclusiveCycles;
+		uint64 ExclusiveCycles;
+	};
+
+	struct FSlot
+	{
+		// interned source of Lua functions (INDEX_NONE for C functions)
+		int32 SourceId;
+		lua_CFunction CFunction;
+		int32 LineDefined;
+		bool bUsed;
+		FString Name;
+		FString Source;
+		FCounters Counters[2];
+	};
+
+	struct FCallFrame
+	{
+		int32 SlotIndex;
+		// LuaHookGetFunction(), for matching the return hook (the unwound functions of caught errors get no return hook)
+		const void* Function;
+		uint64 StartCycles;
+		uint64 ChildrenCycles;
+	};
+
+	int32 FindSlot(lua_State* L, lua_Debug* ar);
+
+	void PopCall(TArray<FCallFrame>& Stack, const uint64 Now);
+
+	TArray<FCallFrame>& GetStack(lua_State* L);
+
+	bool bActive;
+
+	FLuaHookStringInterner Sources;
+
+	// the last one is "(other)"
+	TArray<FSlot> Slots;
+	int32 SlotsMask;
+	// occupied slots, for iterating only the used part of the table
+	TArray<int32> UsedSlots;
+
+	// index of the counters being updated
+	int32 CurrentCounters;
+	float IntervalTime;
+
+	// call stack of each Lua thread (coroutines can interleave their calls)
+	TMap<lua_State*, TArray<FCallFrame>> Stacks;
+	lua_State* LastThread;
+	TArray<FCallFrame>* LastStack;
+};
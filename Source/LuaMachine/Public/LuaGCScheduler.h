@@ -0,0 +1,124 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "LuaGCScheduler.generated.h"
+
+USTRUCT(BlueprintType)
+struct FLuaGCStats
+{
+	GENERATED_BODY()
+
+	/* Frames in which the collector has been stepped */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumFrames;
+
+	/* Total number of incremental steps */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumSteps;
+
+	/* Completed collection cycles */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumCycles;
+
+	/* Frames in which the stepping exceeded the budget */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumFramesOverBudget;
+
+	/* Full collections forced because the memory outgrew the stepping (allocation rate too high for the budget) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumFullCollections;
+
+	/* Milliseconds spent in the collector during the last frame */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float LastPause;
+
+	/* Longest per-frame pause in milliseconds */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float MaxPause;
+
+	/* Average per-frame pause in milliseconds */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float AveragePause;
+
+	/* Total milliseconds spent in the collector */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float TotalPause;
+
+	/* Smoothed allocation rate in KB per second */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float AllocationRate;
+
+	/* Current step size in KB */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 StepSize;
+
+	/* Memory (in KB) used by the Lua VM after the last frame */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 UsedMemory;
+
+	FLuaGCStats()
+		: NumFrames(0)
+		, NumSteps(0)
+		, NumCycles(0)
+		, NumFramesOverBudget(0)
+		, NumFullCollections(0)
+		, LastPause(0)
+		, MaxPause(0)
+		, AveragePause(0)
+		, TotalPause(0)
+		, AllocationRate(0)
+		, StepSize(0)
+		, UsedMemory(0)
+	{
+	}
+};
+
+/**
+ * Replaces the allocation-driven Lua collector with incremental steps (LUA_GCSTEP) run once per frame within a time budget.
+ * The work done each frame follows the measured allocation rate, while the step size adapts to the time taken by each step.
+ * When the memory grows past LuaGCFullCollectFactor times the size left by the last completed cycle a full collection is done
+ * regardless of the budget. The Lua 5.4 generational mode is switched to the incremental one while stepping.
+ */
+class LUAMACHINE_API FLuaGCScheduler
+{
+public:
+	FLuaGCScheduler();
+
+	/* stop the automatic collector and start stepping it manually */
+	void Start(lua_State* L, const int32 InitialStepSize);
+
+	/* stop stepping the collector (the automatic collector is restarted if bRestartCollector is true) */
+	void Stop(lua_State* L, const bool bRestartCollector);
+
+	/* run incremental steps until the per-frame work is done or the budget (in seconds) is spent */
+	void Tick(lua_State* L, const float DeltaTime, const double Budget);
+
+	/* forget the collector state without touching the Lua VM (must be called before closing it) */
+	void Reset();
+
+	void ResetStats();
+
+	FORCEINLINE bool IsActive() const { return bActive; }
+	FORCEINLINE const FLuaGCStats& GetStats() const { return Stats; }
+
+private:
+	static int64 GetUsedBytes(lua_State* L);
+
+	bool bActive;
+
+	// KB passed to LUA_GCSTEP
+	int32 StepSize;
+	// memory after the last tick, everything above it has been allocated in the meantime
+	int64 LastUsedBytes;
+	// KB of collector work not yet done (carried between frames when the budget is exhausted)
+	double Debt;
+	// memory after the last completed cycle (or the start)
+	int64 CycleUsedBytes;
+	// the collector was in generational mode before Start()
+	bool bRestoreGenerationalMode;
+
+	FLuaGCStats Stats;
+};
@@ -0,0 +1,125 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+
+/* the LUA_MASK* bit of a hook event (tail calls are calls, LuaJIT tail returns are returns) */
+FORCEINLINE int32 LuaHookEventToMask(const int Event)
+{
+	switch (Event)
+	{
+	case LUA_HOOKLINE:
+		return LUA_MASKLINE;
+	case LUA_HOOKCOUNT:
+		return LUA_MASKCOUNT;
+	case LUA_HOOKRET:
+#ifdef LUA_HOOKTAILRET
+	case LUA_HOOKTAILRET:
+#endif
+		return LUA_MASKRET;
+	default:
+		return LUA_MASKCALL;
+	}
+}
+
+/* identity of the function of a call/return hook event (the same for every call of the same closure or C function) */
+FORCEINLINE const void* LuaHookGetFunction(lua_State* L, lua_Debug* ar)
+{
+	lua_getinfo(L, "f", ar);
+	const void* Function = lua_topointer(L, -1);
+	lua_pop(L, 1);
+	return Function;
+}
+
+/**
+ * Interns the strings of the hook events (lua_Debug source and name) to integer ids, stable until Reset().
+ * The internal Lua string pointers are cached: the contents are converted and looked up only the first time a pointer is seen.
+ * A pointer can be reused by another string once its chunk is collected, so the pointer cache of every interner is flushed by
+ * Invalidate() (called when a LuaState loads a chunk or is closed).
+ */
+class LUAMACHINE_API FLuaHookStringInterner
+{
+public:
+	FLuaHookStringInterner();
+
+	/* INDEX_NONE for nullptr */
+	FORCEINLINE int32 Intern(const char* String)
+	{
+		if (Generation != GlobalGeneration)
+		{
+			Pointers.Reset();
+			Generation = GlobalGeneration;
+		}
+		if (const int32* Id = Pointers.Find(String))
+		{
+			return *Id;
+		}
+		return InternContents(String);
+	}
+
+	FORCEINLINE const FString& GetString(const int32 Id) const { return Strings[Id]; }
+	FORCEINLINE int32 Num() const { return Strings.Num(); }
+
+	void Reset();
+
+	static void Invalidate() { GlobalGeneration++; }
+
+private:
+	int32 InternContents(const char* String);
+
+	TMap<const char*, int32> Pointers;
+	TMap<FString, int32> Ids;
+	TArray<FString> Strings;
+	uint32 Generation;
+
+	static uint32 GlobalGeneration;
+};
+
+/**
+ * Native receiver of the Lua debug hook events (ULuaState::AddHookListener).
+ * The listener gets the raw lua_Debug and must call lua_getinfo() only for the fields it needs.
+ * Call ULuaState::UpdateHookMask() whenever GetHookMask()/GetHookCount() change.
+ * OnLuaHook() must not raise Lua errors and must not add or remove listeners.
+ */
+class LUAMACHINE_API ILuaHookListener
+{
+public:
+	virtual ~ILuaHookListener() {}
+
+	/* LUA_MASKLINE, LUA_MASKCALL, LUA_MASKRET and LUA_MASKCOUNT combination (0 for disabling the listener) */
+	virtual int32 GetHookMask() const = 0;
+
+	/* instructions between each LUA_HOOKCOUNT event */
+	virtual int32 GetHookCount() const { return 0; }
+
+	virtual void OnLuaHook(lua_State* L, lua_Debug* ar) = 0;
+};
+
+/* a listener attached to the hook with its cached mask/count */
+struct FLuaHookListenerEntry
+{
+	ILuaHookListener* Listener;
+	int32 HookMask;
+	int32 HookCount;
+	// instructions since the last LUA_HOOKCOUNT event delivered to the listener
+	int64 PendingInstructions;
+};
+
+/* forwards the hook events to the LuaState Blueprint events (ReceiveLuaLineHook, ReceiveLuaCallHook, ...) */
+class LUAMACHINE_API FLuaBlueprintHookListener : public ILuaHookListener
+{
+public:
+	FLuaBlueprintHookListener();
+
+	void Configure(const int32 InHookMask, const int32 InHookCount);
+
+	virtual int32 GetHookMask() const override { return HookMask; }
+	virtual int32 GetHookCount() const override { return HookCount; }
+	virtual void OnLuaHook(lua_State* L, lua_Debug* ar) override;
+
+private:
+	int32 HookMask;
+	int32 HookCount;
+};
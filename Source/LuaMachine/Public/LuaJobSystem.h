@@ -0,0 +1,113 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "Async/Future.h"
+#include "HAL/CriticalSection.h"
+#include "Templates/SubclassOf.h"
+
+class ULuaState;
+
+struct FLuaJobResult
+{
+	bool bSuccess = false;
+	FString Error;
+	/* return values of the job function (FLuaBinarySerializer format) */
+	TArray<uint8> Results;
+};
+
+/* everything needed for building a worker VM, collected on the game thread from the LuaState class defaults */
+struct FLuaWorkerConfig
+{
+	FString Name;
+	bool bLuaOpenLibs = true;
+	bool bLoadBase = true;
+	bool bLoadCoroutine = true;
+	bool bLoadTable = true;
+	bool bLoadIO = true;
+	bool bLoadOS = true;
+	bool bLoadString = true;
+	bool bLoadMath = true;
+	bool bLoadUTF8 = true;
+	bool bLoadDebug = false;
+	bool bAllowFFI = false;
+	/* replaces package.path when not empty */
+	FString PackagePath;
+	/* Content dir relative directories ("" is the Content dir) searched by require (bytecode manifest and pak aware) */
+	TArray<FString> ModuleDirs;
+	bool bPreferByteCodeManifest = true;
+	/* chunks (source or bytecode) executed in order when the VM is created (LuaCodeAsset and LuaFilename) */
+	TArray<TPair<FString, TArray<uint8>>> Chunks;
+	/* modules (RequireTable) exposed via package.preload */
+	TArray<TPair<FString, TArray<uint8>>> Modules;
+};
+
+/**
+ * Isolated (UObject free) Lua VMs running the code of a LuaState class, usable from any thread.
+ * A VM is used by a single job at a time, so the number of VMs follows the number of concurrent jobs (the task graph workers).
+ */
+class LUAMACHINE_API FLuaWorkerGroup
+{
+public:
+	FLuaWorkerGroup(const FLuaWorkerConfig& InConfig);
+	~FLuaWorkerGroup();
+
+	/* get an idle VM (or create a new one), returns nullptr on initialization errors */
+	lua_State* Acquire(FString& Error);
+	void Release(lua_State* L);
+
+	/* call FunctionName (a global or a dotted path like "pathfind.solve") with the serialized arguments */
+	FLuaJobResult RunJob(const FString& FunctionName, const uint8* Args, const int64 ArgsSize);
+
+	/* push the function at the dotted path FunctionName, returns false (with nothing pushed) if it is not a function */
+	static bool PushFunction(lua_State* L, const FString& FunctionName);
+
+	/* message handler for lua_pcall adding the traceback */
+	static int MessageHandler(lua_State* L);
+
+	int32 GetNumStates() const;
+
+	const FLuaWorkerConfig& GetConfig() const { return Config; }
+
+private:
+	lua_State* CreateState(FString& Error);
+
+	FLuaWorkerConfig Config;
+
+	mutable FCriticalSection Lock;
+	TArray<lua_State*> IdleStates;
+	int32 NumStates;
+};
+
+/**
+ * Runs Lua functions on the task graph workers using isolated VMs (one FLuaWorkerGroup per LuaState class).
+ * Arguments and results are moved between VMs with FLuaBinarySerializer, so only plain data is supported.
+ */
+class LUAMACHINE_API FLuaJobSystem
+{
+public:
+	/* run the job on a task graph worker (must be called from the game thread) */
+	TFuture<FLuaJobResult> Submit(TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<uint8> Args);
+
+	/* get (or create) the worker VMs of the specified LuaState class (must be called from the game thread) */
+	TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe> GetWorkerGroup(TSubclassOf<ULuaState> StateClass);
+
+	/**
+	 * call FunctionName(Input, Index) for each of the encoded Inputs (Offsets[i] is where the i-th input starts) on multiple worker VMs.
+	 * Inputs are split in chunks of ChunkSize (0 for automatic sizing) claimed by the workers as soon as they are idle,
+	 * the results (one value per input) are returned in the same order of the inputs.
+	 */
+	TFuture<FLuaJobResult> ParallelFor(TSubclassOf<ULuaState> StateClass, const FString& FunctionName, TArray<uint8> Inputs, TArray<int64> Offsets, const int32 ChunkSize = 0);
+
+	/* drop the worker VMs of the class, they will be recreated (with the current code) by the next job */
+	void ResetWorkerGroup(TSubclassOf<ULuaState> StateClass);
+
+	void Reset();
+
+	static FLuaWorkerConfig BuildWorkerConfig(TSubclassOf<ULuaState> StateClass);
+
+private:
+	TMap<TSubclassOf<ULuaState>, TSharedPtr<FLuaWorkerGroup, ESPMode::ThreadSafe>> WorkerGroups;
+};
@@ -6,7 +6,11 @@
 #include "Modules/ModuleManager.h"
 #include "UObject/GCObject.h"
 #include "LuaState.h"
+#include "LuaByteCodeManifest.h"
+#include "LuaCoverage.h"
 #include "HAL/IConsoleManager.h"
+#include "Containers/Ticker.h"
+#include "HAL/CriticalSection.h"
 
 DECLARE_MULTICAST_DELEGATE(FOnRegisteredLuaStatesChanged);
 DECLARE_MULTICAST_DELEGATE_OneParam(FOnNewLuaState, ULuaState*);
@@ -52,8 +56,46 @@ public:
 
 	virtual bool Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& Ar);
 
+	/* game thread only, the manifest is loaded at module startup */
+	const FLuaByteCodeManifest& GetByteCodeManifest();
+	/* the manifest can be retained by other threads (ReloadByteCodeManifest() replaces it) */
+	TSharedRef<const FLuaByteCodeManifest, ESPMode::ThreadSafe> GetSharedByteCodeManifest();
+	void ReloadByteCodeManifest();
+
+	/* ticks every registered LuaState (coroutine scheduler and per-frame work) */
+	bool Tick(float DeltaTime);
+
+	/* worker VMs used by ULuaState::RunJob() */
+	FLuaJobSystem& GetJobSystem() { return JobSystem; }
+
+	/* line coverage of all of the LuaStates */
+	FLuaCoverage& GetCoverage() { return Coverage; }
+
+	/* start/stop collecting the coverage (the hooks of the registered LuaStates are updated) */
+	void StartCoverage();
+	void StopCoverage();
+
+	/* accumulate the startup phases of a new LuaState in the stats of its class */
+	void AddStartupStats(ULuaState* LuaState, const FLuaStartupStats& Stats);
+	const TMap<FString, FLuaStartupClassStats>& GetStartupStatsByClass() const { return StartupStatsByClass; }
+	void ResetStartupStats();
+
 private:
 	TMap<TSubclassOf<ULuaState>, ULuaState*> LuaStates;
 	TArray<ULuaState*> LuaInstancedStates;
 	TSet<FString> LuaConsoleCommands;
+	TSharedPtr<FLuaByteCodeManifest, ESPMode::ThreadSafe> ByteCodeManifest;
+	// guards the replacement of ByteCodeManifest (worker threads retain it)
+	FCriticalSection ByteCodeManifestLock;
+	FLuaJobSystem JobSystem;
+	FLuaCoverage Coverage;
+	// LCOV file written at shutdown (-LuaCoverage command line switch)
+	FString CoverageFilename;
+	// keyed by class name
+	TMap<FString, FLuaStartupClassStats> StartupStatsByClass;
+#if ENGINE_MAJOR_VERSION > 4
+	FTSTicker::FDelegateHandle TickerHandle;
+#else
+	FDelegateHandle TickerHandle;
+#endif
 };
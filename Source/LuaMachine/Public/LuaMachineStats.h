@@ -0,0 +1,84 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "LuaValue.h"
+
+/* 'stat LuaMachine' */
+DECLARE_STATS_GROUP(TEXT("LuaMachine"), STATGROUP_LuaMachine, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("FromLuaValue"), STAT_LuaFromLuaValue, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("ToLuaValue"), STAT_LuaToLuaValue, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("UFunction __call"), STAT_LuaUFunctionCall, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("UFunction __rawcall"), STAT_LuaUFunctionRawCall, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("JSON conversion"), STAT_LuaJsonConversion, STATGROUP_LuaMachine, LUAMACHINE_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("FromLuaValue calls"), STAT_LuaFromLuaValueCalls, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("ToLuaValue calls"), STAT_LuaToLuaValueCalls, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted nil"), STAT_LuaConvertedNil, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted booleans"), STAT_LuaConvertedBool, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted numbers"), STAT_LuaConvertedNumber, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted strings"), STAT_LuaConvertedString, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted tables"), STAT_LuaConvertedTable, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted functions"), STAT_LuaConvertedFunction, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted threads"), STAT_LuaConvertedThread, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted UObjects"), STAT_LuaConvertedUObject, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted UFunctions"), STAT_LuaConvertedUFunction, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Converted delegates"), STAT_LuaConvertedDelegate, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("UFunction __call calls"), STAT_LuaUFunctionCalls, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("UFunction __rawcall calls"), STAT_LuaUFunctionRawCalls, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Userdata allocations"), STAT_LuaUserDataAllocations, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Metatable allocations"), STAT_LuaMetaTableAllocations, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Registry refs"), STAT_LuaRefs, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Registry unrefs"), STAT_LuaUnrefs, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("JSON conversions"), STAT_LuaJsonConversions, STATGROUP_LuaMachine, LUAMACHINE_API);
+
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("LuaStates"), STAT_LuaNumStates, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Memory (all LuaStates)"), STAT_LuaUsedMemory, STATGROUP_LuaMachine, LUAMACHINE_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Memory (largest LuaState)"), STAT_LuaMaxStateMemory, STATGROUP_LuaMachine, LUAMACHINE_API);
+
+#if STATS
+FORCEINLINE void LuaMachineStats_CountConversion(const ELuaValueType Type)
+{
+	switch (Type)
+	{
+	case ELuaValueType::Nil:
+		INC_DWORD_STAT(STAT_LuaConvertedNil);
+		break;
+	case ELuaValueType::Bool:
+		INC_DWORD_STAT(STAT_LuaConvertedBool);
+		break;
+	case ELuaValueType::Integer:
+	case ELuaValueType::Number:
+		INC_DWORD_STAT(STAT_LuaConvertedNumber);
+		break;
+	case ELuaValueType::String:
+		INC_DWORD_STAT(STAT_LuaConvertedString);
+		break;
+	case ELuaValueType::Table:
+		INC_DWORD_STAT(STAT_LuaConvertedTable);
+		break;
+	case ELuaValueType::Function:
+		INC_DWORD_STAT(STAT_LuaConvertedFunction);
+		break;
+	case ELuaValueType::Thread:
+		INC_DWORD_STAT(STAT_LuaConvertedThread);
+		break;
+	case ELuaValueType::UObject:
+		INC_DWORD_STAT(STAT_LuaConvertedUObject);
+		break;
+	case ELuaValueType::UFunction:
+		INC_DWORD_STAT(STAT_LuaConvertedUFunction);
+		break;
+	case ELuaValueType::MulticastDelegate:
+		INC_DWORD_STAT(STAT_LuaConvertedDelegate);
+		break;
+	default:
+		break;
+	}
+}
+#else
+FORCEINLINE void LuaMachineStats_CountConversion(const ELuaValueType Type) {}
+#endif
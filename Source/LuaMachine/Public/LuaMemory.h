@@ -0,0 +1,126 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "LuaMemory.generated.h"
+
+USTRUCT(BlueprintType)
+struct LUAMACHINE_API FLuaMemoryReport
+{
+	GENERATED_BODY()
+
+	/* Bytes used by the Lua VM (as reported by the collector) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 UsedBytes;
+
+	/* Highest number of bytes allocated by the VM (0 when the LuaMachine allocator is not available, like in LuaJIT builds) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 PeakBytes;
+
+	/* Live allocations of the VM */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 NumAllocations;
+
+	/* Estimated bytes of the reachable strings (heap walk) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 StringBytes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 TableBytes;
+
+	/* Closures and their upvalues (prototypes are accounted in OtherBytes) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 FunctionBytes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 UserDataBytes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 ThreadBytes;
+
+	/* UsedBytes not accounted by the heap walk (prototypes, internal structures, garbage not yet collected) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 OtherBytes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumStrings;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumTables;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumFunctions;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumUserData;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumThreads;
+
+	/* Entries of the Lua registry */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 RegistrySize;
+
+	/* Registry references held by C++ (LuaValues holding tables, functions and threads) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumLuaValueRefs;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int32 NumTrackedUserDataObjects;
+
+	/* The heap walk stopped before visiting every object (Lua stack exhausted) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	bool bTruncated;
+
+	FLuaMemoryReport()
+		: UsedBytes(0)
+		, PeakBytes(0)
+		, NumAllocations(0)
+		, StringBytes(0)
+		, TableBytes(0)
+		, FunctionBytes(0)
+		, UserDataBytes(0)
+		, ThreadBytes(0)
+		, OtherBytes(0)
+		, NumStrings(0)
+		, NumTables(0)
+		, NumFunctions(0)
+		, NumUserData(0)
+		, NumThreads(0)
+		, RegistrySize(0)
+		, NumLuaValueRefs(0)
+		, NumTrackedUserDataObjects(0)
+		, bTruncated(false)
+	{
+	}
+};
+
+/* counters updated by the LuaMachine allocator */
+struct LUAMACHINE_API FLuaAllocatorStats
+{
+	int64 UsedBytes = 0;
+	int64 PeakBytes = 0;
+	int64 NumAllocations = 0;
+	// allocations since the creation of the VM
+	int64 TotalAllocations = 0;
+};
+
+/**
+ * Lua VMs allocating from FMemory under the LuaMachine LLM tag, optionally counting their memory.
+ * LuaJIT (whose 64 bit builds do not support custom allocators) always uses its own allocator.
+ */
+class LUAMACHINE_API FLuaAllocator
+{
+public:
+	/* create a VM (Stats, if not null, must live longer than the VM) */
+	static lua_State* NewState(FLuaAllocatorStats* Stats = nullptr);
+
+	/* fill the per type fields of the report walking every object reachable from the registry (game thread, no Lua code is run) */
+	static void WalkHeap(lua_State* L, FLuaMemoryReport& Report);
+
+private:
+	static void* Alloc(void* UserData, void* Ptr, size_t OldSize, size_t NewSize);
+	static int Panic(lua_State* L);
+};
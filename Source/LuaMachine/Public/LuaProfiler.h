@@ -0,0 +1,92 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "LuaHookListener.h"
+
+/* a Lua function as seen by the profiler */
+struct LUAMACHINE_API FLuaProfilerFrame
+{
+	FString Name;
+	FString Source;
+	int32 Line;
+};
+
+/**
+ * Sampling profiler driven by the count hook: every SampleInterval instructions the Lua call stack is captured.
+ * Functions are interned to integer ids and the stacks are stored in a preallocated ring buffer, so taking a sample does not allocate
+ * (only the first sample hitting a function does). Samples can be exported as collapsed stacks (flamegraph.pl, inferno) or speedscope json.
+ */
+class LUAMACHINE_API FLuaProfiler : public ILuaHookListener
+{
+public:
+	FLuaProfiler();
+
+	/* allocate the ring buffer (the oldest samples are overwritten when it is full) and start accepting samples */
+	void Start(const int32 InSampleInterval, const int32 InMaxSamples, const int32 InMaxDepth = 64);
+	void Stop();
+
+	/* forget the samples and the interned frames */
+	void Reset();
+
+	/* capture the call stack of L (called from the count hook) */
+	void Sample(lua_State* L);
+
+	virtual int32 GetHookMask() const override { return bActive ? LUA_MASKCOUNT : 0; }
+	virtual int32 GetHookCount() const override { return SampleInterval; }
+	virtual void OnLuaHook(lua_State* L, lua_Debug* ar) override { Sample(L); }
+
+	FORCEINLINE bool IsActive() const { return bActive; }
+	FORCEINLINE int32 GetSampleInterval() const { return SampleInterval; }
+	FORCEINLINE int32 GetNumSamples() const { return NumSamples; }
+	FORCEINLINE int64 GetNumDroppedSamples() const { return NumDroppedSamples; }
+	FORCEINLINE const TArray<FLuaProfilerFrame>& GetFrames() const { return Frames; }
+
+	/* call the visitor for each sample (oldest first) with the frame ids from the root to the leaf */
+	void ForEachSample(TFunctionRef<void(const int32* FrameIds, const int32 Depth)> Visitor) const;
+
+	/* "root;child;leaf count" lines */
+	FString ExportCollapsed() const;
+
+	/* speedscope sampled profile (https://www.speedscope.app/) */
+	FString ExportSpeedscope(const FString& ProfileName) const;
+
+private:
+	struct FFrameKey
+	{
+		int32 SourceId;
+		// C functions share the same source, so the name is the only way to distinguish them
+		int32 NameId;
+		int32 LineDefined;
+
+		bool operator==(const FFrameKey& Other) const
+		{
+			return SourceId == Other.SourceId && NameId == Other.NameId && LineDefined == Other.LineDefined;
+		}
+
+		friend uint32 GetTypeHash(const FFrameKey& Key)
+		{
+			return HashCombine(HashCombine(GetTypeHash(Key.SourceId), GetTypeHash(Key.NameId)), GetTypeHash(Key.LineDefined));
+		}
+	};
+
+	int32 InternFrame(const lua_Debug& Debug);
+
+	bool bActive;
+	int32 SampleInterval;
+
+	int32 MaxSamples;
+	int32 MaxDepth;
+	// MaxSamples * MaxDepth frame ids (leaf first)
+	TArray<int32> SampleFrames;
+	TArray<uint16> SampleDepths;
+	int32 NextSample;
+	int32 NumSamples;
+	int64 NumDroppedSamples;
+
+	FLuaHookStringInterner Strings;
+	TMap<FFrameKey, int32> FrameIds;
+	TArray<FLuaProfilerFrame> Frames;
+};
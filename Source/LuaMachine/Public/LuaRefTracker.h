@@ -0,0 +1,100 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+
+/* where a registry reference has been created */
+struct LUAMACHINE_API FLuaRefSite
+{
+	/* program counters (innermost first) */
+	TArray<uint64> BackTrace;
+	/* Blueprint function and script offset, empty when not called by a Blueprint */
+	FString Blueprint;
+	/* "chunkname:currentline:" of the innermost running Lua function, empty when not called by Lua */
+	FString Lua;
+
+	bool operator==(const FLuaRefSite& Other) const
+	{
+		return BackTrace == Other.BackTrace && Blueprint == Other.Blueprint && Lua == Other.Lua;
+	}
+
+	friend uint32 GetTypeHash(const FLuaRefSite& Site)
+	{
+		uint32 Hash = HashCombine(GetTypeHash(Site.Blueprint), GetTypeHash(Site.Lua));
+		for (const uint64 ProgramCounter : Site.BackTrace)
+		{
+			Hash = HashCombine(Hash, GetTypeHash(ProgramCounter));
+		}
+		return Hash;
+	}
+};
+
+/* the live references at a given time (serial -> site id) */
+struct LUAMACHINE_API FLuaRefSnapshot
+{
+	double Time;
+	TMap<uint64, int32> Refs;
+};
+
+/**
+ * Opt-in tracker of the references held in the Lua registry (ULuaState::NewRef/Unref).
+ * Each live reference records the C++ callstack, Blueprint function and Lua line that created it, its Lua type and its creation time,
+ * so the holders of leaked tables/functions/threads can be found by dumping the sites with more live references or by diffing snapshots.
+ * References created before Start() are not known to the tracker.
+ */
+class LUAMACHINE_API FLuaRefTracker
+{
+public:
+	FLuaRefTracker();
+
+	/* start recording (previous records and snapshots are discarded), StackDepth is the number of C++ frames captured per reference */
+	void Start(const int32 InStackDepth = 12);
+	void Stop();
+	void Reset();
+
+	/* called with the referenced value on top of the stack of L, before luaL_ref() */
+	void OnRef(lua_State* L, const int Ref);
+	void OnUnref(const int Ref);
+
+	/* save the current live references, returns the snapshot index */
+	int32 TakeSnapshot();
+
+	/* log the NumSites sites holding more live references */
+	void Dump(FOutputDevice& Ar, const int32 NumSites) const;
+
+	/* log the sites whose live references changed between two snapshots (INDEX_NONE for the current live references) */
+	void Diff(FOutputDevice& Ar, const int32 SnapshotA, const int32 SnapshotB, const int32 NumSites) const;
+
+	FORCEINLINE bool IsActive() const { return bActive; }
+	FORCEINLINE int32 GetNumRefs() const { return Refs.Num(); }
+	FORCEINLINE int32 GetNumSnapshots() const { return Snapshots.Num(); }
+
+private:
+	struct FRefRecord
+	{
+		uint64 Serial;
+		double Time;
+		int32 LuaType;
+		int32 SiteId;
+	};
+
+	int32 InternSite(FLuaRefSite&& Site);
+
+	void LogSite(FOutputDevice& Ar, const int32 SiteId) const;
+
+	FLuaRefSnapshot GetLiveSnapshot() const;
+
+	bool bActive;
+	int32 StackDepth;
+	uint64 NextSerial;
+
+	// registry index -> record
+	TMap<int, FRefRecord> Refs;
+
+	TMap<FLuaRefSite, int32> SiteIds;
+	TArray<FLuaRefSite> Sites;
+
+	TArray<FLuaRefSnapshot> Snapshots;
+};
@@ -0,0 +1,126 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaStartupStats.generated.h"
+
+USTRUCT(BlueprintType)
+struct LUAMACHINE_API FLuaStartupPhase
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	FString Name;
+
+	/* Milliseconds spent in the phase */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float Time;
+
+	/* Growth of the VM memory during the phase */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 Bytes;
+
+	/* Allocations made by the VM during the phase (0 when the LuaMachine allocator is not available, like in LuaJIT builds) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 Allocations;
+
+	FLuaStartupPhase()
+		: Time(0)
+		, Bytes(0)
+		, Allocations(0)
+	{
+	}
+};
+
+USTRUCT(BlueprintType)
+struct LUAMACHINE_API FLuaStartupStats
+{
+	GENERATED_BODY()
+
+	/* Phases of ULuaState::GetLuaState() in execution order */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	TArray<FLuaStartupPhase> Phases;
+
+	/* Total milliseconds */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	float Time;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 Bytes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Lua")
+	int64 Allocations;
+
+	FLuaStartupStats()
+		: Time(0)
+		, Bytes(0)
+		, Allocations(0)
+	{
+	}
+
+	void AddPhase(const FString& Name, const float PhaseTime, const int64 PhaseBytes, const int64 PhaseAllocations)
+	{
+		FLuaStartupPhase Phase;
+		Phase.Name = Name;
+		Phase.Time = PhaseTime;
+		Phase.Bytes = PhaseBytes;
+		Phase.Allocations = PhaseAllocations;
+		Phases.Add(Phase);
+		Time += PhaseTime;
+		Bytes += PhaseBytes;
+		Allocations += PhaseAllocations;
+	}
+
+	/* "Phase 1.23 ms 45 KB, ..." */
+	FString ToString() const
+	{
+		FString Text;
+		for (const FLuaStartupPhase& Phase : Phases)
+		{
+			Text += FString::Printf(TEXT("%s%s %.2f ms %lld KB"), Text.IsEmpty() ? TEXT("") : TEXT(", "), *Phase.Name, Phase.Time, Phase.Bytes / 1024);
+		}
+		return Text;
+	}
+};
+
+/* startup stats of all of the LuaStates of a class (phases are summed) */
+struct FLuaStartupClassStats
+{
+	int32 NumStates = 0;
+	float MaxTime = 0;
+	FLuaStartupStats Total;
+
+	void Add(const FLuaStartupStats& Stats)
+	{
+		NumStates++;
+		MaxTime = FMath::Max(MaxTime, Stats.Time);
+		for (const FLuaStartupPhase& Phase : Stats.Phases)
+		{
+			FLuaStartupPhase* TotalPhase = Total.Phases.FindByPredicate([&Phase](const FLuaStartupPhase& Item) { return Item.Name == Phase.Name; });
+			if (!TotalPhase)
+			{
+				TotalPhase = &Total.Phases.AddDefaulted_GetRef();
+				TotalPhase->Name = Phase.Name;
+			}
+			TotalPhase->Time += Phase.Time;
+			TotalPhase->Bytes += Phase.Bytes;
+			TotalPhase->Allocations += Phase.Allocations;
+		}
+		Total.Time += Stats.Time;
+		Total.Bytes += Stats.Bytes;
+		Total.Allocations += Stats.Allocations;
+	}
+
+	/* per state averages */
+	FLuaStartupStats GetAverage() const
+	{
+		FLuaStartupStats Average;
+		const int32 Divisor = FMath::Max(NumStates, 1);
+		for (const FLuaStartupPhase& Phase : Total.Phases)
+		{
+			Average.AddPhase(Phase.Name, Phase.Time / Divisor, Phase.Bytes / Divisor, Phase.Allocations / Divisor);
+		}
+		return Average;
+	}
+};
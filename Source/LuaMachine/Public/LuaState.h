@@ -4,11 +4,23 @@
 
 #include "CoreMinimal.h"
 #include "Engine/Blueprint.h"
-#include "ThirdParty/lua/lua.hpp"
+#include "LuaCompat.h"
 #include "LuaValue.h"
 #include "LuaCode.h"
 #include "LuaDelegate.h"
 #include "LuaCommandExecutor.h"
+#include "LuaCoroutineScheduler.h"
+#include "LuaThreadPool.h"
+#include "LuaGCScheduler.h"
+#include "LuaJobSystem.h"
+#include "LuaMemory.h"
+#include "LuaCommandQueue.h"
+#include "LuaHookListener.h"
+#include "LuaProfiler.h"
+#include "LuaStartupStats.h"
+#include "LuaFunctionStats.h"
+#include "LuaRefTracker.h"
+#include "LuaTrace.h"
 #include "Runtime/Core/Public/Containers/Queue.h"
 #include "Runtime/Launch/Resources/Version.h"
 #include "Runtime/Online/HTTP/Public/Http.h"
@@ -23,6 +35,19 @@ LUAMACHINE_API DECLARE_LOG_CATEGORY_EXTERN(LogLuaMachine, Log, All);
 DECLARE_DYNAMIC_DELEGATE_ThreeParams(FLuaHttpSuccess, FLuaValue, ReturnValue, bool, bWasSuccessful, int32, StatusCode);
 DECLARE_DYNAMIC_DELEGATE_TwoParams(FLuaHttpResponseReceived, FLuaValue, Context, FLuaValue, Response);
 DECLARE_DYNAMIC_DELEGATE_OneParam(FLuaHttpError, FLuaValue, Context);
+/* code read and compiled by a worker thread for RunFileAsync()/RunCodeAssetAsync() */
+struct FLuaLoadedChunk
+{
+	bool bFound = true;
+	FString CodePath;
+	TArray<uint8> ByteCode;
+	FString Error;
+};
+
+/* called on the game thread when the code loaded by RunFileAsync()/RunCodeAssetAsync() has been executed */
+typedef TFunction<void(bool bSuccess, const FLuaValue& ReturnValue)> FLuaRunAsyncCompletion;
+
+DECLARE_DYNAMIC_DELEGATE_ThreeParams(FLuaJobCompleted, const TArray<FLuaValue>&, ReturnValues, bool, bSuccess, const FString&, Error);
 
 struct FLuaUserData
 {
@@ -200,6 +225,50 @@ public:
 	UPROPERTY(EditAnywhere, meta = (DisplayName = "UserData MetaTable from CodeAsset"), Category = "Lua")
 	ULuaCode* UserDataMetaTableFromCodeAsset;
 
+	/* Run the precompiled bytecode (generated by the LuaCompile commandlet) of Content/ scripts when available */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bPreferByteCodeManifest;
+
+	/* Automatically hot reload required modules when their script file or LuaCode asset is modified (editor only) */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bHotReloadModules;
+
+	/* Expose the spawn(), wait(), wait_frames(), wait_event() and signal() global functions for running coroutines natively each frame (timers use the world time when available, so they honor pause and time dilation) */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bEnableCoroutineScheduler;
+
+	/* Maximum time (in milliseconds) spent resuming scheduled coroutines each frame (0 for no limit) */
+	UPROPERTY(EditAnywhere, Category = "Lua", meta = (EditCondition = "bEnableCoroutineScheduler", ClampMin = "0"))
+	float CoroutineSchedulerBudget;
+
+	/* Maximum number of finished coroutines kept for reuse by CreateLuaThread(), spawn() and coroutine.acquire() (0 disables pooling) */
+	UPROPERTY(EditAnywhere, Category = "Lua", meta = (ClampMin = "0"))
+	int32 LuaThreadPoolSize;
+
+	/* Allow scripts to require the LuaJIT ffi module (only when the plugin is built with LuaJIT), it gives unrestricted access to native memory and functions */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bAllowLuaJITFFI;
+
+	/* Use the generational garbage collector (only when the plugin is built with Lua 5.4) */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bGenerationalGC;
+
+	/* Stop the automatic garbage collector and run it incrementally once per frame, following the allocation rate (ignored in commandlets, a LuaState not ticked by the game thread must call GCRestart()) */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bEnableGCStepping;
+
+	/* Maximum time (in milliseconds) spent in the garbage collector each frame (0 for no limit) */
+	UPROPERTY(EditAnywhere, Category = "Lua", meta = (EditCondition = "bEnableGCStepping", ClampMin = "0"))
+	float GCStepBudget;
+
+	/* Initial size (in KB) of each incremental step, it is automatically adapted to the budget */
+	UPROPERTY(EditAnywhere, Category = "Lua", meta = (EditCondition = "bEnableGCStepping", ClampMin = "1"))
+	int32 GCStepSize;
+
+	/* Maximum time (in milliseconds) spent each frame executing calls queued from other threads (0 for no limit) */
+	UPROPERTY(EditAnywhere, Category = "Lua", meta = (ClampMin = "0"))
+	float CommandQueueBudget;
+
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	FLuaValue CreateObject(UObject* InObject);
 
@@ -263,12 +332,89 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	FLuaValue RunCodeAsset(ULuaCode* CodeAsset);
 
+	/* Read and compile the file on a worker thread, only the execution of the bytecode happens on the game thread */
+	void RunFileAsync(const FString& Filename, const bool bIgnoreNonExistent, FLuaRunAsyncCompletion Completion);
+
+	void RunNonContentFileAsync(const FString& Filename, const bool bIgnoreNonExistent, FLuaRunAsyncCompletion Completion);
+
+	/* Compile the code asset on a worker thread (cooked bytecode is directly executed on the next tick) */
+	void RunCodeAssetAsync(ULuaCode* CodeAsset, FLuaRunAsyncCompletion Completion);
+
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	FLuaValue RunByteCode(const TArray<uint8>& ByteCode, const FString& CodePath);
 
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	FLuaValue RunString(const FString& CodeString, FString CodePath = "");
 
+	/* Re-run a module loaded with require() and patch package.loaded in place (tables identity and upvalues are preserved) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	bool HotReloadModule(const FString& ModuleName);
+
+	/* Hot reload every module loaded from the specified Content/ relative file, returns the number of reloaded modules */
+	int32 HotReloadFile(const FString& Filename);
+
+	/* Hot reload every module loaded from the specified LuaCode asset, returns the number of reloaded modules */
+	int32 HotReloadCodeAsset(ULuaCode* CodeAsset);
+
+	FORCEINLINE const TMap<FString, FString>& GetLoadedModules() const { return LoadedModules; }
+
+	/* Start a coroutine managed by the scheduler, returns the Lua thread (nil if bEnableCoroutineScheduler is disabled) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	FLuaValue SpawnCoroutine(FLuaValue Function, TArray<FLuaValue> Args);
+
+	/* Wake up all the scheduled coroutines waiting for the event, returns the number of woken coroutines */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	int32 SignalCoroutineEvent(const FString& EventName, TArray<FLuaValue> Args);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	int32 GetNumScheduledCoroutines() const { return CoroutineScheduler.Num(); }
+
+	/* Called once per frame by the LuaMachine module */
+	virtual void TickLuaState(float DeltaTime);
+
+	FORCEINLINE FLuaCoroutineScheduler& GetCoroutineScheduler() { return CoroutineScheduler; }
+
+	/* The queue can be retained by other threads, calls enqueued after the LuaState is destroyed fail (their completion gets bSuccess=false) */
+	FORCEINLINE TSharedRef<FLuaCommandQueue, ESPMode::ThreadSafe> GetCommandQueue() const { return CommandQueue.ToSharedRef(); }
+
+	/* Thread-safe: FunctionName (a global or a dotted path) will be called with the encoded Args on the next tick */
+	void EnqueueCall(const FString& FunctionName, TArray<uint8> Args, FLuaQueuedCallCompletion Completion = nullptr);
+
+	/* Execute the calls queued before this call until they are done or the Budget (in seconds, 0 for no limit) is spent, returns the number of executed calls */
+	int32 ExecuteQueuedCalls(const double Budget);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	int32 GetNumQueuedCalls() const { return CommandQueue->GetNumPending(); }
+
+	FORCEINLINE FLuaThreadPool& GetLuaThreadPool() { return LuaThreadPool; }
+
+	/* Give back a finished thread to the pool, the thread must not be used anymore after this call */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	bool ReleaseLuaThread(FLuaValue Value);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	int32 GetNumPooledLuaThreads() const { return LuaThreadPool.Num(); }
+
+	/* Encode plain data values (nil, booleans, numbers, strings and tables of them) for moving them to another Lua VM/thread */
+	bool SerializeLuaValues(const TArray<FLuaValue>& Values, TArray<uint8>& Data, TArray<int64>* Offsets = nullptr);
+
+	/* Decode values encoded by SerializeLuaValues() (or by a worker VM) in this LuaState */
+	bool DeserializeLuaValues(const TArray<uint8>& Data, TArray<FLuaValue>& Values);
+
+	/* Run the function (a global or a dotted path) on a worker VM loading the code of this LuaState class */
+	TFuture<FLuaJobResult> RunJob(const FString& FunctionName, const TArray<FLuaValue>& Args);
+
+	/* Like RunJob() but the results are decoded in this LuaState and passed to Completed on the game thread */
+	void RunJobAsync(const FString& FunctionName, const TArray<FLuaValue>& Args, FLuaJobCompleted Completed);
+
+	/* Call FunctionName(Input, Index) for every input, splitting them in chunks over multiple worker VMs (results are in the inputs order) */
+	TFuture<FLuaJobResult> ParallelFor(const FString& FunctionName, const TArray<FLuaValue>& Inputs, const int32 ChunkSize = 0);
+
+	void ParallelForAsync(const FString& FunctionName, const TArray<FLuaValue>& Inputs, const int32 ChunkSize, FLuaJobCompleted Completed);
+
+	/* Load the standard libraries in a new VM (shared by LuaStates and worker VMs) */
+	static void LoadLuaLibs(lua_State* L, const bool bOpenLibs, const FLuaLibsLoader& LibsLoader, const bool bAllowFFI);
+
 	/* Make an HTTP GET request to the specified URL to download the Lua script to run */
 	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Headers"), Category = "Lua")
 	void RunURL(UObject* WorldContextObject, const FString& URL, TMap<FString, FString> Headers, const FString& SecurityHeader, const FString& SignaturePublicExponent, const FString& SignatureModulus, FLuaHttpSuccess Completed);
@@ -280,15 +426,39 @@ public:
 	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
 	int32 GetUsedMemory();
 
+	/* Memory of the VM split by Lua type (estimated walking the heap, that can be slow with big states) and references held by C++ */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	FLuaMemoryReport GetMemoryReport(const bool bWalkHeap = true);
+
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	void GCCollect();
 
+	/* Stop the garbage collector (including the per-frame stepping) */
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	void GCStop();
 
+	/* Restart the automatic garbage collector (the per-frame stepping is disabled) */
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	void GCRestart();
 
+	/* Stop the automatic garbage collector and run it incrementally once per frame (the collector will not run at all if the game thread does not tick) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void GCStartStepping();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	FLuaGCStats GetGCStats() const { return GCScheduler.GetStats(); }
+
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void ResetGCStats();
+
+	/* Time and memory of each phase of the VM creation (open libs, package paths, Table, Blueprint packages, scripts and LuaStateInit) */
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	FLuaStartupStats GetStartupStats() const { return StartupStats; }
+
+	/* Log the startup phases when the VM creation takes longer than the specified milliseconds (negative for never) */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	float StartupLogThreshold = 50;
+
 	UFUNCTION(BlueprintCallable, Category = "Lua")
 	FLuaValue TableAssetToLuaTable(ULuaTableAsset* TableAsset);
 
@@ -375,6 +545,105 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (EditCondition = "bEnableCountHook"))
 	int32 HookInstructionCount = 25000;
 
+	/* Limit the time/instructions of each PCall/Resume: coroutines exceeding it are yielded (and resumed by the scheduler in the next frame), plain calls fail with a timeout error */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bEnableExecutionBudget;
+
+	/* Maximum milliseconds of a single PCall/Resume (0 for no limit) */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (EditCondition = "bEnableExecutionBudget", ClampMin = "0"))
+	float ExecutionTimeBudget = 50;
+
+	/* Maximum Lua instructions of a single PCall/Resume (0 for no limit) */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (EditCondition = "bEnableExecutionBudget", ClampMin = "0"))
+	int32 ExecutionInstructionBudget = 0;
+
+	/* Number of instructions between each budget check */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (EditCondition = "bEnableExecutionBudget", ClampMin = "1"))
+	int32 ExecutionBudgetCheckInterval = 1000;
+
+	/* Emit an Unreal Insights scope (LuaMachine trace channel) for each Lua function call, it uses the call/return hook so it is expensive */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bTraceLuaFunctions;
+
+	/* Number of instructions between each sample of the profiler */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (ClampMin = "1"))
+	int32 ProfilerSampleInterval = 1000;
+
+	/* Size of the profiler ring buffer, the oldest samples are overwritten when it is full (it takes ProfilerMaxSamples * ProfilerMaxDepth * 4 bytes) */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (ClampMin = "1"))
+	int32 ProfilerMaxSamples = 20000;
+
+	/* Maximum number of frames stored for each sample (the root frames of deeper stacks are truncated) */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (ClampMin = "2", ClampMax = "65535"))
+	int32 ProfilerMaxDepth = 32;
+
+	/* Start sampling the Lua call stacks (previous samples are discarded) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void StartProfiler();
+
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void StopProfiler();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	bool IsProfilerActive() const { return Profiler.IsActive(); }
+
+	/* Save the samples as collapsed stacks (for flamegraph.pl/inferno) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	bool SaveProfilerCollapsed(const FString& Filename);
+
+	/* Save the samples as a speedscope (https://www.speedscope.app/) profile */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	bool SaveProfilerSpeedscope(const FString& Filename);
+
+	FORCEINLINE const FLuaProfiler& GetProfiler() const { return Profiler; }
+
+	/* Number of C++ frames captured for each registry reference by the ref tracker */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (ClampMin = "0", ClampMax = "64"))
+	int32 RefTrackerStackDepth = 12;
+
+	/* Start recording where the registry references (tables, functions and threads held by LuaValues) are created, previous records are discarded */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void StartRefTracker();
+
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void StopRefTracker();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Lua")
+	bool IsRefTrackerActive() const { return RefTracker.IsActive(); }
+
+	FORCEINLINE FLuaRefTracker& GetRefTracker() { return RefTracker; }
+
+	/* Count calls and inclusive/exclusive time of each Lua function (using the call/return hooks) */
+	UPROPERTY(EditAnywhere, Category = "Lua")
+	bool bEnableFunctionStats;
+
+	/* Maximum number of distinct functions tracked by the function stats */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (EditCondition = "bEnableFunctionStats", ClampMin = "16"))
+	int32 FunctionStatsTableSize = 1024;
+
+	/* Seconds between each reset of the function stats (0 for every frame, negative for never resetting them) */
+	UPROPERTY(EditAnywhere, Category = "Lua", Meta = (EditCondition = "bEnableFunctionStats"))
+	float FunctionStatsResetInterval = 0;
+
+	/* The Count Lua functions with the highest exclusive time in the last completed interval (or since the last reset if FunctionStatsResetInterval is negative) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	TArray<FLuaFunctionStat> GetTopLuaFunctions(const int32 Count = 10) const;
+
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void ResetFunctionStats();
+
+	/* Attach a native hook listener, it must be removed before being destroyed */
+	void AddHookListener(ILuaHookListener* Listener);
+
+	void RemoveHookListener(ILuaHookListener* Listener);
+
+	/* Apply the hooks related properties (useful when changing them at runtime) */
+	UFUNCTION(BlueprintCallable, Category = "Lua")
+	void UpdateHookMask();
+
+	void BeginExecutionBudget(lua_State* Thread);
+	void EndExecutionBudget();
+
 	UPROPERTY()
 	TMap<FString, ULuaBlueprintPackage*> LuaBlueprintPackages;
 
@@ -484,6 +753,7 @@ public:
 	static int MetaTableFunctionUserData__eq(lua_State* L);
 	static int MetaTableFunctionUserData__gc(lua_State* L);
 
+	UE_DEPRECATED(5.3, "Use FLuaByteCodeCompiler::Writer instead.")
 	static int ToByteCode_Writer(lua_State* L, const void* Ptr, size_t Size, void* UserData);
 
 	static void Debug_Hook(lua_State* L, lua_Debug* ar);
@@ -600,10 +870,70 @@ protected:
 	TMap<TWeakObjectPtr<UObject>, FLuaDelegateGroup> LuaDelegatesMap;
 
 	FLuaCommandExecutor LuaConsole;
+
+	FLuaCoroutineScheduler CoroutineScheduler;
+	// world time of the last scheduler tick (negative before the first one)
+	double CoroutineSchedulerWorldTime;
+
+	FLuaThreadPool LuaThreadPool;
+
+	FLuaGCScheduler GCScheduler;
+
+	FLuaProfiler Profiler;
+
+	FLuaRefTracker RefTracker;
+
+	FLuaFunctionStats FunctionStats;
+
+	FLuaAllocatorStats AllocatorStats;
+
+	FLuaStartupStats StartupStats;
+
+	// live registry references created by NewRef()
+	int32 NumLuaValueRefs;
+
+	FLuaTrace LuaTrace;
+
+	TSharedPtr<FLuaCommandQueue, ESPMode::ThreadSafe> CommandQueue;
+
+	void ExecuteQueuedCall(FLuaQueuedCall& QueuedCall);
+
+	// the instructions between each count hook call
+	int32 HookCountInterval;
+
+	// listeners attached with AddHookListener()
+	TArray<ILuaHookListener*> HookListeners;
+	// listeners (builtin ones included) receiving events, rebuilt by UpdateHookMask()
+	TArray<FLuaHookListenerEntry> ActiveHookListeners;
+
+	FLuaBlueprintHookListener BlueprintHookListener;
+
+	void DispatchHook(lua_State* State, lua_Debug* ar);
+
+	int32 ExecutionBudgetDepth;
+	// the only thread allowed to be yielded by the budget check
+	lua_State* ExecutionBudgetThread;
+	double ExecutionBudgetDeadline;
+	int64 ExecutionBudgetInstructions;
+
+	bool CheckExecutionBudget();
+
+	/* module name -> Content/ relative filename or LuaCode asset path */
+	TMap<FString, FString> LoadedModules;
+
+	void TrackLoadedModule(const FString& ModuleName, const FString& Source);
 private:
 	bool _RunFile(const FString& Filename, bool bIgnoreNonExistent, int NRet = 0, bool bNonContentDirectory = false);
+	/* the Content/ relative file exists or has been precompiled (the source may not be shipped) */
+	bool ModuleFileExists(const FString& Filename) const;
 	bool _RunCodeAsset(ULuaCode* CodeAsset, int NRet = 0);
 
+	void _RunFileAsync(const FString& Filename, const bool bIgnoreNonExistent, const bool bNonContentDirectory, FLuaRunAsyncCompletion Completion);
+	void _RunLoadedChunkAsync(TFunction<FLuaLoadedChunk()> LoadChunk, const bool bIgnoreNonExistent, FLuaRunAsyncCompletion Completion);
+	void RunLoadedChunk(const FLuaLoadedChunk& Chunk, const bool bIgnoreNonExistent, const FLuaRunAsyncCompletion& Completion);
+
+	void CompleteJobOnGameThread(TFuture<FLuaJobResult>&& Future, FLuaJobCompleted Completed);
+
 	static void HttpRequestDone(FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful, ULuaState* LuaState, TWeakObjectPtr<UWorld> World, const FString SecurityHeader, const FString SignaturePublicExponent, const FString SignatureModulus, FLuaHttpSuccess Completed);
 	static void HttpGenericRequestDone(FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful, TWeakPtr<FLuaSmartReference> Context, FLuaHttpResponseReceived ResponseReceived, FLuaHttpError Error);
 
@@ -0,0 +1,49 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+
+struct FLuaPooledThread
+{
+	lua_State* Thread;
+	int ThreadRef;
+};
+
+/**
+ * Keeps finished Lua threads (coroutines) alive for reusing them instead of allocating new ones.
+ * Lua code can use coroutine.acquire(fn) and coroutine.release(co).
+ */
+class LUAMACHINE_API FLuaThreadPool
+{
+public:
+	FLuaThreadPool();
+
+	/* register the pool functions in the (coroutine) table on top of the stack */
+	static void RegisterLuaFunctions(lua_State* L);
+
+	/* true if the thread completed its function without errors (and its stack is empty) */
+	static bool IsFinished(lua_State* Thread);
+
+	/* push a thread (recycled if available) on the stack */
+	lua_State* Acquire(lua_State* L);
+
+	/* put the finished thread at the specified index in the pool, returns false if it cannot be reused */
+	bool Release(lua_State* L, int Index);
+
+	/* drop every thread without touching the Lua VM (must be called before closing it) */
+	void Reset();
+
+	FORCEINLINE void SetMaxSize(const int32 InMaxSize) { MaxSize = InMaxSize; }
+	FORCEINLINE int32 Num() const { return Threads.Num(); }
+	FORCEINLINE uint64 GetNumCreated() const { return NumCreated; }
+	FORCEINLINE uint64 GetNumReused() const { return NumReused; }
+
+private:
+	TArray<FLuaPooledThread> Threads;
+	int32 MaxSize;
+
+	uint64 NumCreated;
+	uint64 NumReused;
+};
@@ -0,0 +1,74 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaCompat.h"
+#include "LuaHookListener.h"
+
+#if ENGINE_MAJOR_VERSION > 4 || ENGINE_MINOR_VERSION >= 26
+#include "Trace/Trace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#define LUAMACHINE_TRACE_ENABLED CPUPROFILERTRACE_ENABLED
+#else
+#define LUAMACHINE_TRACE_ENABLED 0
+#endif
+
+#if LUAMACHINE_TRACE_ENABLED
+/* enable it with -trace=cpu,LuaMachine (or 'Trace.Enable LuaMachine') */
+UE_TRACE_CHANNEL_EXTERN(LuaMachineChannel, LUAMACHINE_API);
+
+#define LUAMACHINE_TRACE_SCOPE(Name) TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(Name, LuaMachineChannel)
+#define LUAMACHINE_TRACE_IS_ENABLED() UE_TRACE_CHANNELEXPR_IS_ENABLED(LuaMachineChannel)
+#else
+#define LUAMACHINE_TRACE_SCOPE(Name)
+#define LUAMACHINE_TRACE_IS_ENABLED() false
+#endif
+
+/**
+ * Insights events for the Lua side of the frame: a timing scope for each Lua function call (driven by the call/return hook)
+ * and the memory/GC counters of the LuaStates.
+ */
+class LUAMACHINE_API FLuaTrace : public ILuaHookListener
+{
+public:
+	FLuaTrace();
+
+	/* call/return hook events */
+	void OnCall(lua_State* L, lua_Debug* ar, const bool bTailCall);
+	void OnReturn(lua_State* L, lua_Debug* ar);
+
+	virtual int32 GetHookMask() const override { return LUA_MASKCALL | LUA_MASKRET; }
+	virtual void OnLuaHook(lua_State* L, lua_Debug* ar) override;
+
+	/* end the scopes left open by errors caught outside of Lua or by yields to C++ */
+	void CloseOpenEvents();
+
+	void Reset();
+
+	/* publish the counters (sums of all of the LuaStates) */
+	static void UpdateCounters(const int64 UsedMemory, const float GCPause, const int32 NumScheduledCoroutines);
+
+private:
+#if LUAMACHINE_TRACE_ENABLED
+	uint32 GetEventType(lua_State* L, lua_Debug* ar);
+
+	FLuaHookStringInterner Strings;
+	// interned source (or C function name) and linedefined
+	TMap<TPair<int32, int32>, uint32> EventTypes;
+
+	/* close the scopes from the top of the stack down to Index (included) */
+	void CloseEvents(const int32 Index);
+#endif
+
+	struct FOpenEvent
+	{
+		lua_State* Thread;
+		const void* Function;
+	};
+
+	// the scopes must be nested on the trace timeline, so coroutines resumed from Lua share this stack with their resumer:
+	// the unwound functions of caught errors (no return hook is called for them) and the functions of yielded coroutines
+	// are closed with the first function below them that returns
+	TArray<FOpenEvent> OpenEvents;
+};
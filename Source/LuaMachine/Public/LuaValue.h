@@ -4,7 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "UObject/NoExportTypes.h"
-#include "ThirdParty/lua/lua.hpp"
+#include "LuaCompat.h"
 #include "Serialization/JsonSerializer.h"
 #include "LuaValue.generated.h"
 
@@ -43,6 +43,8 @@ public class LuaMachineEditor : ModuleRules
                 "Projects",
                 "InputCore",
                 "EditorStyle",
+                "DirectoryWatcher",
+                "Json",
                 "LuaMachine"
             }
             );
@@ -0,0 +1,156 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "LuaCompileCommandlet.h"
+#include "LuaCode.h"
+#include "LuaState.h"
+#include "LuaByteCodeCompiler.h"
+#include "LuaByteCodeManifest.h"
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#if ENGINE_MAJOR_VERSION >= 5 && ENGINE_MINOR_VERSION > 0
+#include "AssetRegistry/AssetRegistryModule.h"
+#else
+#include "AssetRegistryModule.h"
+#endif
+
+ULuaCompileCommandlet::ULuaCompileCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 ULuaCompileCommandlet::Main(const FString& Params)
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	FString OutputDirectory = FLuaByteCodeManifest::GetDefaultDirectory();
+	FParse::Value(*Params, TEXT("Output="), OutputDirectory);
+	const bool bStripDebugInfo = !FParse::Param(*Params, TEXT("NoStrip"));
+	const bool bSkipAssets = FParse::Param(*Params, TEXT("SkipAssets"));
+	const bool bSkipFiles = FParse::Param(*Params, TEXT("SkipFiles"));
+
+	TArray<FLuaByteCodeCompileJob> AssetJobs;
+	TArray<FLuaByteCodeCompileJob> FileJobs;
+	TArray<FString> RelativeFilenames;
+
+	if (!bSkipAssets)
+	{
+		IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+		AssetRegistry.SearchAllAssets(true);
+
+		TArray<FAssetData> Assets;
+#if ENGINE_MAJOR_VERSION >= 5 && ENGINE_MINOR_VERSION > 0
+		AssetRegistry.GetAssetsByClass(ULuaCode::StaticClass()->GetClassPathName(), Assets);
+#else
+		AssetRegistry.GetAssetsByClass(ULuaCode::StaticClass()->GetFName(), Assets);
+#endif
+
+		// assets can only be loaded from the game thread, the sources are then compiled in parallel
+		for (const FAssetData& AssetData : Assets)
+		{
+			ULuaCode* LuaCode = Cast<ULuaCode>(AssetData.GetAsset());
+			if (LuaCode && !LuaCode->Code.IsEmpty())
+			{
+				AssetJobs.Add(FLuaByteCodeCompileJob(LuaCode->GetPathName(), LuaCode->Code.ToString()));
+			}
+		}
+	}
+
+	if (!bSkipFiles)
+	{
+		const FString ContentDirectory = FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir());
+		const FString FullOutputDirectory = FPaths::ConvertRelativePathToFull(OutputDirectory);
+
+		TArray<FString> Filenames;
+		IFileManager::Get().FindFilesRecursive(Filenames, *ContentDirectory, TEXT("*.lua"), true, false);
+
+		for (const FString& Filename : Filenames)
+		{
+			if (Filename.StartsWith(FullOutputDirectory))
+			{
+				continue;
+			}
+			FString RelativeFilename = Filename;
+			FPaths::MakePathRelativeTo(RelativeFilename, *ContentDirectory);
+			RelativeFilenames.Add(RelativeFilename);
+			FileJobs.AddDefaulted_GetRef().CodePath = Filename;
+		}
+
+		ParallelFor(FileJobs.Num(), [&](int32 Index)
+			{
+				if (!FFileHelper::LoadFileToArray(FileJobs[Index].Code, *FileJobs[Index].CodePath))
+				{
+					FileJobs[Index].Error = TEXT("unable to read file");
+				}
+			});
+	}
+
+	int32 Errors = 0;
+	for (int32 Index = FileJobs.Num() - 1; Index >= 0; Index--)
+	{
+		if (!FileJobs[Index].Error.IsEmpty())
+		{
+			UE_LOG(LogLuaMachine, Error, TEXT("%s: %s"), *FileJobs[Index].CodePath, *FileJobs[Index].Error);
+			Errors++;
+			FileJobs.RemoveAt(Index);
+			RelativeFilenames.RemoveAt(Index);
+		}
+	}
+
+	TArray<FLuaByteCodeCompileJob> Jobs = MoveTemp(AssetJobs);
+	const int32 FirstFileJob = Jobs.Num();
+	Jobs.Append(MoveTemp(FileJobs));
+
+	FLuaByteCodeCompiler::CompileBatch(Jobs, bStripDebugInfo);
+
+	for (const FLuaByteCodeCompileJob& Job : Jobs)
+	{
+		if (!Job.bSuccess)
+		{
+			UE_LOG(LogLuaMachine, Error, TEXT("%s: %s"), *Job.CodePath, *Job.Error);
+			Errors++;
+		}
+	}
+
+	if (Jobs.Num() > FirstFileJob)
+	{
+		FLuaByteCodeManifest Manifest;
+		Manifest.Load(OutputDirectory);
+
+		for (int32 Index = FirstFileJob; Index < Jobs.Num(); Index++)
+		{
+			const FLuaByteCodeCompileJob& Job = Jobs[Index];
+			if (!Job.bSuccess)
+			{
+				continue;
+			}
+
+			const FString& RelativeFilename = RelativeFilenames[Index - FirstFileJob];
+			FLuaByteCodeManifestEntry Entry;
+			Entry.ByteCodeFilename = FPaths::ChangeExtension(RelativeFilename, TEXT("luac"));
+			Entry.SourceHash = FLuaByteCodeManifest::HashSource(Job.Code);
+
+			if (!FFileHelper::SaveArrayToFile(Job.ByteCode, *FPaths::Combine(OutputDirectory, Entry.ByteCodeFilename)))
+			{
+				UE_LOG(LogLuaMachine, Error, TEXT("Unable to write bytecode for %s"), *Job.CodePath);
+				Errors++;
+				continue;
+			}
+			Manifest.Add(RelativeFilename, Entry);
+		}
+
+		if (!Manifest.Save())
+		{
+			UE_LOG(LogLuaMachine, Error, TEXT("Unable to write Lua bytecode manifest in %s"), *OutputDirectory);
+			Errors++;
+		}
+	}
+
+	UE_LOG(LogLuaMachine, Display, TEXT("LuaCompile: %d assets, %d files, %d errors (%.2f seconds)"), FirstFileJob, Jobs.Num() - FirstFileJob, Errors, FPlatformTime::Seconds() - StartTime);
+
+	return Errors > 0 ? 1 : 0;
+}
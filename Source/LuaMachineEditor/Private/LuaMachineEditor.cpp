@@ -18,6 +18,7 @@
 #include "Widgets/Layout/SScrollBox.h"
 #include "LuaUserDataObject.h"
 #include "LuaCodeFactory.h"
+#include "DirectoryWatcherModule.h"
 
 #define LOCTEXT_NAMESPACE "FLuaMachineEditorModule"
 
@@ -84,6 +85,51 @@ void FLuaMachineEditorModule::OnPostEngineInit()
 
 	//Add LuaCode to Filters.
 	RegisterAssetTypeAction(AssetTools, MakeShareable(new FLuaCodeAssetTypeActions(LuaMachineAssetCategoryBit)));
+
+	// hot reload of modified scripts
+	FDirectoryWatcherModule& DirectoryWatcherModule = FModuleManager::LoadModuleChecked<FDirectoryWatcherModule>(TEXT("DirectoryWatcher"));
+	if (IDirectoryWatcher* DirectoryWatcher = DirectoryWatcherModule.Get())
+	{
+		DirectoryWatcher->RegisterDirectoryChangedCallback_Handle(FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir()), IDirectoryWatcher::FDirectoryChanged::CreateRaw(this, &FLuaMachineEditorModule::OnContentDirectoryChanged), ContentDirectoryWatcherHandle);
+	}
+}
+
+void FLuaMachineEditorModule::OnContentDirectoryChanged(const TArray<FFileChangeData>& FileChanges)
+{
+	const FString ContentDirectory = FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir());
+
+	TSet<FString> ChangedFiles;
+	for (const FFileChangeData& FileChange : FileChanges)
+	{
+		if (FileChange.Action == FFileChangeData::FCA_Removed || !FileChange.Filename.EndsWith(TEXT(".lua")))
+		{
+			continue;
+		}
+
+		FString RelativeFilename = FPaths::ConvertRelativePathToFull(FileChange.Filename);
+		if (FPaths::MakePathRelativeTo(RelativeFilename, *ContentDirectory))
+		{
+			ChangedFiles.Add(RelativeFilename);
+		}
+	}
+
+	if (ChangedFiles.Num() == 0)
+	{
+		return;
+	}
+
+	for (ULuaState* LuaState : FLuaMachineModule::Get().GetRegisteredLuaStates())
+	{
+		if (!LuaState->bHotReloadModules)
+		{
+			continue;
+		}
+
+		for (const FString& ChangedFile : ChangedFiles)
+		{
+			LuaState->HotReloadFile(ChangedFile);
+		}
+	}
 }
 
 TSharedPtr<FSlateStyleSet> FLuaMachineEditorModule::GetStyleSet()
@@ -260,6 +306,12 @@ class SLuaMachineDebugger : public SCompoundWidget, public FGCObject
 			}
 		}
 
+		for (const TPair<FString, FLuaStartupClassStats>& Pair : FLuaMachineModule::Get().GetStartupStatsByClass())
+		{
+			const FLuaStartupStats Average = Pair.Value.GetAverage();
+			DebugTextContext += FString::Printf(TEXT("%s startup (%d states) (average: %.2f ms, %lldk) (max: %.2f ms) %s\n"), *Pair.Key, Pair.Value.NumStates, Average.Time, Average.Bytes / 1024, Pair.Value.MaxTime, *Average.ToString());
+		}
+
 		if (SelectedLuaState)
 		{
 			TArray<UObject*> Referencers;
@@ -519,6 +571,18 @@ void FLuaMachineEditorModule::ShutdownModule()
 {
 	FCoreDelegates::OnPostEngineInit.RemoveAll(this);
 
+	if (ContentDirectoryWatcherHandle.IsValid())
+	{
+		if (FDirectoryWatcherModule* DirectoryWatcherModule = FModuleManager::GetModulePtr<FDirectoryWatcherModule>(TEXT("DirectoryWatcher")))
+		{
+			if (IDirectoryWatcher* DirectoryWatcher = DirectoryWatcherModule->Get())
+			{
+				DirectoryWatcher->UnregisterDirectoryChangedCallback_Handle(FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir()), ContentDirectoryWatcherHandle);
+			}
+		}
+		ContentDirectoryWatcherHandle.Reset();
+	}
+
 	// Unregister all the asset types that we registered
 	if (FModuleManager::Get().IsModuleLoaded("AssetTools"))
 	{
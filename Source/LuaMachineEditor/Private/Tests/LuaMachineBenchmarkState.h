@@ -0,0 +1,28 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LuaState.h"
+#include "LuaMachineBenchmarkState.generated.h"
+
+/* LuaState used by the LuaMachine.Benchmarks automation tests */
+UCLASS(NotBlueprintable, NotBlueprintType, Transient, HideDropdown)
+class ULuaMachineBenchmarkState : public ULuaState
+{
+	GENERATED_BODY()
+
+public:
+	ULuaMachineBenchmarkState()
+	{
+		bLogError = true;
+		bEnableCoroutineScheduler = false;
+		Table.Add(TEXT("benchmark_add"), FLuaValue::Function(GET_FUNCTION_NAME_CHECKED(ULuaMachineBenchmarkState, BenchmarkAdd)));
+	}
+
+	UFUNCTION()
+	int32 BenchmarkAdd(int32 A, int32 B) const
+	{
+		return A + B;
+	}
+};
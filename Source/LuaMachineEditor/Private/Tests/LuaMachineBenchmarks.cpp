@@ -0,0 +1,497 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "LuaMachineBenchmarkState.h"
+#include "LuaBlueprintFunctionLibrary.h"
+#include "LuaCode.h"
+#include "Dom/JsonObject.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/App.h"
+#include "Misc/EngineVersion.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+#if ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 5)
+#define LUAMACHINE_BENCHMARK_FLAGS (EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+#else
+#define LUAMACHINE_BENCHMARK_FLAGS (EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+#endif
+
+/**
+ * Times a set of operations and saves the results (ns per operation) in Saved/Benchmarks/LuaMachine/<Suite>.json (-LuaBenchmarkDir=<Directory> to change it).
+ * The iterations can be scaled with -LuaBenchmarkScale=<Multiplier>.
+ */
+class FLuaMachineBenchmark
+{
+public:
+	FLuaMachineBenchmark(FAutomationTestBase& InTest, const FString& InSuite) : Test(InTest), Suite(InSuite)
+	{
+		Scale = 1;
+		FParse::Value(FCommandLine::Get(), TEXT("LuaBenchmarkScale="), Scale);
+	}
+
+	/* run Callable Iterations times (after a warm up), each call performs OpsPerIteration operations */
+	template<typename CallableType>
+	void Run(const FString& Name, const int32 Iterations, CallableType&& Callable, const int32 OpsPerIteration = 1)
+	{
+		const int32 ScaledIterations = FMath::Max(FMath::RoundToInt(Iterations * Scale), 1);
+
+		for (int32 Iteration = 0; Iteration < FMath::Max(ScaledIterations / 10, 1); Iteration++)
+		{
+			Callable();
+		}
+
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Iteration = 0; Iteration < ScaledIterations; Iteration++)
+		{
+			Callable();
+		}
+		const double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+		FResult Result;
+		Result.Name = Name;
+		Result.Operations = (int64)ScaledIterations * OpsPerIteration;
+		Result.Milliseconds = Elapsed * 1000;
+		Result.NanosecondsPerOperation = Elapsed * 1000000000 / Result.Operations;
+		Results.Add(Result);
+
+		Test.AddInfo(FString::Printf(TEXT("%s: %.1f ns/op (%lld ops in %.3f ms)"), *Name, Result.NanosecondsPerOperation, Result.Operations, Result.Milliseconds));
+#if ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1)
+		Test.AddTelemetryData(Name, Result.NanosecondsPerOperation, Suite);
+#endif
+	}
+
+	bool Save() const
+	{
+		TSharedRef<FJsonObject> JsonObject = MakeShared<FJsonObject>();
+		JsonObject->SetStringField(TEXT("suite"), Suite);
+		JsonObject->SetStringField(TEXT("timestamp"), FDateTime::UtcNow().ToIso8601());
+		JsonObject->SetStringField(TEXT("engine"), FEngineVersion::Current().ToString());
+		JsonObject->SetStringField(TEXT("platform"), FPlatformProperties::IniPlatformName());
+		JsonObject->SetStringField(TEXT("configuration"), LexToString(FApp::GetBuildConfiguration()));
+		JsonObject->SetStringField(TEXT("lua"), UTF8_TO_TCHAR(LUA_RELEASE));
+		JsonObject->SetBoolField(TEXT("luajit"), LUAMACHINE_LUAJIT != 0);
+		TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("LuaMachine"));
+		JsonObject->SetStringField(TEXT("plugin"), Plugin.IsValid() ? Plugin->GetDescriptor().VersionName : TEXT(""));
+
+		TArray<TSharedPtr<FJsonValue>> JsonResults;
+		for (const FResult& Result : Results)
+		{
+			TSharedRef<FJsonObject> JsonResult = MakeShared<FJsonObject>();
+			JsonResult->SetStringField(TEXT("name"), Result.Name);
+			JsonResult->SetNumberField(TEXT("operations"), (double)Result.Operations);
+			JsonResult->SetNumberField(TEXT("total_ms"), Result.Milliseconds);
+			JsonResult->SetNumberField(TEXT("ns_per_op"), Result.NanosecondsPerOperation);
+			JsonResults.Add(MakeShared<FJsonValueObject>(JsonResult));
+		}
+		JsonObject->SetArrayField(TEXT("results"), JsonResults);
+
+		FString Json;
+		TSharedRef<TJsonWriter<>> JsonWriter = TJsonWriterFactory<>::Create(&Json);
+		FJsonSerializer::Serialize(JsonObject, JsonWriter);
+
+		FString Directory = FPaths::ProjectSavedDir() / TEXT("Benchmarks") / TEXT("LuaMachine");
+		FParse::Value(FCommandLine::Get(), TEXT("LuaBenchmarkDir="), Directory);
+		const FString Filename = Directory / Suite + TEXT(".json");
+		if (!FFileHelper::SaveStringToFile(Json, *Filename, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM))
+		{
+			Test.AddError(FString::Printf(TEXT("unable to save benchmark results to %s"), *Filename));
+			return false;
+		}
+		Test.AddInfo(FString::Printf(TEXT("benchmark results saved to %s"), *FPaths::ConvertRelativePathToFull(Filename)));
+		return true;
+	}
+
+private:
+	struct FResult
+	{
+		FString Name;
+		int64 Operations;
+		double Milliseconds;
+		double NanosecondsPerOperation;
+	};
+
+	FAutomationTestBase& Test;
+	FString Suite;
+	float Scale;
+	TArray<FResult> Results;
+};
+
+/* the states are rooted for the duration of the benchmark */
+static ULuaMachineBenchmarkState* LuaMachineBenchmarkCreateState(TMap<FString, ULuaCode*> RequireTable = TMap<FString, ULuaCode*>())
+{
+	ULuaMachineBenchmarkState* LuaState = NewObject<ULuaMachineBenchmarkState>(GetTransientPackage());
+	LuaState->RequireTable = RequireTable;
+	LuaState->AddToRoot();
+	if (!LuaState->GetLuaState(nullptr))
+	{
+		LuaState->RemoveFromRoot();
+		return nullptr;
+	}
+	return LuaState;
+}
+
+/* unregister the state, its VM is closed by the next garbage collection */
+static void LuaMachineBenchmarkDestroyState(ULuaMachineBenchmarkState* LuaState)
+{
+	LuaState->DestroyState();
+	LuaState->RemoveFromRoot();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkGlobalCall, "LuaMachine.Benchmarks.GlobalCall", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkGlobalCall::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	TestTrue(TEXT("setup"), LuaState->RunString(TEXT("function bench_noop(a, b) return a end; function bench_concat(a, b) return a .. b end; return true")).ToBool());
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("GlobalCall"));
+
+	TArray<FLuaValue> IntegerArgs = { FLuaValue(1), FLuaValue(2) };
+	Benchmark.Run(TEXT("GlobalCall integers"), 100000, [&]()
+		{
+			LuaState->GlobalCall(TEXT("bench_noop"), IntegerArgs);
+		});
+
+	TArray<FLuaValue> StringArgs = { FLuaValue(TEXT("benchmark")), FLuaValue(TEXT("string")) };
+	Benchmark.Run(TEXT("GlobalCall strings"), 100000, [&]()
+		{
+			LuaState->GlobalCall(TEXT("bench_concat"), StringArgs);
+		});
+
+	Benchmark.Run(TEXT("GlobalCallMulti integers"), 100000, [&]()
+		{
+			LuaState->GlobalCallMulti(TEXT("bench_noop"), IntegerArgs);
+		});
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkConversions, "LuaMachine.Benchmarks.Conversions", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkConversions::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	TArray<TPair<FString, FLuaValue>> Values;
+	Values.Emplace(TEXT("Nil"), FLuaValue());
+	Values.Emplace(TEXT("Bool"), FLuaValue(true));
+	Values.Emplace(TEXT("Integer"), FLuaValue(17));
+	Values.Emplace(TEXT("Number"), FLuaValue(17.5));
+	Values.Emplace(TEXT("String"), FLuaValue(TEXT("benchmark")));
+	Values.Emplace(TEXT("String 1KB"), FLuaValue(FString::ChrN(1024, TEXT('x'))));
+	Values.Emplace(TEXT("Table"), LuaState->CreateLuaTable());
+	Values.Emplace(TEXT("Function"), LuaState->RunString(TEXT("return function() end")));
+	Values.Emplace(TEXT("UObject"), FLuaValue(LuaState));
+	Values.Emplace(TEXT("UFunction"), FLuaValue::FunctionOfObject(LuaState, GET_FUNCTION_NAME_CHECKED(ULuaMachineBenchmarkState, BenchmarkAdd)));
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("Conversions"));
+
+	for (TPair<FString, FLuaValue>& Pair : Values)
+	{
+		FLuaValue& Value = Pair.Value;
+		Benchmark.Run(TEXT("FromLuaValue ") + Pair.Key, 100000, [&]()
+			{
+				LuaState->FromLuaValue(Value);
+				LuaState->Pop();
+			});
+
+		LuaState->FromLuaValue(Value);
+		Benchmark.Run(TEXT("ToLuaValue ") + Pair.Key, 100000, [&]()
+			{
+				FLuaValue Converted = LuaState->ToLuaValue(-1);
+			});
+		LuaState->Pop();
+	}
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkUFunctionCall, "LuaMachine.Benchmarks.UFunctionCall", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkUFunctionCall::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	TestTrue(TEXT("setup"), LuaState->RunString(TEXT(R"(
+local function lua_add(a, b) return a + b end
+function bench_lua_function(n) for i = 1, n do lua_add(i, 2) end end
+function bench_ufunction(n) local add = benchmark_add; for i = 1, n do add(i, 2) end end
+return benchmark_add(1, 2) == 3)")).ToBool());
+
+	const int32 CallsPerIteration = 1000;
+	TArray<FLuaValue> Args = { FLuaValue(CallsPerIteration) };
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("UFunctionCall"));
+
+	// baseline
+	Benchmark.Run(TEXT("Lua function call"), 1000, [&]()
+		{
+			LuaState->GlobalCall(TEXT("bench_lua_function"), Args);
+		}, CallsPerIteration);
+
+	Benchmark.Run(TEXT("UFunction __call"), 100, [&]()
+		{
+			LuaState->GlobalCall(TEXT("bench_ufunction"), Args);
+		}, CallsPerIteration);
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkStructs, "LuaMachine.Benchmarks.Structs", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkStructs::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("Structs"));
+
+	// numeric fields only
+	FLuaMemoryReport MemoryReport;
+	Benchmark.Run(TEXT("StructToLuaTable FLuaMemoryReport"), 10000, [&]()
+		{
+			FLuaValue Table = LuaState->StructToLuaValue(MemoryReport);
+		});
+
+	FLuaFunctionStat FunctionStat;
+	FunctionStat.Name = TEXT("benchmark");
+	FunctionStat.Source = TEXT("Benchmarks/benchmark.lua");
+	Benchmark.Run(TEXT("StructToLuaTable FLuaFunctionStat"), 10000, [&]()
+		{
+			FLuaValue Table = LuaState->StructToLuaValue(FunctionStat);
+		});
+
+	FLuaValue FunctionStatTable = LuaState->StructToLuaValue(FunctionStat);
+	Benchmark.Run(TEXT("LuaTableToStruct FLuaFunctionStat"), 10000, [&]()
+		{
+			FLuaFunctionStat Struct = LuaState->LuaValueToStruct<FLuaFunctionStat>(FunctionStatTable);
+		});
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkJson, "LuaMachine.Benchmarks.Json", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkJson::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	FString Json = TEXT("{\"name\": \"benchmark\", \"enabled\": true, \"scale\": 1.5, \"items\": [");
+	for (int32 Index = 0; Index < 32; Index++)
+	{
+		Json += FString::Printf(TEXT("%s{\"id\": %d, \"label\": \"item%d\", \"position\": [%d.5, %d.25, 0]}"), Index > 0 ? TEXT(", ") : TEXT(""), Index, Index, Index, Index);
+	}
+	Json += TEXT("], \"nested\": {\"a\": {\"b\": {\"c\": \"deep\"}}}}");
+
+	FLuaValue Value;
+	if (!TestTrue(TEXT("ValueFromJson"), LuaState->ValueFromJson(Json, Value)))
+	{
+		LuaMachineBenchmarkDestroyState(LuaState);
+		return false;
+	}
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("Json"));
+
+	Benchmark.Run(TEXT("ValueFromJson"), 1000, [&]()
+		{
+			FLuaValue Parsed;
+			LuaState->ValueFromJson(Json, Parsed);
+		});
+
+	Benchmark.Run(TEXT("LuaValueToJson"), 1000, [&]()
+		{
+			ULuaBlueprintFunctionLibrary::LuaValueToJson(Value);
+		});
+
+	Benchmark.Run(TEXT("Json round trip"), 1000, [&]()
+		{
+			FLuaValue Parsed;
+			LuaState->ValueFromJson(ULuaBlueprintFunctionLibrary::LuaValueToJson(Value), Parsed);
+		});
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkLuaValueCopy, "LuaMachine.Benchmarks.LuaValueCopy", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkLuaValueCopy::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	TArray<TPair<FString, FLuaValue>> Values;
+	Values.Emplace(TEXT("Integer"), FLuaValue(17));
+	Values.Emplace(TEXT("String"), FLuaValue(TEXT("benchmark")));
+	Values.Emplace(TEXT("Table"), LuaState->CreateLuaTable());
+	Values.Emplace(TEXT("UObject"), FLuaValue(LuaState));
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("LuaValueCopy"));
+
+	for (TPair<FString, FLuaValue>& Pair : Values)
+	{
+		const FLuaValue& Value = Pair.Value;
+		Benchmark.Run(TEXT("Copy ") + Pair.Key, 100000, [&]()
+			{
+				FLuaValue Copy(Value);
+			});
+
+		FLuaValue Target;
+		Benchmark.Run(TEXT("Assign ") + Pair.Key, 100000, [&]()
+			{
+				Target = Value;
+			});
+	}
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkStateCreation, "LuaMachine.Benchmarks.StateCreation", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkStateCreation::RunTest(const FString& Parameters)
+{
+	TArray<ULuaMachineBenchmarkState*> LuaStates;
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("StateCreation"));
+
+	Benchmark.Run(TEXT("State creation"), 100, [&]()
+		{
+			LuaStates.Add(LuaMachineBenchmarkCreateState());
+		});
+
+	for (ULuaMachineBenchmarkState* LuaState : LuaStates)
+	{
+		if (LuaState)
+		{
+			LuaMachineBenchmarkDestroyState(LuaState);
+		}
+	}
+	// close the VMs now, they would skew the next suites
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	return TestFalse(TEXT("all of the states created"), LuaStates.Contains(nullptr)) && Benchmark.Save();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkRequire, "LuaMachine.Benchmarks.Require", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkRequire::RunTest(const FString& Parameters)
+{
+	ULuaCode* LuaCode = NewObject<ULuaCode>(GetTransientPackage());
+	LuaCode->Code = FText::FromString(TEXT(R"(
+local M = {}
+function M.add(a, b) return a + b end
+function M.sub(a, b) return a - b end
+M.name = "benchmark_module"
+return M)"));
+
+	TMap<FString, ULuaCode*> RequireTable;
+	RequireTable.Add(TEXT("benchmark_module"), LuaCode);
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState(RequireTable);
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	TestTrue(TEXT("setup"), LuaState->RunString(TEXT(R"(
+function bench_require(n) for i = 1, n do package.loaded.benchmark_module = nil; require("benchmark_module") end end
+function bench_require_cached(n) for i = 1, n do require("benchmark_module") end end
+return require("benchmark_module").add(1, 2) == 3)")).ToBool());
+
+	const int32 RequiresPerIteration = 100;
+	TArray<FLuaValue> Args = { FLuaValue(RequiresPerIteration) };
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("Require"));
+
+	Benchmark.Run(TEXT("require"), 100, [&]()
+		{
+			LuaState->GlobalCall(TEXT("bench_require"), Args);
+		}, RequiresPerIteration);
+
+	Benchmark.Run(TEXT("require cached"), 1000, [&]()
+		{
+			LuaState->GlobalCall(TEXT("bench_require_cached"), Args);
+		}, RequiresPerIteration);
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineBenchmarkCoroutines, "LuaMachine.Benchmarks.Coroutines", LUAMACHINE_BENCHMARK_FLAGS)
+
+bool FLuaMachineBenchmarkCoroutines::RunTest(const FString& Parameters)
+{
+	ULuaMachineBenchmarkState* LuaState = LuaMachineBenchmarkCreateState();
+	if (!TestNotNull(TEXT("LuaState"), LuaState))
+	{
+		return false;
+	}
+
+	FLuaValue Coroutine = LuaState->RunString(TEXT("return coroutine.create(function(...) while true do coroutine.yield(...) end end)"));
+	if (!TestTrue(TEXT("coroutine"), Coroutine.Type == ELuaValueType::Thread))
+	{
+		LuaMachineBenchmarkDestroyState(LuaState);
+		return false;
+	}
+
+	FLuaMachineBenchmark Benchmark(*this, TEXT("Coroutines"));
+
+	TArray<FLuaValue> NoArgs;
+	Benchmark.Run(TEXT("Resume"), 100000, [&]()
+		{
+			ULuaBlueprintFunctionLibrary::LuaValueResumeMulti(Coroutine, NoArgs);
+		});
+
+	TArray<FLuaValue> Args = { FLuaValue(1), FLuaValue(TEXT("benchmark")) };
+	Benchmark.Run(TEXT("Resume with arguments"), 100000, [&]()
+		{
+			ULuaBlueprintFunctionLibrary::LuaValueResumeMulti(Coroutine, Args);
+		});
+
+	const bool bSaved = Benchmark.Save();
+	LuaMachineBenchmarkDestroyState(LuaState);
+	return bSaved;
+}
+
+#endif
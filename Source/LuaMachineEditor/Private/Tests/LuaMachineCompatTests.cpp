@@ -0,0 +1,135 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "LuaCompat.h"
+
+#if ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 5)
+#define LUAMACHINE_COMPAT_TEST_FLAGS (EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+#else
+#define LUAMACHINE_COMPAT_TEST_FLAGS (EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+#endif
+
+/* the LuaCompat.h shims on a bare lua_State (no LuaState), so they are checked against the Lua flavour the plugin is built with */
+
+static int LuaCompatTest_Writer(lua_State* L, const void* Ptr, size_t Size, void* UserData)
+{
+	static_cast<TArray<uint8>*>(UserData)->Append(static_cast<const uint8*>(Ptr), Size);
+	return 0;
+}
+
+static int LuaCompatTest_IsYieldable(lua_State* L)
+{
+	lua_pushboolean(L, lua_isyieldable(L));
+	return 1;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineCompatResume, "LuaMachine.Compat.Resume", LUAMACHINE_COMPAT_TEST_FLAGS)
+
+bool FLuaMachineCompatResume::RunTest(const FString& Parameters)
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+
+	lua_State* Thread = lua_newthread(L);
+	luaL_loadstring(Thread, "local a = coroutine.yield(1, 2) return a, a + 1, a + 2");
+
+	int NResults = 0;
+	TestEqual(TEXT("yield status"), LuaCompat_Resume(Thread, L, 0, &NResults), LUA_YIELD);
+	TestEqual(TEXT("yielded values"), NResults, 2);
+	TestEqual(TEXT("first yielded value"), (int32)lua_tointeger(Thread, -2), 1);
+	TestEqual(TEXT("second yielded value"), (int32)lua_tointeger(Thread, -1), 2);
+	lua_pop(Thread, NResults);
+
+	lua_pushinteger(Thread, 10);
+	TestEqual(TEXT("return status"), LuaCompat_Resume(Thread, L, 1, &NResults), LUA_OK);
+	TestEqual(TEXT("returned values"), NResults, 3);
+	TestEqual(TEXT("last returned value"), (int32)lua_tointeger(Thread, -1), 12);
+
+	lua_close(L);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineCompatIsYieldable, "LuaMachine.Compat.IsYieldable", LUAMACHINE_COMPAT_TEST_FLAGS)
+
+bool FLuaMachineCompatIsYieldable::RunTest(const FString& Parameters)
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+
+	TestFalse(TEXT("main thread"), lua_isyieldable(L) != 0);
+
+	lua_pushcfunction(L, LuaCompatTest_IsYieldable);
+	lua_setglobal(L, "is_yieldable");
+	lua_State* Thread = lua_newthread(L);
+	luaL_loadstring(Thread, "return is_yieldable()");
+
+	int NResults = 0;
+	TestEqual(TEXT("resume status"), LuaCompat_Resume(Thread, L, 0, &NResults), LUA_OK);
+	TestTrue(TEXT("coroutine"), NResults == 1 && lua_toboolean(Thread, -1) != 0);
+
+	lua_close(L);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineCompatNewUserData, "LuaMachine.Compat.NewUserData", LUAMACHINE_COMPAT_TEST_FLAGS)
+
+bool FLuaMachineCompatNewUserData::RunTest(const FString& Parameters)
+{
+	lua_State* L = luaL_newstate();
+
+	void* UserData = LuaCompat_NewUserData(L, 24);
+	TestNotNull(TEXT("userdata"), UserData);
+	TestEqual(TEXT("type"), lua_type(L, -1), LUA_TUSERDATA);
+	TestEqual(TEXT("size"), (int32)lua_rawlen(L, -1), 24);
+	TestTrue(TEXT("block"), lua_touserdata(L, -1) == UserData);
+#if LUAMACHINE_LUA54
+	// no user value slot must be reserved
+	TestEqual(TEXT("user values"), lua_getiuservalue(L, -1, 1), LUA_TNONE);
+	lua_pop(L, 1);
+#endif
+
+	lua_close(L);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaMachineCompatDump, "LuaMachine.Compat.Dump", LUAMACHINE_COMPAT_TEST_FLAGS)
+
+bool FLuaMachineCompatDump::RunTest(const FString& Parameters)
+{
+	lua_State* L = luaL_newstate();
+
+	const char* Code = "local first = 17\nlocal second = 25\nreturn first + second";
+	TArray<uint8> ByteCode;
+	TArray<uint8> StrippedByteCode;
+
+	luaL_loadstring(L, Code);
+	TestEqual(TEXT("dump"), LuaCompat_Dump(L, LuaCompatTest_Writer, &ByteCode, 0), 0);
+	TestEqual(TEXT("stripped dump"), LuaCompat_Dump(L, LuaCompatTest_Writer, &StrippedByteCode, 1), 0);
+	lua_pop(L, 1);
+
+#if LUAMACHINE_LUAJIT
+	// the strip argument is ignored
+	TestEqual(TEXT("stripped size"), StrippedByteCode.Num(), ByteCode.Num());
+#else
+	TestTrue(TEXT("stripped size"), StrippedByteCode.Num() > 0 && StrippedByteCode.Num() < ByteCode.Num());
+#endif
+
+	for (const TArray<uint8>* Chunk : { &ByteCode, &StrippedByteCode })
+	{
+		if (TestEqual(TEXT("load"), luaL_loadbuffer(L, reinterpret_cast<const char*>(Chunk->GetData()), Chunk->Num(), "=compat"), LUA_OK) &&
+			TestEqual(TEXT("call"), lua_pcall(L, 0, 1, 0), LUA_OK))
+		{
+			TestEqual(TEXT("result"), (int32)lua_tointeger(L, -1), 42);
+		}
+		lua_settop(L, 0);
+	}
+
+	lua_close(L);
+	return true;
+}
+
+#endif
@@ -0,0 +1,23 @@
+// Copyright 2018-2023 - Roberto De Ioris
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "LuaCompileCommandlet.generated.h"
+
+/**
+ * Validates every LuaCode asset and precompiles every Content/ script to bytecode (in parallel).
+ * Usage: -run=LuaCompile [-Output=<directory>] [-NoStrip] [-SkipAssets] [-SkipFiles]
+ * Returns non-zero if any script has syntax errors.
+ */
+UCLASS()
+class LUAMACHINEEDITOR_API ULuaCompileCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	ULuaCompileCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -16,6 +16,7 @@
 #include "IAssetTools.h"
 #include "IAssetTypeActions.h"
 #include "AssetTypeCategories.h"
+#include "IDirectoryWatcher.h"
 
 class FLuaMachineEditorModule : public IModuleInterface
 {
@@ -38,4 +39,7 @@ private:
 	EAssetTypeCategories::Type LuaMachineAssetCategoryBit;
 	/** All created asset type actions.  Cached here so that we can unregister them during shutdown. */
 	TArray< TSharedPtr<IAssetTypeActions> > CreatedAssetTypeActions;
+
+	void OnContentDirectoryChanged(const TArray<FFileChangeData>& FileChanges);
+	FDelegateHandle ContentDirectoryWatcherHandle;
 };